@@ -0,0 +1,1095 @@
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "include/common.h"
+#include "include/vec3.h"
+#include "include/ray.h"
+#include "include/bbox.h"
+#include "include/tri.h"
+#include "include/octree.h"
+#include "include/model.h"
+#include "include/light.h"
+#include "include/scene.h"
+#include "include/accumulator.h"
+#include "include/wavefront.h"
+#include "include/paging.h"
+#include "include/antialias.h"
+
+// Microbenchmarks for the intersection kernels
+// Every kernel is timed single threaded on fixed, seeded ray sets and checked against a brute-force reference
+#define BENCH_MODEL "models/pillar.obj"
+#define BENCH_SEED 1337
+#define BENCH_RAYS 32768
+#define BENCH_WARMUP 2
+#define BENCH_REPS 9
+// fraction of rays allowed to disagree with the reference, this absorbs ties on shared tri edges
+#define BENCH_MISMATCH_TOLERANCE 0.001
+// side of the frame rendered by the frame benchmarks
+#define BENCH_FRAME_SIZE 256
+// side of the generated checker texture and of the quad it is mapped onto, in texels and world units
+#define BENCH_TEXTURE_SIZE 256
+#define BENCH_TEXTURE_CHECKER 16
+// tris per cluster of the paged pillar, small so it splits into many clusters
+#define BENCH_CLUSTER_TRIS 128
+// paging budget as a fraction of the cluster file, so clusters are evicted and paged in again every frame
+#define BENCH_PAGING_BUDGET 0.5
+#define BENCH_PAGING_FRAMES 4
+// rotated and scaled instances checked against the reference, and instances sharing one mesh in the crowd frame
+#define BENCH_TRANSFORMED 6
+#define BENCH_CROWD 1000
+// side of the crowd frames, every unbinned primary ray tests every instance so they are kept small
+#define BENCH_CROWD_FRAME_SIZE 64
+// frames of each deformation of the refit pillar: bending one side, twisting all of it, then scattering its verts and holding them until the octree is rebuilt
+#define BENCH_REFIT_FRAMES 2
+// ray cache room given to the deforming pillar on top of what earlier sections already hold
+#define BENCH_REFIT_CACHE_MB 32
+
+// keeps the optimizer from discarding kernel results
+static volatile int benchSink;
+
+// Fixed set of rays, shadow rays also carry the distance to the point they were cast at
+class RaySet {
+public:
+	const char *name;
+	std::vector<Ray> rays;
+	std::vector<float> lengths;
+	RaySet (const char *name) : name(name) {}
+};
+
+class BenchStats {
+public:
+	double median, min, spread;
+	size_t rays;
+};
+
+/* brute-force reference intersector, tests every tri of every instance with no acceleration structure
+returns the closest depth and fills in the ray like ModelInstance::rayCast would
+tris of transformed instances are moved into world space instead of the ray into model space */
+static float referenceRayCast(const std::vector<ModelInstance *> &instances, Ray &ray) {
+	float depth = RAY_MISS;
+	for (ModelInstance *instance: instances) {
+		if (instance->transformed) {
+			for (Tri *tri: instance->model->tris) {
+				Vec3 corners[3];
+				for (int v = 0; v < 3; ++v) {
+					corners[v] = Vec3::add(Mat3::transform(instance->linear, tri->verts[v]->pos), instance->pos);
+				}
+				Vec3 normal = Vec3::normalize(Vec3::cross(Vec3::sub(corners[1], corners[0]), Vec3::sub(corners[2], corners[0])));
+				BBox triBounds(corners[0], corners[1]);
+				triBounds += BBox(corners[2], corners[2]);
+				ray.depth = depth;
+				float triDepth = Tri::intersect(corners[0], corners[1], corners[2], normal, triBounds, ray);
+				if (triDepth < depth) {
+					depth = triDepth;
+					ray.meshInfo.normal = normal;
+					ray.tri = tri;
+				}
+			}
+			ray.depth = depth;
+			continue;
+		}
+		Ray subRay = ray;
+		Ray::translate(subRay, Vec3::scale(instance->pos, -1));
+		subRay.depth = depth;
+		for (Tri *tri: instance->model->tris) {
+			tri->rayCast(subRay);
+		}
+		if (subRay.depth < depth) {
+			depth = subRay.depth;
+			Ray::setNonPos(ray, subRay);
+		}
+	}
+	return depth;
+}
+
+static bool referenceOccluded(const std::vector<ModelInstance *> &instances, const Ray &ray, float length) {
+	Ray subRay = ray;
+	return !geqMargin(referenceRayCast(instances, subRay), length);
+}
+
+static BBox instanceBounds(const std::vector<ModelInstance *> &instances) {
+	BBox bounds = instances[0]->bounds();
+	for (ModelInstance *instance: instances) {
+		BBox b = instance->bounds();
+		for (int axis = 0; axis < AXIS_NUM; ++axis) {
+			bounds.min.axis[axis] = std::min(bounds.min.axis[axis], b.min.axis[axis]);
+			bounds.max.axis[axis] = std::max(bounds.max.axis[axis], b.max.axis[axis]);
+		}
+	}
+	return bounds;
+}
+
+// orthographic rays in scanline order over the bounds, like Camera::renderPixel
+static RaySet coherentRays(const BBox &bounds, size_t count) {
+	RaySet set("coherent");
+	int side = std::max(1, (int)std::sqrt((double)count));
+	Vec3 dir = CAMERA_ORTHO_DIR;
+	float height = (bounds.max.axis[AXIS_Z] - bounds.min.axis[AXIS_Z]) + 100;
+	for (int y = 0; y < side; ++y) {
+		for (int x = 0; x < side; ++x) {
+			Vec3 ground(bounds.min.axis[AXIS_X] + (bounds.max.axis[AXIS_X] - bounds.min.axis[AXIS_X]) * (x + 0.5f) / side,
+				bounds.min.axis[AXIS_Y] + (bounds.max.axis[AXIS_Y] - bounds.min.axis[AXIS_Y]) * (y + 0.5f) / side,
+				bounds.min.axis[AXIS_Z]);
+			set.rays.push_back(Ray(Vec3::sub(ground, Vec3::scale(dir, height)), dir));
+			set.lengths.push_back(RAY_MISS);
+		}
+	}
+	return set;
+}
+
+// rays from anywhere around the bounds in any direction
+static RaySet randomRays(const BBox &bounds, size_t count, std::mt19937 &rng) {
+	RaySet set("random");
+	std::uniform_real_distribution<float> unit(-0.5, 1.5);
+	std::normal_distribution<float> normal(0, 1);
+	Vec3 extent = Vec3::sub(bounds.max, bounds.min);
+	for (size_t i = 0; i < count; ++i) {
+		Vec3 origin;
+		for (int axis = 0; axis < AXIS_NUM; ++axis) {
+			origin.axis[axis] = bounds.min.axis[axis] + extent.axis[axis] * unit(rng);
+		}
+		Vec3 dir(normal(rng), normal(rng), normal(rng));
+		set.rays.push_back(Ray(origin, dir));
+		set.lengths.push_back(RAY_MISS);
+	}
+	return set;
+}
+
+// rays from each light to the visible points of the coherent set, built the way Scene::renderRay builds them
+static RaySet shadowRays(const std::vector<ModelInstance *> &instances, const RaySet &coherent, const std::vector<Vec3> &lights, size_t count) {
+	RaySet set("shadow");
+	std::vector<Vec3> points;
+	for (const Ray &source: coherent.rays) {
+		Ray ray = source;
+		float depth = referenceRayCast(instances, ray);
+		if (depth != RAY_MISS) {
+			points.push_back(Vec3::add(ray.origin, Vec3::scale(ray.dir, depth)));
+		}
+	}
+	if (points.size() == 0) {
+		return set;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const Vec3 &light = lights[i % lights.size()];
+		Vec3 lightVec = Vec3::sub(points[(i / lights.size()) % points.size()], light);
+		set.rays.push_back(Ray(light, lightVec));
+		set.lengths.push_back(Vec3::lengthOf(lightVec));
+	}
+	return set;
+}
+
+// median, min and spread of per ray timings in ns
+static BenchStats calcStats(std::vector<double> &samples, size_t count) {
+	std::sort(samples.begin(), samples.end());
+
+	BenchStats stats;
+	stats.rays = count;
+	stats.median = samples[samples.size() / 2];
+	stats.min = samples[0];
+	// median absolute deviation relative to the median
+	std::vector<double> deviations;
+	for (double sample: samples) {
+		deviations.push_back(std::abs(sample - stats.median));
+	}
+	std::sort(deviations.begin(), deviations.end());
+	stats.spread = 100 * deviations[deviations.size() / 2] / stats.median;
+	return stats;
+}
+
+// runs kernel(i) over every ray, BENCH_REPS times after warming up, and reports ns per ray statistics
+template<typename Kernel>
+static BenchStats timeKernel(size_t count, Kernel kernel) {
+	std::vector<double> samples;
+	for (int rep = 0; rep < BENCH_WARMUP + BENCH_REPS; ++rep) {
+		int hits = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; ++i) {
+			hits += kernel(i) != RAY_MISS;
+		}
+		std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+		benchSink = benchSink + hits;
+		if (rep >= BENCH_WARMUP) {
+			samples.push_back(duration.count() / count);
+		}
+	}
+	return calcStats(samples, count);
+}
+
+// runs frame() BENCH_REPS times after warming up, and reports ns per pixel statistics
+template<typename Frame>
+static BenchStats timeFrame(size_t pixels, Frame frame) {
+	std::vector<double> samples;
+	for (int rep = 0; rep < BENCH_WARMUP + BENCH_REPS; ++rep) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		frame();
+		std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+		if (rep >= BENCH_WARMUP) {
+			samples.push_back(duration.count() / pixels);
+		}
+	}
+	return calcStats(samples, pixels);
+}
+
+static void printStats(const char *kernel, const char *set, const BenchStats &stats) {
+	printf("%-28s %-9s %10.1f %10.2f %10.1f %7.1f%%\n", kernel, set, stats.median, 1000 / stats.median, stats.min, stats.spread);
+}
+
+// mean difference of 8 bit channels between two resolved images
+static double channelError(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+	double error = 0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		for (int shift = 8; shift < 32; shift += 8) {
+			error += std::abs((int)((a[i] >> shift) & 0xFF) - (int)((b[i] >> shift) & 0xFF));
+		}
+	}
+	return error / (a.size() * COLOR_NUM);
+}
+
+// prints a correctness line and returns false if too many rays disagree with the reference
+static bool printCheck(const char *kernel, const char *set, size_t mismatches, size_t count) {
+	bool pass = mismatches <= count * BENCH_MISMATCH_TOLERANCE;
+	printf("%-28s %-9s %6ld / %-6ld mismatches %s\n", kernel, set, mismatches, count, pass ? "ok" : "FAIL");
+	return pass;
+}
+
+// checker texel, each channel varies so texels can be told apart
+static uint32_t checkerTexel(int x, int y) {
+	bool odd = ((x / BENCH_TEXTURE_CHECKER) + (y / BENCH_TEXTURE_CHECKER)) & 1;
+	return ((uint32_t)(odd ? 255 : 40) << 24) | ((uint32_t)(x & 0xFF) << 16) | ((uint32_t)(y & 0xFF) << 8);
+}
+
+/* writes a quad model on the XY plane with a checker texture into dir, one texel per world unit
+textured picks whether the quad's material has map_Kd or only Kd, returns the obj path */
+static std::string writeTexturedQuad(const std::string &dir, bool textured) {
+	std::string name = textured ? "textured" : "plain";
+	FILE *ppm = fopen((dir + "/checker.ppm").c_str(), "wb");
+	fprintf(ppm, "P6\n%d %d\n255\n", BENCH_TEXTURE_SIZE, BENCH_TEXTURE_SIZE);
+	for (int y = 0; y < BENCH_TEXTURE_SIZE; ++y) {
+		for (int x = 0; x < BENCH_TEXTURE_SIZE; ++x) {
+			uint32_t texel = checkerTexel(x, y);
+			uint8_t rgb[COLOR_NUM] = {(uint8_t)(texel >> 24), (uint8_t)(texel >> 16), (uint8_t)(texel >> 8)};
+			fwrite(rgb, 1, COLOR_NUM, ppm);
+		}
+	}
+	fclose(ppm);
+	FILE *mtl = fopen((dir + "/" + name + ".mtl").c_str(), "w");
+	fprintf(mtl, "newmtl quad\nKd 0.5 1 1\nKs 0.8 0.8 0.8\nNs 100\n%s", textured ? "map_Kd checker.ppm\n" : "");
+	fclose(mtl);
+	FILE *obj = fopen((dir + "/" + name + ".obj").c_str(), "w");
+	fprintf(obj, "mtllib %s.mtl\n", name.c_str());
+	// in obj units, the loader scales them and flips y
+	float side = BENCH_TEXTURE_SIZE / (float)OBJ_UNITS_TO_PIXELS(1);
+	fprintf(obj, "v 0 0 0\nv %f 0 0\nv %f %f 0\nv 0 %f 0\n", side, side, side, side);
+	fprintf(obj, "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvn 0 0 1\n");
+	fprintf(obj, "usemtl quad\nf 1/1/1 2/2/1 3/3/1\nf 1/1/1 3/3/1 4/4/1\n");
+	fclose(obj);
+	return dir + "/" + name + ".obj";
+}
+
+inline bool depthMatch(float a, float b) {
+	return (a == RAY_MISS && b == RAY_MISS) || (a != RAY_MISS && b != RAY_MISS && eqMargin(a, b));
+}
+
+int main(int argc, char* argv[]) {
+	size_t rayCount = BENCH_RAYS;
+	if (argc > 1) {
+		rayCount = strtoul(argv[1], NULL, 10);
+	}
+	std::mt19937 rng(BENCH_SEED);
+	omp_set_num_threads(1);
+
+	// Load scene, laid out like main.cpp
+	Model pillar(BENCH_MODEL, false);
+	if (pillar.tris.size() == 0) {
+		printf("failed to load %s\n", BENCH_MODEL);
+		return 1;
+	}
+	Model cachedPillar(BENCH_MODEL, true);
+	Camera camera(Vec3(800, 800, 1500));
+	ModelInstance pillars[6];
+	for (int x = 0; x < 2; ++x) {
+		for (int y = 0; y < 3; ++y) {
+			pillars[(x * 3) + y] = ModelInstance(&cachedPillar, Vec3(150 + x * 1600, 200 + y * 400, 0));
+			camera.scene.addModel(&pillars[(x * 3) + y]);
+		}
+	}
+	Light light1(Vec3(1, 0.5, 0), 150000, Vec3(500, 500, 500), true);
+	camera.scene.addLight(&light1);
+	Light light2(Vec3(0.2, 0.5, 1), 150000, Vec3(1300, 100, 600), true);
+	camera.scene.addLight(&light2);
+
+	// the model on its own, in object space
+	ModelInstance local(&pillar, Vec3(0, 0, 0));
+	std::vector<ModelInstance *> localInstances = {&local};
+	const BBox &bounds = pillar.bbox;
+	Vec3 extent = Vec3::sub(bounds.max, bounds.min);
+	std::vector<Vec3> localLights = {
+		Vec3(bounds.min.axis[AXIS_X] - extent.axis[AXIS_X], bounds.min.axis[AXIS_Y], bounds.max.axis[AXIS_Z] + extent.axis[AXIS_Z]),
+		Vec3(bounds.max.axis[AXIS_X] + extent.axis[AXIS_X], bounds.max.axis[AXIS_Y], bounds.max.axis[AXIS_Z] / 2)
+	};
+	std::vector<RaySet> localSets;
+	localSets.push_back(coherentRays(bounds, rayCount));
+	localSets.push_back(randomRays(bounds, rayCount, rng));
+	localSets.push_back(shadowRays(localInstances, localSets[0], localLights, rayCount));
+
+	// the whole scene, in world space
+	BBox sceneBounds = instanceBounds(camera.scene.models);
+	std::vector<Vec3> sceneLights = {light1.pos, light2.pos};
+	std::vector<RaySet> sceneSets;
+	sceneSets.push_back(coherentRays(sceneBounds, rayCount));
+	sceneSets.push_back(randomRays(sceneBounds, rayCount, rng));
+	sceneSets.push_back(shadowRays(camera.scene.models, sceneSets[0], sceneLights, rayCount));
+
+	OctNode *octree = Octree::calcOctree(pillar.bbox, pillar.tris, std::min((int)std::round(std::log(pillar.tris.size() * OCTREE_NODES_PER_TRI) / std::log(8)), OCTREE_DEPTH_MAX));
+
+	// reference results
+	std::vector<std::vector<float>> localDepths, sceneDepths;
+	std::vector<std::vector<const Tri *>> localTris;
+	for (const RaySet &set: localSets) {
+		std::vector<float> depths;
+		std::vector<const Tri *> tris;
+		for (size_t i = 0; i < set.rays.size(); ++i) {
+			Ray ray = set.rays[i];
+			depths.push_back(referenceRayCast(localInstances, ray));
+			tris.push_back(depths.back() != RAY_MISS ? ray.tri : pillar.tris[i % pillar.tris.size()]);
+		}
+		localDepths.push_back(depths);
+		localTris.push_back(tris);
+	}
+	for (const RaySet &set: sceneSets) {
+		std::vector<float> depths;
+		for (const Ray &source: set.rays) {
+			Ray ray = source;
+			depths.push_back(referenceRayCast(camera.scene.models, ray));
+		}
+		sceneDepths.push_back(depths);
+	}
+
+	printf("\n%ld rays per set, %d reps, seed %d\n", rayCount, BENCH_REPS, BENCH_SEED);
+
+	// correctness against the reference
+	printf("\n%-28s %-9s\n", "check", "set");
+	bool pass = true;
+	for (size_t s = 0; s < localSets.size(); ++s) {
+		const RaySet &set = localSets[s];
+		bool shadow = set.lengths[0] != RAY_MISS;
+		size_t octreeMismatches = 0, traverseMismatches = 0, traceMismatches = 0, modelMismatches = 0;
+		for (size_t i = 0; i < set.rays.size(); ++i) {
+			Ray ray = set.rays[i], traverseRay = set.rays[i], traceRay = set.rays[i];
+			if (shadow) {
+				float length = set.lengths[i];
+				bool reference = referenceOccluded(localInstances, set.rays[i], length);
+				octreeMismatches += !geqMargin(Octree::rayCastOctree(octree, ray, length, true), length) != reference;
+				traverseMismatches += !geqMargin(Octree::traverse<QUERY_OCCLUSION>(octree, traverseRay, length), length) != reference;
+				traceMismatches += !geqMargin(pillar.trace<QUERY_OCCLUSION>(traceRay, length), length) != reference;
+			} else {
+				octreeMismatches += !depthMatch(Octree::rayCastOctree(octree, ray), localDepths[s][i]);
+				traverseMismatches += !depthMatch(Octree::traverse<QUERY_CLOSEST>(octree, traverseRay, RAY_MISS), localDepths[s][i]);
+				traceMismatches += !depthMatch(pillar.trace<QUERY_CLOSEST>(traceRay), localDepths[s][i]);
+			}
+		}
+		pass &= printCheck("Octree::rayCastOctree", set.name, octreeMismatches, set.rays.size());
+		pass &= printCheck("Octree::traverse", set.name, traverseMismatches, set.rays.size());
+		pass &= printCheck("Model::trace", set.name, traceMismatches, set.rays.size());
+		if (!shadow) {
+			// first pass fills the cache, second pass is answered from it
+			size_t cachedTraceMismatches = 0;
+			for (int fill = 0; fill < 2; ++fill) {
+				modelMismatches = cachedTraceMismatches = 0;
+				for (size_t i = 0; i < set.rays.size(); ++i) {
+					Ray ray = set.rays[i], traceRay = set.rays[i];
+					modelMismatches += !depthMatch(cachedPillar.rayCast(ray), localDepths[s][i]);
+					cachedTraceMismatches += !depthMatch(cachedPillar.trace<QUERY_CLOSEST>(traceRay), localDepths[s][i]);
+				}
+			}
+			pass &= printCheck("Model::rayCast (cached)", set.name, modelMismatches, set.rays.size());
+			pass &= printCheck("Model::trace (cached)", set.name, cachedTraceMismatches, set.rays.size());
+		}
+	}
+	for (size_t s = 0; s < sceneSets.size(); ++s) {
+		const RaySet &set = sceneSets[s];
+		bool shadow = set.lengths[0] != RAY_MISS;
+		size_t mismatches = 0, traceMismatches = 0;
+		for (size_t i = 0; i < set.rays.size(); ++i) {
+			Ray ray = set.rays[i], traceRay = set.rays[i];
+			if (shadow) {
+				float length = set.lengths[i];
+				bool reference = referenceOccluded(camera.scene.models, set.rays[i], length);
+				mismatches += !eqMargin(camera.scene.rayCast(ray, length, true), length) != reference;
+				traceMismatches += !eqMargin(camera.scene.trace<QUERY_OCCLUSION>(traceRay, length), length) != reference;
+			} else {
+				mismatches += !depthMatch(camera.scene.rayCast(ray), sceneDepths[s][i]);
+				traceMismatches += !depthMatch(camera.scene.trace<QUERY_CLOSEST>(traceRay), sceneDepths[s][i]);
+			}
+		}
+		pass &= printCheck("Scene::rayCast", set.name, mismatches, set.rays.size());
+		pass &= printCheck("Scene::trace", set.name, traceMismatches, set.rays.size());
+	}
+
+	// caches warmed with the reference results for the lookup kernel
+	std::vector<ModelRayCache> caches(localSets.size());
+	std::vector<std::vector<int>> faces(localSets.size());
+	std::vector<std::vector<float>> bboxDists(localSets.size());
+	for (size_t s = 0; s < localSets.size(); ++s) {
+		const RaySet &set = localSets[s];
+		if (set.lengths[0] != RAY_MISS) {
+			continue;
+		}
+		printf("%s ", set.name);
+		caches[s].allocate(Vec3::sub(pillar.bbox.max, pillar.bbox.min), pillar.bbox.min);
+		faces[s].resize(set.rays.size());
+		bboxDists[s].resize(set.rays.size());
+		for (size_t i = 0; i < set.rays.size(); ++i) {
+			bboxDists[s][i] = pillar.bbox.rayCastFace(set.rays[i], faces[s][i]);
+			Ray ray = set.rays[i];
+			ray.tri = localTris[s][i];
+			caches[s].set(ray, faces[s][i], bboxDists[s][i], localDepths[s][i] == RAY_MISS);
+		}
+	}
+
+	printf("Ray caches: %.2f MB in use of %.2f MB budget, %ld tiles refused\n", ModelRayCache::totalMemory() / (float)SIZE_MB, ModelRayCache::budget() / (float)SIZE_MB, ModelRayCache::refused.load());
+
+	// timings
+	printf("\n%-28s %-9s %10s %10s %10s %8s\n", "kernel", "set", "ns/ray", "Mrays/s", "min ns", "spread");
+	for (size_t s = 0; s < localSets.size(); ++s) {
+		const RaySet &set = localSets[s];
+		const std::vector<Ray> &rays = set.rays;
+		const std::vector<float> &lengths = set.lengths;
+		bool shadow = lengths[0] != RAY_MISS;
+		const std::vector<const Tri *> &tris = localTris[s];
+
+		printStats("BBox::rayCast", set.name, timeKernel(rays.size(), [&](size_t i) {
+			return pillar.bbox.rayCast(rays[i]);
+		}));
+		printStats("BBox::rayCastFace", set.name, timeKernel(rays.size(), [&](size_t i) {
+			int face;
+			return pillar.bbox.rayCastFace(rays[i], face);
+		}));
+		// each ray against the tri the reference says it hits, or an arbitrary one on a miss
+		printStats("Tri::rayCast", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return tris[i]->rayCast(ray);
+		}));
+		printStats("Octree::rayCastOctree", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return Octree::rayCastOctree(octree, ray, lengths[i], shadow);
+		}));
+		// generic paths against the kernels specialized for the query, cache policy and accelerator
+		if (shadow) {
+			printStats("Octree::traverse<occlusion>", set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return Octree::traverse<QUERY_OCCLUSION>(octree, ray, lengths[i]);
+			}));
+		} else {
+			printStats("Octree::traverse<closest>", set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return Octree::traverse<QUERY_CLOSEST>(octree, ray, lengths[i]);
+			}));
+		}
+		printStats("Model::rayCast", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return pillar.rayCast(ray, lengths[i], shadow);
+		}));
+		printStats(shadow ? "Model::trace<occlusion>" : "Model::trace<closest>", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return shadow ? pillar.trace<QUERY_OCCLUSION>(ray, lengths[i]) : pillar.trace<QUERY_CLOSEST>(ray, lengths[i]);
+		}));
+		if (!shadow) {
+			printStats("Model::rayCast (cached)", set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return cachedPillar.rayCast(ray);
+			}));
+			printStats("Model::trace<closest,cached>", set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return cachedPillar.trace<QUERY_CLOSEST>(ray);
+			}));
+		}
+
+		if (!shadow) {
+			printStats("ModelRayCache::lookup", set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return caches[s].lookup(ray, faces[s][i], bboxDists[s][i]);
+			}));
+		}
+	}
+	for (const RaySet &set: sceneSets) {
+		const std::vector<Ray> &rays = set.rays;
+		const std::vector<float> &lengths = set.lengths;
+		bool shadow = lengths[0] != RAY_MISS;
+
+		printStats("Scene::rayCast", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return camera.scene.rayCast(ray, lengths[i], shadow);
+		}));
+		printStats("Scene::trace", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return shadow ? camera.scene.trace<QUERY_OCCLUSION>(ray, lengths[i]) : camera.scene.trace<QUERY_CLOSEST>(ray, lengths[i]);
+		}));
+		if (!shadow) {
+			printStats("Scene::renderRay", set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return (float)camera.scene.renderRay(ray);
+			}));
+		}
+	}
+
+	// whole frames through the megakernel and the wavefront pipeline, which must produce the same image
+	Camera frameCamera(Vec3(960, 760, 1500));
+	frameCamera.scene = camera.scene;
+	Accumulator megakernelFrame(BENCH_FRAME_SIZE, BENCH_FRAME_SIZE), wavefrontFrame(BENCH_FRAME_SIZE, BENCH_FRAME_SIZE), binnedFrame(BENCH_FRAME_SIZE, BENCH_FRAME_SIZE);
+	std::vector<uint32_t> megakernelPixels(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE), wavefrontPixels(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE), binnedPixels(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE);
+	const char *wavefrontNames[] = {"Wavefront (unsorted)", "Wavefront (direction)", "Wavefront (model)", "Wavefront (packets)"};
+	int wavefrontSorts[] = {WAVEFRONT_SORT_NONE, WAVEFRONT_SORT_DIRECTION, WAVEFRONT_SORT_MODEL, WAVEFRONT_SORT_DIRECTION};
+	bool wavefrontPackets[] = {false, false, false, true};
+	float reflectivities[2] = {0, 0.5};
+	for (float reflectivity: reflectivities) {
+		frameCamera.scene.reflectivity = reflectivity;
+		const char *setName = reflectivity > 0 ? "reflect" : "direct";
+		printf("\n%-28s %-9s\n", "frame", setName);
+
+		BenchStats megakernelStats = timeFrame(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE, [&]() {
+			megakernelFrame.reset();
+			for (int y = 0; y < BENCH_FRAME_SIZE; ++y) {
+				for (int x = 0; x < BENCH_FRAME_SIZE; ++x) {
+					megakernelFrame.add(x, y, frameCamera.samplePixel(x, y, 0));
+				}
+			}
+			megakernelFrame.endSample();
+		});
+		megakernelFrame.resolve(megakernelPixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+		printStats("Scene::shadeRay", setName, megakernelStats);
+
+		// primary rays only testing the instances binned to their screen tile, bins rebuilt every frame, forced below BIN_MIN_INSTANCES
+		Camera binnedCamera = frameCamera;
+		BenchStats binStats = timeFrame(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE, [&]() {
+			binnedCamera.binInstances(0);
+		});
+		BenchStats binnedStats = timeFrame(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE, [&]() {
+			binnedCamera.binInstances(0);
+			binnedFrame.reset();
+			for (int y = 0; y < BENCH_FRAME_SIZE; ++y) {
+				for (int x = 0; x < BENCH_FRAME_SIZE; ++x) {
+					binnedFrame.add(x, y, binnedCamera.samplePixel(x, y, 0));
+				}
+			}
+			binnedFrame.endSample();
+		});
+		binnedFrame.resolve(binnedPixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+		printStats("Scene::shadeRay (binned)", setName, binnedStats);
+		printStats("InstanceBins::build", setName, binStats);
+		size_t binnedMismatches = 0;
+		for (size_t i = 0; i < binnedPixels.size(); ++i) {
+			binnedMismatches += binnedPixels[i] != megakernelPixels[i];
+		}
+		pass &= printCheck("Scene::shadeRay (binned)", setName, binnedMismatches, binnedPixels.size());
+		printf("%-28s %-9s %.2f instances per tile of %ld, build is %.2f%% of the frame\n", "", setName, binnedCamera.bins.averageBinSize(), (long)binnedCamera.scene.models.size(), 100 * binStats.median / binnedStats.median);
+
+		// the wavefront renderers use the binned camera too, primary rays go through the bins
+		for (int config = 0; config < 4; ++config) {
+			Wavefront wavefront(wavefrontSorts[config], wavefrontPackets[config]);
+			BenchStats wavefrontStats = timeFrame(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE, [&]() {
+				wavefrontFrame.reset();
+				wavefront.render(binnedCamera, wavefrontFrame, 0);
+				wavefrontFrame.endSample();
+			});
+			wavefrontFrame.resolve(wavefrontPixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+			printStats(wavefrontNames[config], setName, wavefrontStats);
+
+			// reflections are summed in a different order, so allow rounding in the last bit of a channel
+			size_t mismatches = 0;
+			for (size_t i = 0; i < wavefrontPixels.size(); ++i) {
+				for (int shift = 8; shift < 32; shift += 8) {
+					int a = (megakernelPixels[i] >> shift) & 0xFF;
+					int b = (wavefrontPixels[i] >> shift) & 0xFF;
+					if (std::abs(a - b) > (reflectivity > 0 ? 1 : 0)) {
+						++mismatches;
+						break;
+					}
+				}
+			}
+			pass &= printCheck(wavefrontNames[config], setName, mismatches, wavefrontPixels.size());
+			printf("%-28s %-9s %ld primary, %ld bounce, %ld shadow, %ld shadow skipped, %ld in %ld packets\n", "", setName, wavefront.primaryRays, wavefront.bounceRays, wavefront.shadowRays, wavefront.skippedShadowRays, wavefront.packetRays, wavefront.packets);
+		}
+	}
+
+	// materials and textures, on a generated quad so the expected texels are known
+	char textureDir[] = "/tmp/benchXXXXXX";
+	if (!mkdtemp(textureDir)) {
+		printf("could not create a directory for the texture benchmark\n");
+		return 1;
+	}
+	Model texturedQuad(writeTexturedQuad(textureDir, true), false);
+	Model plainQuad(writeTexturedQuad(textureDir, false), false);
+	for (const char *file: {"checker.ppm", "textured.obj", "textured.mtl", "plain.obj", "plain.mtl"}) {
+		remove((std::string(textureDir) + "/" + file).c_str());
+	}
+	rmdir(textureDir);
+	printf("\n%-28s %-9s\n", "check", "set");
+	// rays straight down through texel centers read level 0, pillar.mtl's Kd must reach the shading
+	size_t texelMismatches = 0;
+	for (int y = 0; y < BENCH_TEXTURE_SIZE; ++y) {
+		for (int x = 0; x < BENCH_TEXTURE_SIZE; ++x) {
+			Ray ray(Vec3(x + 0.5f, (y + 0.5f) - BENCH_TEXTURE_SIZE, 100), Vec3(0, 0, -1));
+			ModelInstance instance(&texturedQuad, Vec3(0, 0, 0));
+			float depth = instance.trace<QUERY_CLOSEST>(ray);
+			if (depth == RAY_MISS) {
+				++texelMismatches;
+				continue;
+			}
+			instance.surface(ray, depth);
+			uint32_t texel = checkerTexel(x, y);
+			Vec3 expected(0.5f * ((texel >> 24) & 0xFF) / 255.0f, ((texel >> 16) & 0xFF) / 255.0f, ((texel >> 8) & 0xFF) / 255.0f);
+			texelMismatches += !eqMargin(Vec3::lengthOf(Vec3::sub(ray.meshInfo.diffuse, expected)), 0, FLOAT_MARGIN_PRECISE);
+		}
+	}
+	pass &= printCheck("Model::surface", "texels", texelMismatches, BENCH_TEXTURE_SIZE * BENCH_TEXTURE_SIZE);
+	// straight down onto the middle of the first pillar, which the reference must hit too
+	BBox pillarBounds = pillars[0].bounds();
+	Vec3 pillarTop = Vec3::scale(Vec3::add(pillarBounds.min, pillarBounds.max), 0.5f);
+	pillarTop.axis[AXIS_Z] = pillarBounds.max.axis[AXIS_Z] + 100;
+	Ray pillarRay(pillarTop, Vec3(0, 0, -1)), referencePillarRay = pillarRay;
+	float pillarDepth = camera.scene.trace<QUERY_CLOSEST>(pillarRay);
+	bool pillarHit = pillarDepth != RAY_MISS && depthMatch(pillarDepth, referenceRayCast(camera.scene.models, referencePillarRay));
+	pass &= printCheck("Model::surface", "mtl hit", !pillarHit, 1);
+	pass &= printCheck("Model::surface", "mtl Kd", !(pillarHit && eqMargin(pillarRay.meshInfo.diffuse.axis[COLOR_R], 0.8f, FLOAT_MARGIN_PRECISE)), 1);
+
+	/* fetches at random coords and levels, then whole orthographic hits on the quad with and without its texture
+	the difference between the two is the cost texturing adds to each hit */
+	printf("\n%-28s %-9s %10s %10s %10s %8s\n", "kernel", "set", "ns/ray", "Mrays/s", "min ns", "spread");
+	const Texture *checker = texturedQuad.textures[0];
+	std::uniform_real_distribution<float> unitCoord(0, 1), unitLod(0, checker->levels());
+	std::vector<float> sampleU(rayCount), sampleV(rayCount), sampleLod(rayCount);
+	for (size_t i = 0; i < rayCount; ++i) {
+		sampleU[i] = unitCoord(rng);
+		sampleV[i] = unitCoord(rng);
+		sampleLod[i] = unitLod(rng);
+	}
+	printStats("Texture::sample", "random", timeKernel(rayCount, [&](size_t i) {
+		return checker->sample(sampleU[i], sampleV[i], sampleLod[i]).axis[COLOR_R];
+	}));
+	printStats("Texture::sample", "level 0", timeKernel(rayCount, [&](size_t i) {
+		return checker->sample(sampleU[i], sampleV[i], 0).axis[COLOR_R];
+	}));
+	Scene texturedScene, plainScene;
+	ModelInstance texturedInstance(&texturedQuad, Vec3(0, 0, 0)), plainInstance(&plainQuad, Vec3(0, 0, 0));
+	texturedScene.addModel(&texturedInstance);
+	plainScene.addModel(&plainInstance);
+	RaySet quadSet = coherentRays(texturedQuad.bbox, rayCount);
+	BenchStats plainStats = timeKernel(quadSet.rays.size(), [&](size_t i) {
+		Ray ray = quadSet.rays[i];
+		return plainScene.trace<QUERY_CLOSEST>(ray);
+	});
+	BenchStats texturedStats = timeKernel(quadSet.rays.size(), [&](size_t i) {
+		Ray ray = quadSet.rays[i];
+		return texturedScene.trace<QUERY_CLOSEST>(ray);
+	});
+	printStats("Scene::trace (Kd only)", quadSet.name, plainStats);
+	printStats("Scene::trace (textured)", quadSet.name, texturedStats);
+	printf("texture fetch adds %.1f ns per hit, %d levels in %.2f MB\n", texturedStats.median - plainStats.median, checker->levels(), checker->memory() / (float)SIZE_MB);
+
+	// the pillar out of core, in small clusters under a budget that can't hold all of them
+	char pagingDir[] = "/tmp/benchXXXXXX";
+	if (!mkdtemp(pagingDir)) {
+		printf("could not create a directory for the paging benchmark\n");
+		return 1;
+	}
+	std::string clusterFile = std::string(pagingDir) + "/pillar.clusters";
+	PagedGeometry pagedGeometry;
+	bool paged = PagedGeometry::write(clusterFile, pillar.tris, pillar.triMaterials, pillar.materials, BENCH_CLUSTER_TRIS) && pagedGeometry.open(clusterFile);
+	// the mapping keeps the file alive
+	remove(clusterFile.c_str());
+	rmdir(pagingDir);
+	if (!paged) {
+		return 1;
+	}
+	PagedGeometry::setBudget(pagedGeometry.fileSize() * BENCH_PAGING_BUDGET);
+	Model pagedPillar(&pagedGeometry);
+
+	printf("\n%-28s %-9s\n", "check", "set");
+	for (size_t s = 0; s < localSets.size(); ++s) {
+		const RaySet &set = localSets[s];
+		bool shadow = set.lengths[0] != RAY_MISS;
+		size_t mismatches = 0;
+		for (size_t i = 0; i < set.rays.size(); ++i) {
+			Ray ray = set.rays[i];
+			if (shadow) {
+				float length = set.lengths[i];
+				mismatches += !geqMargin(pagedPillar.trace<QUERY_OCCLUSION>(ray, length), length) != referenceOccluded(localInstances, set.rays[i], length);
+			} else {
+				mismatches += !depthMatch(pagedPillar.trace<QUERY_CLOSEST>(ray), localDepths[s][i]);
+			}
+		}
+		pass &= printCheck("PagedGeometry::trace", set.name, mismatches, set.rays.size());
+		PagedGeometry::endFrame();
+	}
+
+	// the same frame as the megakernel's, every pillar instance paged
+	Camera pagedCamera(frameCamera.pos);
+	ModelInstance pagedPillars[6];
+	for (int i = 0; i < 6; ++i) {
+		pagedPillars[i] = ModelInstance(&pagedPillar, camera.scene.models[i]->pos);
+		pagedCamera.scene.addModel(&pagedPillars[i]);
+	}
+	pagedCamera.scene.lights = frameCamera.scene.lights;
+	frameCamera.scene.reflectivity = 0;
+	Accumulator pagedFrame(BENCH_FRAME_SIZE, BENCH_FRAME_SIZE);
+	std::vector<uint32_t> pagedPixels(BENCH_FRAME_SIZE * BENCH_FRAME_SIZE);
+	for (int frame = 0; frame < BENCH_PAGING_FRAMES; ++frame) {
+		megakernelFrame.reset();
+		pagedFrame.reset();
+		for (int y = 0; y < BENCH_FRAME_SIZE; ++y) {
+			for (int x = 0; x < BENCH_FRAME_SIZE; ++x) {
+				megakernelFrame.add(x, y, frameCamera.samplePixel(x, y, 0));
+				pagedFrame.add(x, y, pagedCamera.samplePixel(x, y, 0));
+			}
+		}
+		megakernelFrame.endSample();
+		pagedFrame.endSample();
+		PagedGeometry::endFrame();
+		printf("%-28s %-9d %ld page ins, %.2f MB, %.2f of %.2f MB resident, %ld evicted\n", "PagedGeometry", frame, PagedGeometry::lastFramePageIns, PagedGeometry::lastFramePageInBytes / (float)SIZE_MB,
+			PagedGeometry::memory() / (float)SIZE_MB, PagedGeometry::budget() / (float)SIZE_MB, PagedGeometry::evicted.load());
+	}
+	megakernelFrame.resolve(megakernelPixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+	pagedFrame.resolve(pagedPixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+	size_t pagedMismatches = 0;
+	for (size_t i = 0; i < pagedPixels.size(); ++i) {
+		pagedMismatches += pagedPixels[i] != megakernelPixels[i];
+	}
+	pass &= printCheck("PagedGeometry frame", "direct", pagedMismatches, pagedPixels.size());
+
+	printf("\n%-28s %-9s %10s %10s %10s %8s\n", "kernel", "set", "ns/ray", "Mrays/s", "min ns", "spread");
+	// everything resident, the cost of the cluster hierarchy itself
+	PagedGeometry::setBudget(pagedGeometry.fileSize() * 2);
+	for (const RaySet &set: localSets) {
+		const std::vector<Ray> &rays = set.rays;
+		const std::vector<float> &lengths = set.lengths;
+		bool shadow = lengths[0] != RAY_MISS;
+		printStats("PagedGeometry::trace", set.name, timeKernel(rays.size(), [&](size_t i) {
+			Ray ray = rays[i];
+			return shadow ? pagedPillar.trace<QUERY_OCCLUSION>(ray, lengths[i]) : pagedPillar.trace<QUERY_CLOSEST>(ray, lengths[i]);
+		}));
+	}
+
+	// rotated and scaled instances, the reference moves the tris into world space instead
+	for (Model *model: {&pillar, &cachedPillar}) {
+		const char *kernel = model == &pillar ? "transformed" : "transformed (cached)";
+		ModelInstance turned[BENCH_TRANSFORMED];
+		Scene turnedScene;
+		double tightVolume = 0, cornerVolume = 0;
+		for (int i = 0; i < BENCH_TRANSFORMED; ++i) {
+			Mat3 linear = Mat3::mul(Mat3::rotation(AXIS_Z, 0.7f * i), Mat3::mul(Mat3::rotation(AXIS_X, 0.4f * (i % 3)), Mat3::scale(Vec3(1 + (0.2f * i), 1, 1 - (0.1f * i)))));
+			turned[i] = ModelInstance(model, Vec3(300 + (i % 3) * 500, 300 + (i / 3) * 600, 0), linear);
+			turnedScene.addModel(&turned[i]);
+			// what transforming the model's bounding box corners would give
+			Vec3 extent = Vec3::sub(model->bbox.max, model->bbox.min);
+			Vec3 half(0, 0, 0);
+			for (int row = 0; row < 3; ++row) {
+				for (int axis = 0; axis < AXIS_NUM; ++axis) {
+					half.axis[row] += std::abs(linear.rows[row].axis[axis]) * extent.axis[axis];
+				}
+			}
+			Vec3 tight = Vec3::sub(turned[i].linearBounds.max, turned[i].linearBounds.min);
+			tightVolume += (double)tight.axis[AXIS_X] * tight.axis[AXIS_Y] * tight.axis[AXIS_Z];
+			cornerVolume += (double)half.axis[AXIS_X] * half.axis[AXIS_Y] * half.axis[AXIS_Z];
+		}
+		turnedScene.lights = camera.scene.lights;
+		BBox turnedBounds = instanceBounds(turnedScene.models);
+		std::vector<RaySet> turnedSets;
+		turnedSets.push_back(coherentRays(turnedBounds, rayCount));
+		turnedSets.push_back(randomRays(turnedBounds, rayCount, rng));
+		turnedSets.push_back(shadowRays(turnedScene.models, turnedSets[0], sceneLights, rayCount));
+
+		printf("\n%-28s %-9s\n", "check", "set");
+		for (const RaySet &set: turnedSets) {
+			bool shadow = set.lengths[0] != RAY_MISS;
+			size_t mismatches = 0, normalMismatches = 0;
+			for (size_t i = 0; i < set.rays.size(); ++i) {
+				Ray ray = set.rays[i], referenceRay = set.rays[i];
+				if (shadow) {
+					float length = set.lengths[i];
+					mismatches += !eqMargin(turnedScene.trace<QUERY_OCCLUSION>(ray, length), length) != referenceOccluded(turnedScene.models, referenceRay, length);
+				} else {
+					float depth = turnedScene.trace<QUERY_CLOSEST>(ray);
+					float referenceDepth = referenceRayCast(turnedScene.models, referenceRay);
+					mismatches += !depthMatch(depth, referenceDepth);
+					normalMismatches += depth != RAY_MISS && depthMatch(depth, referenceDepth) && Vec3::dot(ray.meshInfo.normal, referenceRay.meshInfo.normal) < 0.999f;
+				}
+			}
+			pass &= printCheck(kernel, set.name, mismatches, set.rays.size());
+			if (!shadow) {
+				pass &= printCheck("transformed normals", set.name, normalMismatches, set.rays.size());
+			}
+		}
+		// shadow packets fall back to single rays for transformed instances, grouped per light like the wavefront renderer
+		const RaySet &shadowSet = turnedSets[2];
+		size_t packetMismatches = 0;
+		for (size_t light = 0; light < sceneLights.size(); ++light) {
+			for (size_t first = light; first < shadowSet.rays.size(); first += sceneLights.size() * PACKET_MAX_RAYS) {
+				ShadowPacket packet;
+				std::vector<size_t> indices;
+				for (size_t i = first; i < shadowSet.rays.size() && indices.size() < PACKET_MAX_RAYS; i += sceneLights.size()) {
+					packet.add(shadowSet.rays[i], shadowSet.lengths[i]);
+					indices.push_back(i);
+				}
+				if (!packet.build()) {
+					continue;
+				}
+				turnedScene.occludePacket(packet);
+				for (size_t j = 0; j < indices.size(); ++j) {
+					packetMismatches += (bool)packet.occluded[j] != referenceOccluded(turnedScene.models, shadowSet.rays[indices[j]], shadowSet.lengths[indices[j]]);
+				}
+			}
+		}
+		pass &= printCheck("transformed packets", "shadow", packetMismatches, shadowSet.rays.size());
+		printf("%-28s %-9s world bounds %.1f%% of the volume of transformed bounding boxes\n", "", "", 100 * tightVolume / cornerVolume);
+
+		printf("%-28s %-9s %10s %10s %10s %8s\n", "kernel", "set", "ns/ray", "Mrays/s", "min ns", "spread");
+		for (const RaySet &set: turnedSets) {
+			const std::vector<Ray> &rays = set.rays;
+			const std::vector<float> &lengths = set.lengths;
+			bool shadow = lengths[0] != RAY_MISS;
+			printStats(kernel, set.name, timeKernel(rays.size(), [&](size_t i) {
+				Ray ray = rays[i];
+				return shadow ? turnedScene.trace<QUERY_OCCLUSION>(ray, lengths[i]) : turnedScene.trace<QUERY_CLOSEST>(ray, lengths[i]);
+			}));
+		}
+	}
+
+	// a crowd of rotated and scaled instances all tracing the one pillar, only the instances grow with their count
+	std::vector<ModelInstance> crowd(BENCH_CROWD);
+	Camera crowdCamera(Vec3(1600, 1600, 1500));
+	std::uniform_real_distribution<float> angle(0, 2 * M_PI), size(0.1f, 0.3f);
+	int crowdSide = (int)std::ceil(std::sqrt((double)BENCH_CROWD));
+	for (int i = 0; i < BENCH_CROWD; ++i) {
+		float scale = size(rng);
+		crowd[i] = ModelInstance(&cachedPillar, Vec3((i % crowdSide) * (3200.0f / crowdSide), (i / crowdSide) * (3200.0f / crowdSide), 0),
+			Mat3::mul(Mat3::rotation(AXIS_Z, angle(rng)), Mat3::mul(Mat3::rotation(AXIS_X, angle(rng)), Mat3::scale(Vec3(scale, scale, scale)))));
+		crowdCamera.scene.addModel(&crowd[i]);
+	}
+	crowdCamera.scene.lights = camera.scene.lights;
+	// the same crowd with every primary ray tracing every instance, where bins pay for themselves
+	Camera unbinnedCrowdCamera = crowdCamera;
+	crowdCamera.binInstances();
+	Accumulator crowdFrame(BENCH_CROWD_FRAME_SIZE, BENCH_CROWD_FRAME_SIZE), unbinnedCrowdFrame(BENCH_CROWD_FRAME_SIZE, BENCH_CROWD_FRAME_SIZE);
+	BenchStats crowdStats = timeFrame(BENCH_CROWD_FRAME_SIZE * BENCH_CROWD_FRAME_SIZE, [&]() {
+		crowdFrame.reset();
+		for (int y = 0; y < BENCH_CROWD_FRAME_SIZE; ++y) {
+			for (int x = 0; x < BENCH_CROWD_FRAME_SIZE; ++x) {
+				crowdFrame.add(x, y, crowdCamera.samplePixel(x, y, 0));
+			}
+		}
+		crowdFrame.endSample();
+	});
+	BenchStats unbinnedCrowdStats = timeFrame(BENCH_CROWD_FRAME_SIZE * BENCH_CROWD_FRAME_SIZE, [&]() {
+		unbinnedCrowdFrame.reset();
+		for (int y = 0; y < BENCH_CROWD_FRAME_SIZE; ++y) {
+			for (int x = 0; x < BENCH_CROWD_FRAME_SIZE; ++x) {
+				unbinnedCrowdFrame.add(x, y, unbinnedCrowdCamera.samplePixel(x, y, 0));
+			}
+		}
+		unbinnedCrowdFrame.endSample();
+	});
+	std::vector<uint32_t> crowdPixels(BENCH_CROWD_FRAME_SIZE * BENCH_CROWD_FRAME_SIZE), unbinnedCrowdPixels(BENCH_CROWD_FRAME_SIZE * BENCH_CROWD_FRAME_SIZE);
+	crowdFrame.resolve(crowdPixels.data(), BENCH_CROWD_FRAME_SIZE * sizeof(uint32_t));
+	unbinnedCrowdFrame.resolve(unbinnedCrowdPixels.data(), BENCH_CROWD_FRAME_SIZE * sizeof(uint32_t));
+	size_t crowdMismatches = 0;
+	for (size_t i = 0; i < crowdPixels.size(); ++i) {
+		crowdMismatches += crowdPixels[i] != unbinnedCrowdPixels[i];
+	}
+	printf("\n%-28s %-9s %10s %10s %10s %8s\n", "frame", "set", "ns/pixel", "Mpix/s", "min ns", "spread");
+	printStats("Scene::shadeRay (crowd)", "direct", unbinnedCrowdStats);
+	printStats("Scene::shadeRay (binned)", "direct", crowdStats);
+	pass &= printCheck("Scene::shadeRay (binned)", "crowd", crowdMismatches, crowdPixels.size());
+	printf("%-28s %-9s %.2f instances per tile of %d\n", "", "direct", crowdCamera.bins.averageBinSize(), BENCH_CROWD);
+	printf("%-28s %-9s %d instances of %ld tris, %ld bytes each, sharing %.2f MB of tris and octree\n", "", "direct", BENCH_CROWD, (long)cachedPillar.tris.size(), (long)sizeof(ModelInstance),
+		((cachedPillar.tris.size() * sizeof(Tri)) + (cachedPillar.verts.size() * sizeof(Vert))) / (float)SIZE_MB);
+
+	// a deforming pillar refit every frame, the cached copy checks that entries of moved regions were invalidated and the rest kept
+	Model deforming(BENCH_MODEL, false), cachedDeforming(BENCH_MODEL, true);
+	std::vector<Vec3> rest;
+	for (const Vert *vert: deforming.verts) {
+		rest.push_back(vert->pos);
+	}
+	BBox restBounds = deforming.bbox;
+	Vec3 restExtent = Vec3::sub(restBounds.max, restBounds.min);
+	Vec3 restCenter = Vec3::scale(Vec3::add(restBounds.min, restBounds.max), 0.5f);
+	deforming.setDynamic();
+	cachedDeforming.setDynamic();
+	ModelInstance deformingInstance(&deforming, Vec3(0, 0, 0)), cachedDeformingInstance(&cachedDeforming, Vec3(0, 0, 0));
+	std::vector<ModelInstance *> deformingInstances = {&deformingInstance}, cachedDeformingInstances = {&cachedDeformingInstance};
+	std::vector<RaySet> deformingSets;
+	deformingSets.push_back(coherentRays(deforming.bbox, rayCount));
+	deformingSets.push_back(randomRays(deforming.bbox, rayCount, rng));
+	/* bend moves the side past a quarter of the width outwards, twist turns the whole pillar about its axis more with height
+	and scatter shifts each vert sideways by its own pseudo random amount, tearing the octree's leaves apart, all as fractions of its width or in radians */
+	auto deform = [&](float bend, float twist, float scatter) {
+		float side = restCenter.axis[AXIS_X] + (restExtent.axis[AXIS_X] / 4);
+		for (size_t i = 0; i < rest.size(); ++i) {
+			Vec3 pos = rest[i];
+			if (pos.axis[AXIS_X] > side) {
+				pos.axis[AXIS_X] += bend * restExtent.axis[AXIS_X] * (pos.axis[AXIS_X] - side) / (restBounds.max.axis[AXIS_X] - side);
+			}
+			Vec3 fromAxis = Vec3::sub(pos, Vec3(restCenter.axis[AXIS_X], restCenter.axis[AXIS_Y], 0));
+			Vec3 turned = Mat3::transform(Mat3::rotation(AXIS_Z, twist * (pos.axis[AXIS_Z] - restBounds.min.axis[AXIS_Z]) / restExtent.axis[AXIS_Z]), fromAxis);
+			pos = Vec3::add(turned, Vec3(restCenter.axis[AXIS_X], restCenter.axis[AXIS_Y], 0));
+			pos.axis[AXIS_Y] += scatter * restExtent.axis[AXIS_X] * std::sin(i * 12.9898f);
+			deforming.verts[i]->pos = pos;
+			cachedDeforming.verts[i]->pos = pos;
+		}
+	};
+	auto checkDeforming = [&](const char *name) {
+		for (const RaySet &set: deformingSets) {
+			size_t mismatches = 0, cachedMismatches = 0;
+			for (size_t i = 0; i < set.rays.size(); ++i) {
+				Ray ray = set.rays[i], cachedRay = set.rays[i], referenceRay = set.rays[i];
+				float reference = referenceRayCast(deformingInstances, referenceRay);
+				mismatches += !depthMatch(deformingInstance.trace<QUERY_CLOSEST>(ray), reference);
+				cachedMismatches += !depthMatch(cachedDeformingInstance.trace<QUERY_CLOSEST>(cachedRay), reference);
+			}
+			pass &= printCheck(name, set.name, mismatches, set.rays.size());
+			pass &= printCheck("refit (cached)", set.name, cachedMismatches, set.rays.size());
+		}
+	};
+	printf("\n%-28s %-9s\n", "check", "set");
+	// earlier sections' caches fill the budget and are never evicted here, so the cached copy gets room of its own
+	long cacheBudget = ModelRayCache::budget();
+	ModelRayCache::setBudget(ModelRayCache::totalMemory() + ((long)BENCH_REFIT_CACHE_MB * SIZE_MB));
+	// fills the cache at rest
+	checkDeforming("refit");
+	pass &= printCheck("refit (cache filled)", "direct", cachedDeforming.cacheEntries() == 0, 1);
+	const char *phases[] = {"Model::refit (bend)", "Model::refit (twist)", "Model::refit (scatter)"};
+	for (int frame = 0; frame < 3 * BENCH_REFIT_FRAMES; ++frame) {
+		int phase = frame / BENCH_REFIT_FRAMES;
+		float amount = (float)((frame % BENCH_REFIT_FRAMES) + 1) / BENCH_REFIT_FRAMES;
+		deform(phase == 0 ? 0.2f * amount : 0.2f, phase == 1 ? 1.5f * amount : (phase > 1 ? 1.5f : 0), phase == 2 ? 0.1f : 0);
+		long cachedBefore = cachedDeforming.cacheEntries();
+		deforming.refit();
+		cachedDeforming.refit();
+		printf("%-28s %-9d %.3f ms, %ld tris moved, %ld of %ld cache entries invalidated, cost %.2fx built, %ld rebuilds\n", phases[phase], frame,
+			cachedDeforming.refitMs, cachedDeforming.refitMoved, cachedDeforming.refitInvalidated, cachedBefore, cachedDeforming.refitCost, cachedDeforming.rebuilds);
+		// moved tris must clear some entries, a frame where nothing moved must keep them all
+		pass &= printCheck("refit (invalidated)", "direct", (cachedDeforming.refitMoved > 0) != (cachedDeforming.refitInvalidated > 0), 1);
+		checkDeforming("refit");
+	}
+	ModelRayCache::setBudget(cacheBudget);
+
+	printf("%-28s %-9s %10s %10s %10s %8s\n", "kernel", "set", "ns/ray", "Mrays/s", "min ns", "spread");
+	const std::vector<Ray> &deformingRays = deformingSets[0].rays;
+	printStats("refit octree", "coherent", timeKernel(deformingRays.size(), [&](size_t i) {
+		Ray ray = deformingRays[i];
+		return deformingInstance.trace<QUERY_CLOSEST>(ray);
+	}));
+	// a refit swaps in the octree rebuilt in the background
+	deforming.finishRebuild();
+	cachedDeforming.finishRebuild();
+	deforming.refit();
+	cachedDeforming.refit();
+	printStats("rebuilt octree", "coherent", timeKernel(deformingRays.size(), [&](size_t i) {
+		Ray ray = deformingRays[i];
+		return deformingInstance.trace<QUERY_CLOSEST>(ray);
+	}));
+	printf("%-28s %-9s %.3f ms, cost %.2fx built, %ld rebuilds, bounds regrown %ld times\n", "Model::refit (rebuilt)", "", cachedDeforming.refitMs, cachedDeforming.refitCost, cachedDeforming.rebuilds, cachedDeforming.regrown);
+	checkDeforming("rebuilt");
+
+	// refitting every tri against building the octree from scratch
+	printf("%-28s %-9s %10s %10s %10s %8s\n", "kernel", "set", "ns/tri", "Mtris/s", "min ns", "spread");
+	printStats("Model::refit", "scatter", timeFrame(deforming.tris.size(), [&]() {
+		deforming.refit();
+	}));
+	printStats("Octree::calcOctree", "scatter", timeFrame(deforming.tris.size(), [&]() {
+		Octree::freeOctree(Octree::calcOctree(deforming.bbox, deforming.tris, std::min((int)std::round(std::log(deforming.tris.size() * OCTREE_NODES_PER_TRI) / std::log(8)), OCTREE_DEPTH_MAX)));
+	}));
+	deforming.finishRebuild();
+
+	// adaptive edge anti-aliasing against supersampling every pixel with the same sub-pixel samples
+	Camera aaCamera = frameCamera;
+	aaCamera.binInstances();
+	int framePixels = BENCH_FRAME_SIZE * BENCH_FRAME_SIZE;
+	Accumulator aaFrame(BENCH_FRAME_SIZE, BENCH_FRAME_SIZE);
+	std::vector<uint32_t> singlePixels(framePixels), supersampledPixels(framePixels), edgePixels(framePixels);
+	printf("\n%-28s %-9s %10s %10s %10s %8s\n", "anti-aliasing", "set", "ns/pixel", "Mpix/s", "min ns", "spread");
+	long singleRays = 0, supersampledRays = 0;
+	BenchStats singleStats = timeFrame(framePixels, [&]() {
+		singleRays = 0;
+		aaFrame.reset();
+		for (int y = 0; y < BENCH_FRAME_SIZE; ++y) {
+			for (int x = 0; x < BENCH_FRAME_SIZE; ++x) {
+				SampleInfo info;
+				aaFrame.add(x, y, aaCamera.samplePixel(x, y, 0, &info));
+				singleRays += info.rays;
+			}
+		}
+		aaFrame.endSample();
+	});
+	aaFrame.resolve(singlePixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+	printStats("1 sample", "direct", singleStats);
+	BenchStats supersampledStats = timeFrame(framePixels, [&]() {
+		supersampledRays = 0;
+		aaFrame.reset();
+		for (int y = 0; y < BENCH_FRAME_SIZE; ++y) {
+			for (int x = 0; x < BENCH_FRAME_SIZE; ++x) {
+				SampleInfo info;
+				Vec3 sum = aaCamera.samplePixel(x, y, 0, &info);
+				Vec3::m_cap(sum, COLOR_MAX);
+				for (unsigned int sample = 1; sample <= AA_EDGE_SAMPLES; ++sample) {
+					float offsetX, offsetY;
+					Vec3 lightOffset;
+					Accumulator::jitter(x, y, sample, offsetX, offsetY, lightOffset);
+					Vec3 color = aaCamera.shadeSubPixel(x, y, offsetX, offsetY, Vec3(0, 0, 0), &info);
+					Vec3::m_cap(color, COLOR_MAX);
+					Vec3::m_add(sum, color);
+				}
+				aaFrame.add(x, y, Vec3::scale(sum, 1.0f / (AA_EDGE_SAMPLES + 1)));
+				supersampledRays += info.rays;
+			}
+		}
+		aaFrame.endSample();
+	});
+	aaFrame.resolve(supersampledPixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+	printStats("supersampled", "direct", supersampledStats);
+	printf("%-28s %-9s %ld rays, %ld at 1 sample, %.3f mean channel error at 1 sample\n", "", "direct", supersampledRays, singleRays, channelError(singlePixels, supersampledPixels));
+
+	// without a budget every edge is refined, each pixel must be its 1 sample or its supersampled value
+	float budgets[2] = {1, AA_BUDGET};
+	for (float budget: budgets) {
+		EdgeAA edgeAA(budget);
+		BenchStats edgeStats = timeFrame(framePixels, [&]() {
+			aaFrame.reset();
+			edgeAA.render(aaCamera, aaFrame);
+			aaFrame.endSample();
+		});
+		aaFrame.resolve(edgePixels.data(), BENCH_FRAME_SIZE * sizeof(uint32_t));
+		char name[64];
+		snprintf(name, sizeof(name), "EdgeAA (budget %.2f)", budget);
+		printStats(name, "direct", edgeStats);
+		size_t mismatches = 0, refinedPixels = 0;
+		for (int i = 0; i < framePixels; ++i) {
+			bool supersampled = edgePixels[i] == supersampledPixels[i];
+			refinedPixels += supersampled && singlePixels[i] != supersampledPixels[i];
+			mismatches += !supersampled && edgePixels[i] != singlePixels[i];
+		}
+		pass &= printCheck(name, "direct", mismatches, framePixels);
+		printf("%-28s %-9s %.1f%% of pixels refined(%ld edges), %ld rays added to %ld(%.1f%%), %.3f mean channel error\n", "", "direct", 100 * edgeAA.refinedFraction(), edgeAA.candidates,
+			edgeAA.addedRays, edgeAA.baseRays, 100.0 * edgeAA.addedRays / edgeAA.baseRays, channelError(edgePixels, supersampledPixels));
+		if (budget >= 1) {
+			// pixels supersampling changes that showed no edge at their first sample, detail thinner than a pixel
+			size_t changed = 0;
+			for (int i = 0; i < framePixels; ++i) {
+				changed += singlePixels[i] != supersampledPixels[i];
+			}
+			printf("%-28s %-9s %ld of %ld pixels supersampling changes were not refined\n", "", "direct", (long)(changed - refinedPixels), (long)changed);
+		}
+	}
+
+	printf("\n%s\n", pass ? "all checks passed" : "CHECKS FAILED");
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <stdio.h>
+
+#include "include/common.h"
+#include "include/sharedframes.h"
+
+/* Example consumer of the shared memory frames written by ./main shm and ./render stream
+reads each newest frame in place and reports latency, frames it skipped and frames overwritten while it read them */
+#define FRAMEDUMP_WAIT_MS 5000
+#define FRAMEDUMP_POLL_MS 1
+
+static void usage() {
+	printf("Usage:\n");
+	printf("\tframedump [shm name] [frames] [delay ms per frame] [out.ppm]\n");
+	printf("a delay simulates a slow consumer, out.ppm gets the last intact frame\n");
+}
+
+int main(int argc, char* argv[]) {
+	if (argc >= 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+		usage();
+		return 0;
+	}
+	const char *name = argc >= 2 ? argv[1] : SHARED_FRAMES_NAME;
+	long frames = argc >= 3 ? atol(argv[2]) : 0;
+	int delayMs = argc >= 4 ? atoi(argv[3]) : 0;
+	const char *output = argc >= 5 ? argv[4] : nullptr;
+
+	// the producer may not have started yet
+	SharedFrameReader reader;
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+	while (!reader.open(name)) {
+		if (std::chrono::steady_clock::now() - waitStart > std::chrono::milliseconds(FRAMEDUMP_WAIT_MS)) {
+			printf("No frames at \"%s\"\n", name);
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(FRAMEDUMP_POLL_MS));
+	}
+	const SharedFramesHeader *info = reader.info();
+	printf("Reading \"%s\", %u slots of %ux%u\n", name, info->slots, info->width, info->height);
+	fflush(stdout);
+
+	std::vector<double> latencies;
+	std::vector<uint32_t> last, copy;
+	uint64_t checksum = 0;
+	std::chrono::steady_clock::time_point lastFrame = std::chrono::steady_clock::now();
+	while (frames == 0 || (long)reader.read < frames) {
+		SharedFrame frame;
+		if (!reader.acquire(frame)) {
+			// a producer that stopped publishing is done
+			if (std::chrono::steady_clock::now() - lastFrame > std::chrono::milliseconds(FRAMEDUMP_WAIT_MS)) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(FRAMEDUMP_POLL_MS));
+			continue;
+		}
+		lastFrame = std::chrono::steady_clock::now();
+		latencies.push_back((SharedFrames::now() - frame.timestamp) / 1000000.0);
+
+		// stands in for an encoder reading the frame in place
+		uint64_t sum = 0;
+		for (uint32_t y = 0; y < frame.height; ++y) {
+			const uint32_t *row = frame.pixels + ((size_t)y * (frame.pitch / sizeof(uint32_t)));
+			for (uint32_t x = 0; x < frame.width; ++x) {
+				sum += row[x] >> 8;
+			}
+		}
+		if (output) {
+			copy.assign(frame.pixels, frame.pixels + ((size_t)frame.height * (frame.pitch / sizeof(uint32_t))));
+		}
+		if (delayMs > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+		}
+		if (reader.release()) {
+			checksum = sum;
+			last.swap(copy);
+		}
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("Read %ld frames, %ld skipped, %ld torn, producer dropped %ld\n", (long)reader.read, (long)reader.skipped, (long)reader.torn, (long)info->dropped.load());
+	if (latencies.size() > 0) {
+		printf("Latency from publish: median %.2f ms, max %.2f ms, last checksum %016lx\n", latencies[latencies.size() / 2], latencies.back(), (unsigned long)checksum);
+	}
+
+	if (output && last.size() > 0) {
+		FILE *file = fopen(output, "wb");
+		if (!file) {
+			printf("Could not open \"%s\"\n", output);
+			return 1;
+		}
+		fprintf(file, "P6\n%u %u\n255\n", info->width, info->height);
+		int rowPixels = info->pitch / sizeof(uint32_t);
+		for (uint32_t y = 0; y < info->height; ++y) {
+			for (uint32_t x = 0; x < info->width; ++x) {
+				uint32_t pixel = last[ARRAY_INDEX(x, y, rowPixels)];
+				uint8_t rgb[COLOR_NUM] = {(uint8_t)(pixel >> 24), (uint8_t)(pixel >> 16), (uint8_t)(pixel >> 8)};
+				fwrite(rgb, 1, COLOR_NUM, file);
+			}
+		}
+		fclose(file);
+	}
+	return 0;
+}
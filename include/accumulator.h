@@ -0,0 +1,125 @@
+#ifndef ACCUMULATOR
+#define ACCUMULATOR
+
+#include <algorithm>
+#include <cstdint>
+
+#include "common.h"
+#include "vec3.h"
+
+// Progressive accumulation
+// samples traced per pixel on each frame the view stays static, bounds the idle frame cost
+#define ACCUM_SAMPLES_PER_FRAME 1
+// samples per pixel after which the image is considered converged and tracing stops
+#define ACCUM_MAX_SAMPLES 64
+// max offset of a light along each axis when jittering it for soft shadows
+#define ACCUM_LIGHT_JITTER 8
+
+// Floating point framebuffer that averages jittered samples of a static view
+class Accumulator {
+private:
+	static inline uint32_t hash(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352d;
+		x ^= x >> 15;
+		x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+	// low discrepancy sequence, rotated by a per pixel offset so neighbouring pixels don't share a pattern
+	static inline float halton(uint32_t index, uint32_t base, uint32_t rotation) {
+		float result = 0, f = 1;
+		while (index > 0) {
+			f /= base;
+			result += f * (index % base);
+			index /= base;
+		}
+		result += rotation * (1.0f / 4294967296.0f);
+		return result - (int)result;
+	}
+public:
+	int width, height;
+	// one plane per color channel so the resolve pass vectorizes
+	float *channels[COLOR_NUM];
+	// samples per pixel accumulated so far
+	unsigned int samples;
+	unsigned int samplesPerFrame, maxSamples;
+
+	Accumulator (int width, int height, unsigned int samplesPerFrame = ACCUM_SAMPLES_PER_FRAME, unsigned int maxSamples = ACCUM_MAX_SAMPLES) : width(width), height(height), samples(0), samplesPerFrame(std::max(samplesPerFrame, 1u)), maxSamples(std::max(maxSamples, 1u)) {
+		for (int color = 0; color < COLOR_NUM; ++color) {
+			channels[color] = new float[width * height];
+		}
+	}
+	Accumulator (const Accumulator &) = delete;
+	Accumulator &operator=(const Accumulator &) = delete;
+	~Accumulator () {
+		for (int color = 0; color < COLOR_NUM; ++color) {
+			delete[] channels[color];
+		}
+	}
+	// discard accumulated samples, call whenever the camera or scene changes
+	void reset() {
+		samples = 0;
+	}
+	inline bool converged() const {
+		return samples >= maxSamples;
+	}
+	// a changed view gets a single sample so moving stays as fast as before, static views refine
+	inline unsigned int frameSamples() const {
+		if (samples == 0) {
+			return 1;
+		}
+		return std::min(samplesPerFrame, maxSamples - std::min(samples, maxSamples));
+	}
+	inline void add(int x, int y, const Vec3 &color) {
+		int i = ARRAY_INDEX(x, y, width);
+		if (samples == 0) {
+			channels[COLOR_R][i] = color.axis[COLOR_R];
+			channels[COLOR_G][i] = color.axis[COLOR_G];
+			channels[COLOR_B][i] = color.axis[COLOR_B];
+		} else {
+			channels[COLOR_R][i] += color.axis[COLOR_R];
+			channels[COLOR_G][i] += color.axis[COLOR_G];
+			channels[COLOR_B][i] += color.axis[COLOR_B];
+		}
+	}
+	// call once every pixel has had add called for the current sample
+	inline void endSample() {
+		++samples;
+	}
+	// tone map the average of all samples and pack it into an RGBX8888 texture
+	void resolve(uint32_t *pixels, int pitch) const {
+		float scale = 1.0f / std::max(samples, 1u);
+		int rowPixels = pitch / sizeof(uint32_t);
+
+		#pragma omp parallel for
+		for (int y = 0; y < height; ++y) {
+			const float *r = channels[COLOR_R] + (y * width);
+			const float *g = channels[COLOR_G] + (y * width);
+			const float *b = channels[COLOR_B] + (y * width);
+			uint32_t *row = pixels + (y * rowPixels);
+			#pragma omp simd
+			for (int x = 0; x < width; ++x) {
+				row[x] = PACK_COLOR(std::min(r[x] * scale, 1.0f), std::min(g[x] * scale, 1.0f), std::min(b[x] * scale, 1.0f));
+			}
+		}
+	}
+	/* sub-pixel and light offsets for one sample of one pixel
+	sample 0 is never jittered so the first frame after a change matches the non-accumulated image */
+	static inline void jitter(int x, int y, unsigned int sample, float &offsetX, float &offsetY, Vec3 &lightOffset) {
+		if (sample == 0) {
+			offsetX = 0;
+			offsetY = 0;
+			lightOffset = Vec3(0, 0, 0);
+			return;
+		}
+		uint32_t rotation = hash(x ^ hash(y));
+		offsetX = halton(sample, 2, rotation) - 0.5f;
+		offsetY = halton(sample, 3, hash(rotation)) - 0.5f;
+		lightOffset = Vec3((halton(sample, 5, hash(rotation + 1)) * 2 - 1) * ACCUM_LIGHT_JITTER,
+			(halton(sample, 7, hash(rotation + 2)) * 2 - 1) * ACCUM_LIGHT_JITTER,
+			(halton(sample, 11, hash(rotation + 3)) * 2 - 1) * ACCUM_LIGHT_JITTER);
+	}
+};
+
+#endif
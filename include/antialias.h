@@ -0,0 +1,169 @@
+#ifndef ANTIALIAS
+#define ANTIALIAS
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#include "common.h"
+#include "vec3.h"
+#include "scene.h"
+#include "accumulator.h"
+#include "profiler.h"
+
+// Adaptive edge anti-aliasing
+// extra sub-pixel samples traced for each refined pixel
+#define AA_EDGE_SAMPLES 4
+// pixels refined per frame at most, as a fraction of the image
+#define AA_BUDGET 0.15
+// depth jump between neighbouring pixels, in world units(one pixel is one unit), taken as a silhouette within one instance
+#define AA_DEPTH_GAP 4
+// tris meeting at a smaller angle than this shade the same, so their shared edge is left alone
+#define AA_CREASE_COSINE 0.999f
+// why a pixel is refined, the budget goes to higher reasons first
+enum AA_EDGE{AA_EDGE_NONE, AA_EDGE_TRI, AA_EDGE_SHADOW, AA_EDGE_SILHOUETTE, AA_EDGE_NUM};
+
+/* Renders one sample per pixel, then spends AA_EDGE_SAMPLES more only on pixels that differ from a neighbour
+in instance, depth, which lights are blocked or tri(across a crease), so edges look supersampled for a fraction of the rays
+refined pixels average tone mapped samples, so an edge against a light saturated surface still blends */
+class EdgeAA {
+private:
+	std::vector<Vec3> colors;
+	std::vector<SampleInfo> infos;
+	std::vector<uint8_t> edges;
+	std::vector<int> refine;
+
+	static inline int classify(const SampleInfo &a, const SampleInfo &b) {
+		if (a.instance != b.instance || ((a.depth == RAY_MISS) != (b.depth == RAY_MISS)) ||
+			(a.depth != RAY_MISS && std::fabs(a.depth - b.depth) > AA_DEPTH_GAP)) {
+			return AA_EDGE_SILHOUETTE;
+		}
+		if (a.shadowed != b.shadowed) {
+			return AA_EDGE_SHADOW;
+		}
+		// a miss never reaches here with a hit, and both normals are only set on hits
+		if (a.depth != RAY_MISS && a.tri != b.tri && Vec3::dot(a.normal, b.normal) < AA_CREASE_COSINE) {
+			return AA_EDGE_TRI;
+		}
+		return AA_EDGE_NONE;
+	}
+public:
+	float budget;
+	unsigned int edgeSamples;
+	// pixels that differed from a neighbour, those refined within the budget, and rays of the first and refining passes
+	long candidates, refined, baseRays, addedRays;
+
+	EdgeAA (float budget = AA_BUDGET, unsigned int edgeSamples = AA_EDGE_SAMPLES) : budget(budget), edgeSamples(edgeSamples), candidates(0), refined(0), baseRays(0), addedRays(0) {}
+
+	inline float refinedFraction() const {
+		return colors.size() > 0 ? refined / (float)colors.size() : 0;
+	}
+	// add one anti-aliased sample of every pixel of the accumulator, lights are never jittered
+	void render(const Camera &camera, Accumulator &accumulator) {
+		int width = accumulator.width, height = accumulator.height;
+		int pixels = width * height;
+		colors.resize(pixels);
+		infos.resize(pixels);
+		edges.resize(pixels);
+
+		long rays = 0;
+		ProfileZone firstZone("AA first sample");
+		#pragma omp parallel for schedule(dynamic) reduction(+:rays)
+		for (int y = 0; y < height; ++y) {
+			PROFILE_ZONE_ARG("Trace row", y);
+			for (int x = 0; x < width; ++x) {
+				int i = ARRAY_INDEX(x, y, width);
+				infos[i] = SampleInfo();
+				colors[i] = camera.samplePixel(x, y, 0, &infos[i]);
+				rays += infos[i].rays;
+			}
+		}
+		firstZone.end();
+		baseRays = rays;
+
+		// each pixel takes the strongest difference to its 4 neighbours
+		long levels[AA_EDGE_NUM] = {0};
+		long levelTri = 0, levelShadow = 0, levelSilhouette = 0;
+		#pragma omp parallel for reduction(+:levelTri, levelShadow, levelSilhouette)
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				int i = ARRAY_INDEX(x, y, width);
+				int edge = AA_EDGE_NONE;
+				if (x > 0) {
+					edge = std::max(edge, classify(infos[i], infos[i - 1]));
+				}
+				if (x + 1 < width) {
+					edge = std::max(edge, classify(infos[i], infos[i + 1]));
+				}
+				if (y > 0) {
+					edge = std::max(edge, classify(infos[i], infos[i - width]));
+				}
+				if (y + 1 < height) {
+					edge = std::max(edge, classify(infos[i], infos[i + width]));
+				}
+				edges[i] = edge;
+				levelTri += edge == AA_EDGE_TRI;
+				levelShadow += edge == AA_EDGE_SHADOW;
+				levelSilhouette += edge == AA_EDGE_SILHOUETTE;
+			}
+		}
+		levels[AA_EDGE_TRI] = levelTri;
+		levels[AA_EDGE_SHADOW] = levelShadow;
+		levels[AA_EDGE_SILHOUETTE] = levelSilhouette;
+		candidates = levelTri + levelShadow + levelSilhouette;
+
+		/* whole reasons fit the budget from the strongest down, the first that doesn't fit
+		is thinned evenly over the image rather than cut off at some row */
+		long remaining = edgeSamples > 0 ? (long)(budget * pixels) : 0;
+		long taken[AA_EDGE_NUM] = {0};
+		for (int level = AA_EDGE_NUM - 1; level > AA_EDGE_NONE; --level) {
+			taken[level] = std::min(levels[level], remaining);
+			remaining -= taken[level];
+		}
+		refine.clear();
+		long seen[AA_EDGE_NUM] = {0};
+		for (int i = 0; i < pixels; ++i) {
+			int level = edges[i];
+			if (level == AA_EDGE_NONE) {
+				continue;
+			}
+			long k = seen[level]++;
+			if (((k + 1) * taken[level]) / levels[level] > (k * taken[level]) / levels[level]) {
+				refine.push_back(i);
+			}
+		}
+		refined = refine.size();
+
+		rays = 0;
+		ProfileZone refineZone("AA refine");
+		#pragma omp parallel for schedule(dynamic, 64) reduction(+:rays)
+		for (size_t r = 0; r < refine.size(); ++r) {
+			int i = refine[r];
+			int x = i % width, y = i / width;
+			Vec3 sum = colors[i];
+			Vec3::m_cap(sum, COLOR_MAX);
+			for (unsigned int sample = 1; sample <= edgeSamples; ++sample) {
+				float offsetX, offsetY;
+				Vec3 lightOffset;
+				Accumulator::jitter(x, y, sample, offsetX, offsetY, lightOffset);
+				SampleInfo info;
+				Vec3 color = camera.shadeSubPixel(x, y, offsetX, offsetY, Vec3(0, 0, 0), &info);
+				Vec3::m_cap(color, COLOR_MAX);
+				Vec3::m_add(sum, color);
+				rays += info.rays;
+			}
+			colors[i] = Vec3::scale(sum, 1.0f / (edgeSamples + 1));
+		}
+		refineZone.end();
+		addedRays = rays;
+
+		#pragma omp parallel for
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				accumulator.add(x, y, colors[ARRAY_INDEX(x, y, width)]);
+			}
+		}
+	}
+};
+
+#endif
@@ -27,17 +27,20 @@ public:
 	BBox &operator+=(const BBox &bbox) {
 		if (bbox.min.axis[AXIS_X] < min.axis[AXIS_X]) {
 			min.axis[AXIS_X] = bbox.min.axis[AXIS_X];
-		} else if (bbox.max.axis[AXIS_X] > max.axis[AXIS_X]) {
+		}
+		if (bbox.max.axis[AXIS_X] > max.axis[AXIS_X]) {
 			max.axis[AXIS_X] = bbox.max.axis[AXIS_X];
 		}
 		if (bbox.min.axis[AXIS_Y] < min.axis[AXIS_Y]) {
 			min.axis[AXIS_Y] = bbox.min.axis[AXIS_Y];
-		} else if (bbox.max.axis[AXIS_Y] > max.axis[AXIS_Y]) {
+		}
+		if (bbox.max.axis[AXIS_Y] > max.axis[AXIS_Y]) {
 			max.axis[AXIS_Y] = bbox.max.axis[AXIS_Y];
 		}
 		if (bbox.min.axis[AXIS_Z] < min.axis[AXIS_Z]) {
 			min.axis[AXIS_Z] = bbox.min.axis[AXIS_Z];
-		} else if (bbox.max.axis[AXIS_Z] > max.axis[AXIS_Z]) {
+		}
+		if (bbox.max.axis[AXIS_Z] > max.axis[AXIS_Z]) {
 			max.axis[AXIS_Z] = bbox.max.axis[AXIS_Z];
 		}
 		return *this;
@@ -92,6 +95,10 @@ public:
 			return tmin;
 		}
 	}
+	inline float surfaceArea() const {
+		Vec3 size = Vec3::sub(max, min);
+		return 2 * ((size.axis[AXIS_X] * size.axis[AXIS_Y]) + (size.axis[AXIS_X] * size.axis[AXIS_Z]) + (size.axis[AXIS_Y] * size.axis[AXIS_Z]));
+	}
 	static inline bool overlap(const BBox &a, const BBox &b) {
 		return geqMargin(a.max.axis[AXIS_X], b.min.axis[AXIS_X]) && geqMargin(b.max.axis[AXIS_X], a.min.axis[AXIS_X]) &&
 			geqMargin(a.max.axis[AXIS_Y], b.min.axis[AXIS_Y]) && geqMargin(b.max.axis[AXIS_Y], a.min.axis[AXIS_Y]) &&
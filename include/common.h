@@ -2,6 +2,7 @@
 #define COMMON
 
 #include <limits>
+#include <cstdint>
 
 #define WINDOW_NAME "RayEngine"
 #define SCREEN_WIDTH 1920
@@ -17,6 +18,8 @@
 
 #define RAY_MISS std::numeric_limits<float>::max()
 #define RAY_INVALID -1
+// what a traversal is asked, the closest hit along the ray or only whether anything blocks it before a target depth
+enum QUERY{QUERY_CLOSEST, QUERY_OCCLUSION};
 
 enum AXIS{AXIS_X, AXIS_Y, AXIS_Z, AXIS_NUM};
 enum FACE{FACE_X_MIN, FACE_X_PLUS, FACE_Y_MIN, FACE_Y_PLUS, FACE_Z_MIN, FACE_Z_PLUS, FACE_NONE};
@@ -26,6 +29,8 @@ enum FACE{FACE_X_MIN, FACE_X_PLUS, FACE_Y_MIN, FACE_Y_PLUS, FACE_Z_MIN, FACE_Z_P
 
 enum COLOR{COLOR_R, COLOR_G, COLOR_B, COLOR_NUM};
 #define COLOR_MAX Vec3(1,1,1)
+// packs color channels in the range [0, 1] as RGBX8888
+#define PACK_COLOR(r,g,b) (((uint32_t)((r) * 255) << 24) | ((uint32_t)((g) * 255) << 16) | ((uint32_t)((b) * 255) << 8))
 
 #define FLOAT_MARGIN_CLOSE 0.01
 #define FLOAT_MARGIN_PRECISE 0.001
@@ -0,0 +1,131 @@
+#ifndef DEMOSCENE
+#define DEMOSCENE
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#include "common.h"
+#include "vec3.h"
+#include "model.h"
+#include "light.h"
+#include "scene.h"
+
+// The demo scene, shared by the interactive and headless renderers so they all draw the same thing
+// TODO load the camera position/model list from file
+// how far the ball squashes and ripples when deformed, as a fraction of its size
+#define DEMO_WOBBLE 0.15
+class DemoScene {
+private:
+	static inline uint32_t hashFloat(uint32_t hash, float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		// FNV-1a
+		for (int i = 0; i < 4; ++i) {
+			hash ^= (bits >> (i * 8)) & 0xFF;
+			hash *= 16777619;
+		}
+		return hash;
+	}
+	static inline uint32_t hashVec3(uint32_t hash, const Vec3 &v) {
+		return hashFloat(hashFloat(hashFloat(hash, v.axis[AXIS_X]), v.axis[AXIS_Y]), v.axis[AXIS_Z]);
+	}
+public:
+	Camera camera;
+	Model ball, pillar;
+	ModelInstance ball1;
+	ModelInstance pillars[6];
+	Light camLight, light2;
+	// the pillars' mesh out of core when given a cluster file, see pagePillars
+	PagedGeometry pagedGeometry;
+	Model *pagedPillar;
+	float ballVel;
+	// the ball's verts before it was first deformed, and frames it has been deformed for
+	std::vector<Vec3> ballRest;
+	int wobbleFrame;
+
+	DemoScene () : camera(Vec3(800, 800, 1500)), ball("models/ball.obj", true), pillar("models/pillar.obj", true),
+		ball1(&ball, Vec3(600, 500, 0)),
+		camLight(Vec3(1, 0.5, 0), 150000, Vec3(500, 500, 500), true), light2(Vec3(0.2, 0.5, 1), 150000, Vec3(1300, 100, 600), true),
+		pagedPillar(nullptr), ballVel(10), wobbleFrame(0) {
+		camera.scene.addModel(&ball1);
+		for (int x = 0; x < 2; ++x) {
+			for (int y = 0; y < 3; ++y) {
+				pillars[(x * 3) + y] = ModelInstance(&pillar, Vec3(150 + x * 1600, 200 + y * 400, 0));
+				camera.scene.addModel(&pillars[(x * 3) + y]);
+			}
+		}
+		camera.scene.addLight(&camLight);
+		camera.scene.addLight(&light2);
+	}
+	DemoScene (const DemoScene &) = delete;
+	DemoScene &operator= (const DemoScene &) = delete;
+	~DemoScene () {
+		delete pagedPillar;
+	}
+	/* every pillar traces the mesh in a cluster file instead, written by ./render pack, paged in as rays reach it
+	false if the file can't be opened, the pillars are left as they were */
+	bool pagePillars(const char *filename) {
+		if (!pagedGeometry.open(filename)) {
+			return false;
+		}
+		delete pagedPillar;
+		pagedPillar = new Model(&pagedGeometry);
+		for (ModelInstance &instance: pillars) {
+			instance = ModelInstance(pagedPillar, instance.pos);
+		}
+		return true;
+	}
+	// light that follows camera
+	void followCamera() {
+		camLight.pos.axis[AXIS_X] = camera.pos.axis[AXIS_X];
+		camLight.pos.axis[AXIS_Y] = camera.pos.axis[AXIS_Y];
+	}
+	// animated model
+	void animate() {
+		if (ball1.pos.axis[AXIS_X] > 1200 || ball1.pos.axis[AXIS_X] < 600) {
+			ballVel *= -1;
+		}
+		ball1.pos.axis[AXIS_X] += ballVel;
+	}
+	// squashes the ball and runs a ripple over it, moving its verts and refitting it every frame
+	void deform() {
+		if (!ball.dynamic) {
+			for (const Vert *vert: ball.verts) {
+				ballRest.push_back(vert->pos);
+			}
+			ball.setDynamic();
+		}
+		++wobbleFrame;
+		Vec3 center(0, 0, 0);
+		for (const Vec3 &pos: ballRest) {
+			Vec3::m_add(center, pos);
+		}
+		center = Vec3::scale(center, 1.0f / ballRest.size());
+		float squash = DEMO_WOBBLE * std::sin(wobbleFrame * 0.2f);
+		for (size_t i = 0; i < ballRest.size(); ++i) {
+			Vec3 offset = Vec3::sub(ballRest[i], center);
+			float ripple = 1 + (DEMO_WOBBLE * std::sin((wobbleFrame * 0.3f) + (offset.axis[AXIS_Z] * 0.05f)));
+			ball.verts[i]->pos = Vec3::add(center, Vec3(offset.axis[AXIS_X] * (1 + squash) * ripple, offset.axis[AXIS_Y] * (1 + squash) * ripple, offset.axis[AXIS_Z] * (1 - squash)));
+		}
+		ball.refit();
+	}
+	// hash of all geometry, instance positions and lights, processes rendering the same scene get the same value
+	uint32_t fingerprint() const {
+		uint32_t hash = 2166136261u;
+		for (const ModelInstance *instance: camera.scene.models) {
+			hash = hashVec3(hash, instance->pos);
+			for (const Vert *vert: instance->model->verts) {
+				hash = hashVec3(hash, vert->pos);
+			}
+		}
+		for (const Light *light: camera.scene.lights) {
+			hash = hashVec3(hashVec3(hash, light->pos), light->color);
+			hash = hashFloat(hash, light->lum);
+		}
+		return hash;
+	}
+};
+
+#endif
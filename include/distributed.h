@@ -0,0 +1,607 @@
+#ifndef DISTRIBUTED
+#define DISTRIBUTED
+
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <omp.h>
+
+#include "common.h"
+#include "vec3.h"
+#include "scene.h"
+#include "demoscene.h"
+#include "profiler.h"
+
+// Distributed tile rendering
+// bumped whenever a message layout changes, workers with another version are turned away
+#define DIST_PROTOCOL_VERSION 1
+// side in pixels of the tiles handed to workers
+#define DIST_TILE_SIZE 64
+// tiles in flight per worker, the next tile is already queued while a result travels back
+#define DIST_PIPELINE_DEPTH 2
+// a worker that has spent this long on one tile is treated as dead and loses its tiles
+#define DIST_TILE_TIMEOUT_MS 30000
+// once the queue is empty idle workers duplicate tiles that have taken this many times the mean tile time
+#define DIST_SPECULATE_FACTOR 2
+// give up when no worker has been connected for this long
+#define DIST_IDLE_TIMEOUT_MS 30000
+#define DIST_POLL_MS 50
+#define DIST_RECV_BUFFER 65536
+
+/* every message is a list of 32 bit words in network order, starting with its type
+HELLO  worker -> coordinator: version, scene fingerprint, threads
+TILE   coordinator -> worker: tile id, view, camera x y z(float bits), image width, height, tile x, y, width, height
+RESULT worker -> coordinator: tile id, render time in microseconds, then one RGBX8888 word per tile pixel, row by row
+DONE   coordinator -> worker: no more tiles, disconnect */
+enum DIST_MSG{DIST_MSG_HELLO, DIST_MSG_TILE, DIST_MSG_RESULT, DIST_MSG_DONE};
+#define DIST_HELLO_WORDS 4
+#define DIST_TILE_WORDS 12
+#define DIST_RESULT_WORDS 3
+
+namespace Distributed {
+	typedef std::chrono::steady_clock Clock;
+
+	static inline uint32_t floatBits(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+	static inline float bitsFloat(uint32_t bits) {
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+	static inline long micros(Clock::time_point start, Clock::time_point end) {
+		return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	}
+	static bool writeAll(int fd, const void *data, size_t size) {
+		const uint8_t *bytes = (const uint8_t *)data;
+		while (size > 0) {
+			ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+			if (sent <= 0) {
+				return false;
+			}
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+	static bool readAll(int fd, void *data, size_t size) {
+		uint8_t *bytes = (uint8_t *)data;
+		while (size > 0) {
+			ssize_t received = recv(fd, bytes, size, 0);
+			if (received <= 0) {
+				return false;
+			}
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+	// converts to network order in place and sends
+	static bool sendWords(int fd, uint32_t *words, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			words[i] = htonl(words[i]);
+		}
+		return writeAll(fd, words, count * sizeof(uint32_t));
+	}
+	static bool readWords(int fd, uint32_t *words, size_t count) {
+		if (!readAll(fd, words, count * sizeof(uint32_t))) {
+			return false;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			words[i] = ntohl(words[i]);
+		}
+		return true;
+	}
+	// results are small and latency bound, don't let Nagle hold them back
+	static void setNoDelay(int fd) {
+		int flag = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	}
+	static int connectTo(const char *host, int port) {
+		addrinfo hints, *addresses;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		char service[16];
+		snprintf(service, sizeof(service), "%d", port);
+		if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+			return -1;
+		}
+		int fd = -1;
+		for (addrinfo *address = addresses; address != nullptr; address = address->ai_next) {
+			fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (fd < 0) {
+				continue;
+			}
+			if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+				break;
+			}
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(addresses);
+		if (fd >= 0) {
+			setNoDelay(fd);
+		}
+		return fd;
+	}
+	// port 0 picks a free port, which is written back
+	static int listenOn(int &port) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			return -1;
+		}
+		int flag = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(port);
+		socklen_t length = sizeof(address);
+		if (bind(fd, (sockaddr *)&address, length) != 0 || listen(fd, SOMAXCONN) != 0 || getsockname(fd, (sockaddr *)&address, &length) != 0) {
+			close(fd);
+			return -1;
+		}
+		port = ntohs(address.sin_port);
+		return fd;
+	}
+}
+
+// one tile of one view
+struct DistTile {
+	int view, x, y, width, height;
+	bool done;
+	// workers currently holding the tile, more than one once it has been duplicated
+	int holders;
+};
+
+struct DistAssignment {
+	int tile;
+	Distributed::Clock::time_point sent;
+};
+
+// the coordinator's view of one worker connection
+struct DistWorker {
+	int fd;
+	int id;
+	bool alive, ready;
+	int threads;
+	// bytes received but not yet parsed into a whole message
+	std::vector<uint8_t> input;
+	std::vector<DistAssignment> outstanding;
+	Distributed::Clock::time_point connected, disconnected, lastResult;
+	// tiles used, results for tiles another worker finished first, tiles taken back when the worker was dropped
+	long tiles, duplicates, lost;
+	long pixels, renderMicros, serviceMicros;
+	long bytesIn, bytesOut;
+
+	DistWorker (int fd, int id) : fd(fd), id(id), alive(true), ready(false), threads(0), connected(Distributed::Clock::now()), lastResult(connected),
+		tiles(0), duplicates(0), lost(0), pixels(0), renderMicros(0), serviceMicros(0), bytesIn(0), bytesOut(0) {}
+};
+
+/* Splits the views into tiles and hands them to any number of worker processes
+workers pull tiles as they finish them, so faster workers get more, dead workers' tiles are requeued
+and slow ones are raced by idle workers once nothing else is left */
+class TileCoordinator {
+private:
+	int listenFd;
+	std::vector<DistTile> tiles;
+	std::deque<int> pending;
+	int remaining;
+	// completed tiles and their summed time from the worker starting them to the result arriving
+	long completed, completedMicros;
+
+	bool issue(DistWorker &worker, int tileId) {
+		const DistTile &tile = tiles[tileId];
+		const Vec3 &view = views[tile.view];
+		uint32_t message[DIST_TILE_WORDS] = {DIST_MSG_TILE, (uint32_t)tileId, (uint32_t)tile.view,
+			Distributed::floatBits(view.axis[AXIS_X]), Distributed::floatBits(view.axis[AXIS_Y]), Distributed::floatBits(view.axis[AXIS_Z]),
+			(uint32_t)width, (uint32_t)height, (uint32_t)tile.x, (uint32_t)tile.y, (uint32_t)tile.width, (uint32_t)tile.height};
+		// the holder is recorded first so dropping the worker on a failed send requeues the tile
+		++tiles[tileId].holders;
+		worker.outstanding.push_back({tileId, Distributed::Clock::now()});
+		if (!Distributed::sendWords(worker.fd, message, DIST_TILE_WORDS)) {
+			drop(worker, "send failed");
+			return false;
+		}
+		worker.bytesOut += sizeof(message);
+		return true;
+	}
+	// the tile an idle worker should duplicate, or -1
+	int speculate(const DistWorker &idle, Distributed::Clock::time_point now) const {
+		if (completed == 0) {
+			return -1;
+		}
+		long threshold = DIST_SPECULATE_FACTOR * (completedMicros / completed);
+		int best = -1;
+		long bestAge = threshold;
+		for (const DistWorker &worker: workers) {
+			if (!worker.alive || worker.id == idle.id) {
+				continue;
+			}
+			for (const DistAssignment &assignment: worker.outstanding) {
+				long age = Distributed::micros(std::max(assignment.sent, worker.lastResult), now);
+				if (!tiles[assignment.tile].done && tiles[assignment.tile].holders == 1 && age > bestAge) {
+					best = assignment.tile;
+					bestAge = age;
+				}
+			}
+		}
+		return best;
+	}
+	// keeps the worker's pipeline full
+	void schedule(DistWorker &worker, Distributed::Clock::time_point now) {
+		while (worker.alive && worker.ready && worker.outstanding.size() < DIST_PIPELINE_DEPTH) {
+			int tileId = -1;
+			while (tileId < 0 && !pending.empty()) {
+				tileId = pending.front();
+				pending.pop_front();
+				if (tiles[tileId].done) {
+					tileId = -1;
+				}
+			}
+			if (tileId < 0 && worker.outstanding.empty()) {
+				tileId = speculate(worker, now);
+				if (tileId >= 0) {
+					++speculated;
+				}
+			}
+			if (tileId < 0 || !issue(worker, tileId)) {
+				return;
+			}
+		}
+	}
+	void drop(DistWorker &worker, const char *reason) {
+		if (!worker.alive) {
+			return;
+		}
+		printf("Worker %d dropped: %s, %ld tiles requeued\n", worker.id, reason, (long)worker.outstanding.size());
+		close(worker.fd);
+		worker.alive = false;
+		worker.disconnected = Distributed::Clock::now();
+		for (const DistAssignment &assignment: worker.outstanding) {
+			DistTile &tile = tiles[assignment.tile];
+			--tile.holders;
+			if (!tile.done && tile.holders == 0) {
+				pending.push_front(assignment.tile);
+				++requeued;
+				++worker.lost;
+			}
+		}
+		worker.outstanding.clear();
+	}
+	void accept() {
+		int fd = ::accept(listenFd, nullptr, nullptr);
+		if (fd < 0) {
+			return;
+		}
+		Distributed::setNoDelay(fd);
+		workers.push_back(DistWorker(fd, workers.size()));
+	}
+	inline uint32_t inputWord(const DistWorker &worker, size_t offset) const {
+		uint32_t word;
+		memcpy(&word, worker.input.data() + offset, sizeof(word));
+		return ntohl(word);
+	}
+	void result(DistWorker &worker, int tileId, long renderMicros, const uint8_t *data, Distributed::Clock::time_point now) {
+		DistTile &tile = tiles[tileId];
+		for (size_t i = 0; i < worker.outstanding.size(); ++i) {
+			if (worker.outstanding[i].tile == tileId) {
+				// pipelined tiles wait for the one before them, time them from when the worker could start
+				long serviceMicros = Distributed::micros(std::max(worker.outstanding[i].sent, worker.lastResult), now);
+				worker.serviceMicros += serviceMicros;
+				completedMicros += serviceMicros;
+				++completed;
+				worker.outstanding.erase(worker.outstanding.begin() + i);
+				break;
+			}
+		}
+		worker.lastResult = now;
+		worker.renderMicros += renderMicros;
+		--tile.holders;
+		if (tile.done) {
+			++worker.duplicates;
+			return;
+		}
+		for (int y = 0; y < tile.height; ++y) {
+			uint32_t *row = images[tile.view].data() + ((tile.y + y) * width) + tile.x;
+			for (int x = 0; x < tile.width; ++x) {
+				uint32_t pixel;
+				memcpy(&pixel, data + (ARRAY_INDEX(x, y, tile.width) * sizeof(uint32_t)), sizeof(pixel));
+				row[x] = ntohl(pixel);
+			}
+		}
+		tile.done = true;
+		--remaining;
+		++worker.tiles;
+		worker.pixels += tile.width * tile.height;
+	}
+	// parses every whole message received so far, returns false on a protocol error
+	bool parse(DistWorker &worker, Distributed::Clock::time_point now) {
+		size_t offset = 0;
+		while (worker.input.size() - offset >= sizeof(uint32_t)) {
+			size_t available = worker.input.size() - offset;
+			uint32_t type = inputWord(worker, offset);
+			if (type == DIST_MSG_HELLO && !worker.ready) {
+				if (available < DIST_HELLO_WORDS * sizeof(uint32_t)) {
+					break;
+				}
+				uint32_t version = inputWord(worker, offset + 4), workerFingerprint = inputWord(worker, offset + 8);
+				worker.threads = inputWord(worker, offset + 12);
+				offset += DIST_HELLO_WORDS * sizeof(uint32_t);
+				if (version != DIST_PROTOCOL_VERSION || workerFingerprint != fingerprint) {
+					printf("Worker %d rejected: protocol %u scene %08x, expected protocol %u scene %08x\n", worker.id, version, workerFingerprint, DIST_PROTOCOL_VERSION, fingerprint);
+					uint32_t done = DIST_MSG_DONE;
+					Distributed::sendWords(worker.fd, &done, 1);
+					return false;
+				}
+				worker.ready = true;
+				printf("Worker %d connected, %d threads\n", worker.id, worker.threads);
+			} else if (type == DIST_MSG_RESULT && worker.ready) {
+				if (available < DIST_RESULT_WORDS * sizeof(uint32_t)) {
+					break;
+				}
+				uint32_t tileId = inputWord(worker, offset + 4);
+				bool held = false;
+				for (const DistAssignment &assignment: worker.outstanding) {
+					held |= assignment.tile == (int)tileId;
+				}
+				if (!held) {
+					return false;
+				}
+				size_t size = (DIST_RESULT_WORDS + tiles[tileId].width * tiles[tileId].height) * sizeof(uint32_t);
+				if (available < size) {
+					break;
+				}
+				result(worker, tileId, inputWord(worker, offset + 8), worker.input.data() + offset + (DIST_RESULT_WORDS * sizeof(uint32_t)), now);
+				offset += size;
+			} else {
+				return false;
+			}
+		}
+		worker.input.erase(worker.input.begin(), worker.input.begin() + offset);
+		return true;
+	}
+	void receive(DistWorker &worker, Distributed::Clock::time_point now) {
+		uint8_t buffer[DIST_RECV_BUFFER];
+		ssize_t received = recv(worker.fd, buffer, sizeof(buffer), 0);
+		if (received <= 0) {
+			drop(worker, "disconnected");
+			return;
+		}
+		worker.bytesIn += received;
+		worker.input.insert(worker.input.end(), buffer, buffer + received);
+		if (!parse(worker, now)) {
+			drop(worker, "protocol error");
+		}
+	}
+	void checkTimeouts(Distributed::Clock::time_point now) {
+		for (DistWorker &worker: workers) {
+			if (worker.alive && !worker.outstanding.empty() &&
+				Distributed::micros(std::max(worker.outstanding.front().sent, worker.lastResult), now) > DIST_TILE_TIMEOUT_MS * 1000L) {
+				drop(worker, "timed out");
+			}
+		}
+	}
+public:
+	int width, height, port;
+	std::vector<Vec3> views;
+	// scene fingerprint every worker must match
+	uint32_t fingerprint;
+	// one RGBX8888 image per view
+	std::vector<std::vector<uint32_t>> images;
+	std::vector<DistWorker> workers;
+	long requeued, speculated;
+	double seconds;
+
+	TileCoordinator (int width, int height, const std::vector<Vec3> &views, uint32_t fingerprint) : listenFd(-1), remaining(0), completed(0), completedMicros(0),
+		width(width), height(height), port(0), views(views), fingerprint(fingerprint), requeued(0), speculated(0), seconds(0) {
+		for (size_t view = 0; view < views.size(); ++view) {
+			images.push_back(std::vector<uint32_t>(width * height, 0));
+			for (int y = 0; y < height; y += DIST_TILE_SIZE) {
+				for (int x = 0; x < width; x += DIST_TILE_SIZE) {
+					tiles.push_back({(int)view, x, y, std::min(DIST_TILE_SIZE, width - x), std::min(DIST_TILE_SIZE, height - y), false, 0});
+				}
+			}
+		}
+	}
+	~TileCoordinator () {
+		for (DistWorker &worker: workers) {
+			if (worker.alive) {
+				close(worker.fd);
+			}
+		}
+		if (listenFd >= 0) {
+			close(listenFd);
+		}
+	}
+	// port 0 picks a free port, stored in port
+	bool listen(int listenPort) {
+		port = listenPort;
+		listenFd = Distributed::listenOn(port);
+		return listenFd >= 0;
+	}
+	// renders every view, workers may connect at any point, returns false if the workers were all gone too long
+	bool render() {
+		Distributed::Clock::time_point start = Distributed::Clock::now(), lastWorker = start;
+		pending.clear();
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			pending.push_back(i);
+		}
+		remaining = tiles.size();
+
+		std::vector<pollfd> fds;
+		std::vector<int> fdWorkers;
+		while (remaining > 0) {
+			Distributed::Clock::time_point now = Distributed::Clock::now();
+			fds.clear();
+			fdWorkers.clear();
+			fds.push_back({listenFd, POLLIN, 0});
+			fdWorkers.push_back(-1);
+			for (DistWorker &worker: workers) {
+				if (worker.alive) {
+					fds.push_back({worker.fd, POLLIN, 0});
+					fdWorkers.push_back(worker.id);
+					lastWorker = now;
+				}
+			}
+			if (Distributed::micros(lastWorker, now) > DIST_IDLE_TIMEOUT_MS * 1000L) {
+				printf("No workers for %ds, giving up with %d tiles left\n", DIST_IDLE_TIMEOUT_MS / 1000, remaining);
+				return false;
+			}
+
+			poll(fds.data(), fds.size(), DIST_POLL_MS);
+			now = Distributed::Clock::now();
+			for (size_t i = 0; i < fds.size(); ++i) {
+				if (fds[i].revents == 0) {
+					continue;
+				}
+				if (fdWorkers[i] < 0) {
+					accept();
+				} else {
+					receive(workers[fdWorkers[i]], now);
+				}
+			}
+			checkTimeouts(now);
+			for (DistWorker &worker: workers) {
+				schedule(worker, now);
+			}
+		}
+
+		for (DistWorker &worker: workers) {
+			if (worker.alive) {
+				uint32_t done = DIST_MSG_DONE;
+				Distributed::sendWords(worker.fd, &done, 1);
+				worker.bytesOut += sizeof(done);
+				close(worker.fd);
+				worker.alive = false;
+				worker.disconnected = Distributed::Clock::now();
+			}
+		}
+		seconds = Distributed::micros(start, Distributed::Clock::now()) / 1000000.0;
+		return true;
+	}
+	/* per worker throughput and network cost
+	overhead is the time a tile spent outside the worker's renderer: transfer, queueing and scheduling */
+	void printStats() const {
+		long pixels = 0, bytesIn = 0, bytesOut = 0, duplicates = 0;
+		printf("%-7s %7s %7s %5s %11s %11s %10s %10s %12s\n", "worker", "threads", "tiles", "dupes", "Mpix/s busy", "Mpix/s wall", "KB in", "KB out", "overhead/tile");
+		for (const DistWorker &worker: workers) {
+			if (!worker.ready) {
+				continue;
+			}
+			long renderedPixels = worker.pixels;
+			double wall = Distributed::micros(worker.connected, worker.alive ? Distributed::Clock::now() : worker.disconnected) / 1000000.0;
+			long results = worker.tiles + worker.duplicates;
+			printf("%-7d %7d %7ld %5ld %11.2f %11.2f %10.1f %10.1f %10.2fms%s\n", worker.id, worker.threads, worker.tiles, worker.duplicates,
+				worker.renderMicros > 0 ? renderedPixels / (double)worker.renderMicros : 0, wall > 0 ? renderedPixels / wall / 1000000.0 : 0,
+				worker.bytesIn / 1000.0, worker.bytesOut / 1000.0,
+				results > 0 ? std::max(worker.serviceMicros - worker.renderMicros, 0L) / (double)results / 1000.0 : 0,
+				worker.lost > 0 ? " (dropped)" : "");
+			pixels += worker.pixels;
+			bytesIn += worker.bytesIn;
+			bytesOut += worker.bytesOut;
+			duplicates += worker.duplicates;
+		}
+		long payload = pixels * sizeof(uint32_t);
+		printf("%ld views, %ld tiles in %.3fs, %.2f Mpix/s\n", (long)views.size(), (long)tiles.size(), seconds, seconds > 0 ? pixels / seconds / 1000000.0 : 0);
+		printf("\tnetwork: %.1f KB in, %.1f KB out, %.1f%% beyond pixel payload\n", bytesIn / 1000.0, bytesOut / 1000.0,
+			payload > 0 ? (bytesIn + bytesOut - payload) * 100.0 / payload : 0);
+		printf("\t%ld tiles requeued from dropped workers, %ld duplicated to idle workers, %ld duplicate results discarded\n", requeued, speculated, duplicates);
+	}
+};
+
+// Renders tiles for a coordinator until told to stop
+class TileWorker {
+private:
+	DemoScene &demo;
+	int fd;
+	std::vector<uint32_t> message;
+public:
+	// testing aids: extra time per tile, and disconnecting without replying after this many tiles(-1 for never)
+	int delayMs, dieAfter;
+	long tiles;
+
+	TileWorker (DemoScene &demo, int delayMs = 0, int dieAfter = -1) : demo(demo), fd(-1), delayMs(delayMs), dieAfter(dieAfter), tiles(0) {}
+	~TileWorker () {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+	// returns true once the coordinator says it's done, false if the connection failed or the worker died on purpose
+	bool run(const char *host, int port) {
+		fd = Distributed::connectTo(host, port);
+		if (fd < 0) {
+			return false;
+		}
+		uint32_t hello[DIST_HELLO_WORDS] = {DIST_MSG_HELLO, DIST_PROTOCOL_VERSION, demo.fingerprint(), (uint32_t)omp_get_max_threads()};
+		if (!Distributed::sendWords(fd, hello, DIST_HELLO_WORDS)) {
+			return false;
+		}
+
+		uint32_t tile[DIST_TILE_WORDS];
+		while (Distributed::readWords(fd, tile, 1)) {
+			if (tile[0] != DIST_MSG_TILE) {
+				return tile[0] == DIST_MSG_DONE;
+			}
+			if (!Distributed::readWords(fd, tile + 1, DIST_TILE_WORDS - 1)) {
+				return false;
+			}
+			if (tiles == dieAfter) {
+				return false;
+			}
+			ProfileZone tileZone("Tile", tile[1]);
+			Distributed::Clock::time_point start = Distributed::Clock::now();
+			Camera &camera = demo.camera;
+			camera.pos = Vec3(Distributed::bitsFloat(tile[3]), Distributed::bitsFloat(tile[4]), Distributed::bitsFloat(tile[5]));
+			camera.width = tile[6];
+			camera.height = tile[7];
+			demo.followCamera();
+			camera.binInstances();
+			int tileX = tile[8], tileY = tile[9], tileWidth = tile[10], tileHeight = tile[11];
+
+			message.resize(DIST_RESULT_WORDS + (tileWidth * tileHeight));
+			uint32_t *pixels = message.data() + DIST_RESULT_WORDS;
+			#pragma omp parallel for schedule(dynamic)
+			for (int y = 0; y < tileHeight; ++y) {
+				PROFILE_ZONE_ARG("Trace row", tileY + y);
+				for (int x = 0; x < tileWidth; ++x) {
+					pixels[ARRAY_INDEX(x, y, tileWidth)] = camera.renderPixel(tileX + x, tileY + y);
+				}
+			}
+			tileZone.end();
+			// tiles are the worker's frames, no thread is using the caches between them
+			ModelRayCache::endFrame();
+			PagedGeometry::endFrame();
+			Profiler::endFrame();
+			if (delayMs > 0) {
+				usleep(delayMs * 1000);
+			}
+			message[0] = DIST_MSG_RESULT;
+			message[1] = tile[1];
+			message[2] = Distributed::micros(start, Distributed::Clock::now());
+			if (!Distributed::sendWords(fd, message.data(), message.size())) {
+				return false;
+			}
+			++tiles;
+		}
+		return false;
+	}
+};
+
+#endif
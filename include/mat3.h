@@ -0,0 +1,79 @@
+#ifndef MAT3
+#define MAT3
+
+#include <cmath>
+
+#include "common.h"
+#include "vec3.h"
+
+// 3x3 matrix(rotation, scale, shear), row major
+class Mat3 {
+public:
+	Vec3 rows[3];
+	Mat3 () {}
+	Mat3 (const Vec3 &x, const Vec3 &y, const Vec3 &z) {
+		rows[AXIS_X] = x;
+		rows[AXIS_Y] = y;
+		rows[AXIS_Z] = z;
+	}
+	static inline Mat3 identity() {
+		return Mat3(Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(0, 0, 1));
+	}
+	static inline Mat3 scale(const Vec3 &factors) {
+		return Mat3(Vec3(factors.axis[AXIS_X], 0, 0), Vec3(0, factors.axis[AXIS_Y], 0), Vec3(0, 0, factors.axis[AXIS_Z]));
+	}
+	// right handed rotation by radians about one of the axes
+	static inline Mat3 rotation(int axis, float radians) {
+		float c = std::cos(radians), s = std::sin(radians);
+		if (axis == AXIS_X) {
+			return Mat3(Vec3(1, 0, 0), Vec3(0, c, -s), Vec3(0, s, c));
+		} else if (axis == AXIS_Y) {
+			return Mat3(Vec3(c, 0, s), Vec3(0, 1, 0), Vec3(-s, 0, c));
+		}
+		return Mat3(Vec3(c, -s, 0), Vec3(s, c, 0), Vec3(0, 0, 1));
+	}
+	static inline Vec3 transform(const Mat3 &m, const Vec3 &v) {
+		return Vec3(Vec3::dot(m.rows[AXIS_X], v), Vec3::dot(m.rows[AXIS_Y], v), Vec3::dot(m.rows[AXIS_Z], v));
+	}
+	// transform by the transpose, ie: normals through the inverse of a matrix
+	static inline Vec3 transformTransposed(const Mat3 &m, const Vec3 &v) {
+		return Vec3::add(Vec3::add(Vec3::scale(m.rows[AXIS_X], v.axis[AXIS_X]), Vec3::scale(m.rows[AXIS_Y], v.axis[AXIS_Y])), Vec3::scale(m.rows[AXIS_Z], v.axis[AXIS_Z]));
+	}
+	static inline Mat3 transpose(const Mat3 &m) {
+		return Mat3(Vec3(m.rows[AXIS_X].axis[AXIS_X], m.rows[AXIS_Y].axis[AXIS_X], m.rows[AXIS_Z].axis[AXIS_X]),
+			Vec3(m.rows[AXIS_X].axis[AXIS_Y], m.rows[AXIS_Y].axis[AXIS_Y], m.rows[AXIS_Z].axis[AXIS_Y]),
+			Vec3(m.rows[AXIS_X].axis[AXIS_Z], m.rows[AXIS_Y].axis[AXIS_Z], m.rows[AXIS_Z].axis[AXIS_Z]));
+	}
+	// a applied after b
+	static inline Mat3 mul(const Mat3 &a, const Mat3 &b) {
+		Mat3 columns = transpose(b);
+		return Mat3(transform(columns, a.rows[AXIS_X]), transform(columns, a.rows[AXIS_Y]), transform(columns, a.rows[AXIS_Z]));
+	}
+	static inline float determinant(const Mat3 &m) {
+		return Vec3::dot(m.rows[AXIS_X], Vec3::cross(m.rows[AXIS_Y], m.rows[AXIS_Z]));
+	}
+	// the matrix must not be singular(determinant 0)
+	static inline Mat3 inverse(const Mat3 &m) {
+		// columns of the inverse are the cross products of the rows, over the determinant
+		float inverseDeterminant = 1 / determinant(m);
+		Mat3 adjugate(Vec3::cross(m.rows[AXIS_Y], m.rows[AXIS_Z]), Vec3::cross(m.rows[AXIS_Z], m.rows[AXIS_X]), Vec3::cross(m.rows[AXIS_X], m.rows[AXIS_Y]));
+		Mat3 result = transpose(adjugate);
+		for (int row = 0; row < 3; ++row) {
+			Vec3::m_scale(result.rows[row], inverseDeterminant);
+		}
+		return result;
+	}
+	static inline bool isIdentity(const Mat3 &m) {
+		Mat3 i = identity();
+		for (int row = 0; row < 3; ++row) {
+			for (int column = 0; column < 3; ++column) {
+				if (m.rows[row].axis[column] != i.rows[row].axis[column]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+};
+
+#endif
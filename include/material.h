@@ -0,0 +1,79 @@
+#ifndef MATERIAL
+#define MATERIAL
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+
+#include <string.h>
+
+#include "common.h"
+#include "vec3.h"
+#include "texture.h"
+
+// surface of tris with no material, matches the old hard coded white
+#define MATERIAL_DEFAULT_DIFFUSE Vec3(1, 1, 1)
+
+// Surface properties from a .mtl file
+class Material {
+public:
+	std::string name;
+	// Kd and Ks
+	Vec3 diffuse, specular;
+	// Ns
+	float shininess;
+	// index into the model's textures, -1 if untextured
+	int texture;
+	Material () : diffuse(MATERIAL_DEFAULT_DIFFUSE), specular(Vec3(0, 0, 0)), shininess(0), texture(-1) {}
+};
+
+namespace MTL {
+	#define MTL_LOAD_LINE_BUFFER 512
+
+	// directory of a path including the trailing separator, empty if there is none
+	static inline std::string directory(const std::string &path) {
+		size_t separator = path.find_last_of('/');
+		return separator == std::string::npos ? "" : path.substr(0, separator + 1);
+	}
+	/* appends every material in the file, map_Kd images are loaded into textures(binary PPM only)
+	paths in the file are relative to it */
+	static bool load(const std::string &filename, std::vector<Material> &materials, std::vector<Texture *> &textures) {
+		std::ifstream file(filename);
+		if (!file) {
+			printf("Could not open material library \"%s\"\n", filename.c_str());
+			return false;
+		}
+		char lineBuffer[MTL_LOAD_LINE_BUFFER];
+		char path[MTL_LOAD_LINE_BUFFER];
+		Material *material = nullptr;
+		while (file) {
+			file.getline(lineBuffer, MTL_LOAD_LINE_BUFFER);
+			// leading whitespace is allowed
+			const char *line = lineBuffer + strspn(lineBuffer, " \t");
+			float x, y, z;
+			if (sscanf(line, "newmtl %511s", path) == 1) {
+				materials.push_back(Material());
+				material = &materials.back();
+				material->name = path;
+			} else if (!material) {
+				continue;
+			} else if (sscanf(line, "Kd %f %f %f", &x, &y, &z) == 3) {
+				material->diffuse = Vec3(x, y, z);
+			} else if (sscanf(line, "Ks %f %f %f", &x, &y, &z) == 3) {
+				material->specular = Vec3(x, y, z);
+			} else if (sscanf(line, "Ns %f", &x) == 1) {
+				material->shininess = x;
+			} else if (sscanf(line, "map_Kd %511s", path) == 1) {
+				Texture *texture = Texture::loadPPM(directory(filename) + path);
+				if (texture) {
+					material->texture = textures.size();
+					textures.push_back(texture);
+				}
+			}
+		}
+		return true;
+	}
+}
+
+#endif
@@ -7,6 +7,10 @@
 #include <fstream>
 #include <limits>
 #include <cmath>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
 
 #include <string.h>
 
@@ -17,95 +21,307 @@
 #include "vert.h"
 #include "tri.h"
 #include "octree.h"
+#include "packet.h"
+#include "profiler.h"
+#include "material.h"
+#include "texture.h"
+#include "mat3.h"
+#include "paging.h"
+
+// Ray cache
+// side in cache cells of the tiles each face is allocated in
+#define CACHE_TILE_SIZE 16
+#define CACHE_TILE_ENTRIES (CACHE_TILE_SIZE * CACHE_TILE_SIZE)
+// bits per axis of the quantized ray direction stored with each entry, rays whose directions quantize the same share entries
+#define CACHE_DIR_BITS 10
+#define CACHE_DIR_STEPS (1 << CACHE_DIR_BITS)
+// memory all caches together may use, tiles past it aren't allocated until others are evicted
+#define CACHE_BUDGET_MB 64
+// eviction starts when the caches pass the high fraction of the budget and frees least recently used tiles down to the low one
+#define CACHE_EVICT_HIGH 0.9
+#define CACHE_EVICT_LOW 0.75
+#define CACHE_MARGIN Vec3(1,1,1)
+
+// Dynamic meshes
+// a dynamic model's bounds are its mesh's padded by this fraction of its size, so the ray cache keeps its grid while the mesh moves inside them
+#define DYNAMIC_MARGIN 0.25
+// a background rebuild starts once refits have made the octree this many times costlier to traverse than when it was built
+#define DYNAMIC_REBUILD_COST 1.5
+// tris that moved are gathered into this many regions per axis of the model's bounds to invalidate the ray cache with
+#define DYNAMIC_DIRTY_GRID 4
 
 class CacheEntry {
 public:
-	Vec3 dir;
 	const Tri *tri;
-	bool valid;
-	CacheEntry () : valid(false) {}
+	// quantized direction of the ray that set the entry, 0 if unset
+	uint32_t key;
+	CacheEntry () : tri(nullptr), key(0) {}
+};
+
+class CacheTile {
+public:
+	// frame the tile was last read or written on, see ModelRayCache::endFrame
+	std::atomic<uint32_t> lastUsed;
+	// a bit per entry that may be set, so walking a sparsely filled tile doesn't read every entry
+	std::atomic<uint64_t> used[CACHE_TILE_ENTRIES / 64];
+	CacheEntry entries[CACHE_TILE_ENTRIES];
+	CacheTile (uint32_t frame) : lastUsed(frame) {
+		for (std::atomic<uint64_t> &bits: used) {
+			bits = 0;
+		}
+	}
 };
 
+/* Per model cache of the tri a ray entering the bounding box through a given point hits, one grid per bbox face
+grids are split into tiles allocated on first write, so only the parts of the model rays actually reach cost memory
+all caches share one memory budget, endFrame evicts the tiles that have gone unused longest */
 class ModelRayCache {
+private:
+	// bytes of tiles and tile tables held by every cache
+	static inline std::atomic<long> memoryUsed{0};
+	static inline long memoryBudget = (long)CACHE_BUDGET_MB * SIZE_MB;
+	static inline std::atomic<uint32_t> frame{1};
+	static inline std::vector<ModelRayCache *> caches;
+	static inline std::mutex cachesMutex;
+
+	// the two axes spanning each face, and the size of its grid in cells and tiles
+	int faceAxes[FACE_NONE][2];
+	int faceCells[FACE_NONE][2];
+	int faceTilesAcross[FACE_NONE];
+	int faceTileCount[FACE_NONE];
+	std::atomic<CacheTile *> *tiles[FACE_NONE];
+	/* range of each face axis' slope against the inward depth over the directions set on the face, so invalidate can
+	project a region back onto the cells whose rays reach it, a face that was given a direction not heading inward is wide open */
+	std::atomic<float> slopeMin[FACE_NONE][2], slopeMax[FACE_NONE][2];
+	std::atomic<bool> wideFace[FACE_NONE];
+
+	// tiles are published with a compare and swap so threads touching a new tile at once agree on one
+	CacheTile *allocateTile(int face, int tileIndex) {
+		if (memoryUsed.fetch_add(sizeof(CacheTile)) + (long)sizeof(CacheTile) > memoryBudget) {
+			memoryUsed.fetch_sub(sizeof(CacheTile));
+			refused.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		CacheTile *tile = new CacheTile(frame.load(std::memory_order_relaxed));
+		CacheTile *expected = nullptr;
+		if (!tiles[face][tileIndex].compare_exchange_strong(expected, tile)) {
+			delete tile;
+			memoryUsed.fetch_sub(sizeof(CacheTile));
+			return expected;
+		}
+		tilesAllocated.fetch_add(1, std::memory_order_relaxed);
+		return tile;
+	}
+	// only written when it widens, which stops happening once the face has seen its spread of directions
+	void widenSlopes(int face, uint32_t key) {
+		int axis = face / 2;
+		Vec3 dir = keyDirection(key);
+		float inward = face % 2 ? -dir.axis[axis] : dir.axis[axis];
+		if (inward <= 0) {
+			wideFace[face].store(true, std::memory_order_relaxed);
+			return;
+		}
+		for (int m = 0; m < 2; ++m) {
+			float slope = dir.axis[faceAxes[face][m]] / inward;
+			float bound = slopeMin[face][m].load(std::memory_order_relaxed);
+			while (slope < bound && !slopeMin[face][m].compare_exchange_weak(bound, slope, std::memory_order_relaxed)) {}
+			bound = slopeMax[face][m].load(std::memory_order_relaxed);
+			while (slope > bound && !slopeMax[face][m].compare_exchange_weak(bound, slope, std::memory_order_relaxed)) {}
+		}
+	}
+	// tree over the regions invalidate tests rays against, a node has two children or is a region
+	struct RegionNode {
+		BBox bbox;
+		int children[2];
+		int region;
+	};
+	// builds the tree over order[begin, end) in place, split at the median of the longest axis, returns the node's index
+	static int buildRegions(const std::vector<BBox> &boxes, std::vector<int> &order, size_t begin, size_t end, std::vector<RegionNode> &nodes) {
+		BBox bbox = boxes[order[begin]];
+		for (size_t i = begin + 1; i < end; ++i) {
+			bbox += boxes[order[i]];
+		}
+		int node = nodes.size();
+		nodes.push_back({bbox, {-1, -1}, end - begin == 1 ? order[begin] : -1});
+		if (end - begin == 1) {
+			return node;
+		}
+		int axis = AXIS_X;
+		for (int a = AXIS_Y; a < AXIS_NUM; ++a) {
+			if (bbox.max.axis[a] - bbox.min.axis[a] > bbox.max.axis[axis] - bbox.min.axis[axis]) {
+				axis = a;
+			}
+		}
+		size_t middle = begin + ((end - begin) / 2);
+		std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&boxes, axis](int a, int b) {
+			return boxes[a].min.axis[axis] + boxes[a].max.axis[axis] < boxes[b].min.axis[axis] + boxes[b].max.axis[axis];
+		});
+		int left = buildRegions(boxes, order, begin, middle, nodes);
+		int right = buildRegions(boxes, order, middle, end, nodes);
+		nodes[node].children[0] = left;
+		nodes[node].children[1] = right;
+		return node;
+	}
+	// whether the ray's line passes through any region, the tree is at most 32 levels for any count of regions
+	static bool hitsRegion(const std::vector<RegionNode> &nodes, const Ray &ray) {
+		int stack[64];
+		int pending = 0;
+		stack[pending++] = 0;
+		while (pending > 0) {
+			const RegionNode &node = nodes[stack[--pending]];
+			if (node.bbox.rayCast(ray) == RAY_MISS) {
+				continue;
+			}
+			if (node.region >= 0) {
+				return true;
+			}
+			stack[pending++] = node.children[0];
+			stack[pending++] = node.children[1];
+		}
+		return false;
+	}
+	void freeTiles() {
+		for (int face = 0; face < FACE_NONE; ++face) {
+			for (int i = 0; i < faceTileCount[face]; ++i) {
+				CacheTile *tile = tiles[face][i].load();
+				if (tile) {
+					delete tile;
+					memoryUsed.fetch_sub(sizeof(CacheTile));
+				}
+			}
+			delete[] tiles[face];
+			memoryUsed.fetch_sub(faceTileCount[face] * sizeof(*tiles[face]));
+		}
+		tilesAllocated = 0;
+	}
+	static inline uint32_t directionKey(const Vec3 &dir) {
+		uint32_t key = 1;
+		for (int axis = 0; axis < AXIS_NUM; ++axis) {
+			// directions are normalized, map [-1, 1] onto the steps
+			int step = (int)((dir.axis[axis] + 1) * (CACHE_DIR_STEPS / 2));
+			key = (key << CACHE_DIR_BITS) | CLAMP(0, step, CACHE_DIR_STEPS - 1);
+		}
+		return key;
+	}
+	// the center of the direction steps a key was made from
+	static inline Vec3 keyDirection(uint32_t key) {
+		Vec3 dir;
+		for (int axis = AXIS_NUM - 1; axis >= 0; --axis) {
+			dir.axis[axis] = (((key & (CACHE_DIR_STEPS - 1)) + 0.5f) / (CACHE_DIR_STEPS / 2)) - 1;
+			key >>= CACHE_DIR_BITS;
+		}
+		return Vec3::normalize(dir);
+	}
+	// rays that didn't come through a face are cached on the top one
+	static inline int cacheFace(int face) {
+		return (face < 0 || face >= FACE_NONE) ? FACE_Z_PLUS : face;
+	}
+	// the entry for the cell the ray enters the bbox through, nullptr if its tile isn't allocated(and can't be if create)
+	CacheEntry *index(const Ray &ray, int face, float bboxDist, bool create) {
+		face = cacheFace(face);
+		int axis1 = faceAxes[face][0], axis2 = faceAxes[face][1];
+		int u = (int)std::fma(ray.dir.axis[axis1], bboxDist, ray.origin.axis[axis1] - offset.axis[axis1]);
+		int v = (int)std::fma(ray.dir.axis[axis2], bboxDist, ray.origin.axis[axis2] - offset.axis[axis2]);
+		u = CLAMP(0, u, faceCells[face][0] - 1);
+		v = CLAMP(0, v, faceCells[face][1] - 1);
+
+		int tileIndex = ((v / CACHE_TILE_SIZE) * faceTilesAcross[face]) + (u / CACHE_TILE_SIZE);
+		CacheTile *tile = tiles[face][tileIndex].load(std::memory_order_acquire);
+		if (!tile) {
+			if (!create) {
+				return nullptr;
+			}
+			tile = allocateTile(face, tileIndex);
+			if (!tile) {
+				return nullptr;
+			}
+		}
+		// only written when it changes so threads reading the same tile don't fight over its cache line
+		uint32_t now = frame.load(std::memory_order_relaxed);
+		if (tile->lastUsed.load(std::memory_order_relaxed) != now) {
+			tile->lastUsed.store(now, std::memory_order_relaxed);
+		}
+		int entry = ((v % CACHE_TILE_SIZE) * CACHE_TILE_SIZE) + (u % CACHE_TILE_SIZE);
+		// entries handed out to be written are about to be set
+		uint64_t bit = (uint64_t)1 << (entry % 64);
+		if (create && !(tile->used[entry / 64].load(std::memory_order_relaxed) & bit)) {
+			tile->used[entry / 64].fetch_or(bit, std::memory_order_relaxed);
+		}
+		return &tile->entries[entry];
+	}
 public:
 	Vec3i dim;
 	Vec3 offset;
-	CacheEntry *x_minus, *x_plus, *y_minus, *y_plus, *z_minus, *z_plus;
 	bool allocated;
+	// tiles held by this cache, and tiles every cache was refused for being over budget
+	std::atomic<long> tilesAllocated;
+	static inline std::atomic<long> refused{0};
+	static inline long evicted = 0;
+
+	// the model bounds rays were cached entering
+	BBox bounds;
 
-	ModelRayCache () : allocated(false) {}
-	#define CACHE_MARGIN Vec3(1,1,1)
+	ModelRayCache () : allocated(false), tilesAllocated(0) {}
+	ModelRayCache (const ModelRayCache &) = delete;
+	ModelRayCache &operator= (const ModelRayCache &) = delete;
+	~ModelRayCache () {
+		release();
+	}
+	// frees every tile and the tables, allocate may be called again after
+	void release() {
+		if (allocated) {
+			std::lock_guard<std::mutex> lock(cachesMutex);
+			caches.erase(std::find(caches.begin(), caches.end(), this));
+			freeTiles();
+			allocated = false;
+		}
+	}
+	// sets up the empty tile tables, tiles themselves are allocated as rays are cached
 	void allocate(const Vec3 &size, const Vec3 &_offset) {
 		dim = Vec3i(Vec3::add(size, Vec3::scale(CACHE_MARGIN, 2)));
 		offset = Vec3::sub(_offset, CACHE_MARGIN);
+		bounds = BBox(_offset, Vec3::add(_offset, size));
 
-		// it may seem funny to allocate a cache for the bottom of an object in a top-down engine
+		// it may seem funny to have a cache for the bottom of an object in a top-down engine
 		// but remember that this is the bottom of the object, not any particular instance of it
 		// if an instance was rotated sideways or upside down, rays would impact it there
-		x_minus = new CacheEntry[dim.axis[AXIS_Y] * dim.axis[AXIS_Z]];
-		x_plus = new CacheEntry[dim.axis[AXIS_Y] * dim.axis[AXIS_Z]];
-		y_minus = new CacheEntry[dim.axis[AXIS_X] * dim.axis[AXIS_Z]];
-		y_plus = new CacheEntry[dim.axis[AXIS_X] * dim.axis[AXIS_Z]];
-		z_minus = new CacheEntry[dim.axis[AXIS_X] * dim.axis[AXIS_Y]];
-		z_plus = new CacheEntry[dim.axis[AXIS_X] * dim.axis[AXIS_Y]];
+		long tableBytes = 0;
+		for (int face = 0; face < FACE_NONE; ++face) {
+			int axis = face / 2;
+			faceAxes[face][0] = axis == AXIS_X ? AXIS_Y : AXIS_X;
+			faceAxes[face][1] = axis == AXIS_Z ? AXIS_Y : AXIS_Z;
+			faceCells[face][0] = std::max(dim.axis[faceAxes[face][0]], 1);
+			faceCells[face][1] = std::max(dim.axis[faceAxes[face][1]], 1);
+			faceTilesAcross[face] = (faceCells[face][0] + CACHE_TILE_SIZE - 1) / CACHE_TILE_SIZE;
+			faceTileCount[face] = faceTilesAcross[face] * ((faceCells[face][1] + CACHE_TILE_SIZE - 1) / CACHE_TILE_SIZE);
+			tiles[face] = new std::atomic<CacheTile *>[faceTileCount[face]];
+			for (int i = 0; i < faceTileCount[face]; ++i) {
+				tiles[face][i] = nullptr;
+			}
+			for (int m = 0; m < 2; ++m) {
+				slopeMin[face][m] = RAY_MISS;
+				slopeMax[face][m] = -RAY_MISS;
+			}
+			wideFace[face] = false;
+			tableBytes += faceTileCount[face] * sizeof(*tiles[face]);
+		}
+		memoryUsed += tableBytes;
+		{
+			std::lock_guard<std::mutex> lock(cachesMutex);
+			caches.push_back(this);
+		}
 
-		float allocMB = (((2 * dim.axis[AXIS_Y] * dim.axis[AXIS_Z]) + (2 * dim.axis[AXIS_X] * dim.axis[AXIS_Z]) + (2 * dim.axis[AXIS_X] * dim.axis[AXIS_Y])) * sizeof(*z_plus)) / SIZE_MB;
-		printf("allocated cache of dim (%d, %d, %d) - %.2f MB\n", dim.axis[AXIS_X], dim.axis[AXIS_Y], dim.axis[AXIS_Z], allocMB);
+		float denseMB = (((2 * dim.axis[AXIS_Y] * dim.axis[AXIS_Z]) + (2 * dim.axis[AXIS_X] * dim.axis[AXIS_Z]) + (2 * dim.axis[AXIS_X] * dim.axis[AXIS_Y])) * sizeof(CacheEntry)) / (float)SIZE_MB;
+		printf("allocated cache of dim (%d, %d, %d) - %.2f MB of tables, up to %.2f MB of tiles\n", dim.axis[AXIS_X], dim.axis[AXIS_Y], dim.axis[AXIS_Z], tableBytes / (float)SIZE_MB, denseMB);
 
 		allocated = true;
 	}
-	CacheEntry &index(const Ray &ray, int face, float bboxDist) {
-		int axis1, axis2;
-		CacheEntry *faceArray;
+	float lookup(Ray &ray, int face, float bboxDist) {
+		CacheEntry *cacheHit = index(ray, face, bboxDist, false);
 
-		switch(face) {
-			case FACE_X_MIN:
-				faceArray = x_minus;
-				axis1 = AXIS_Y;
-				axis2 = AXIS_Z;
-				break;
-			case FACE_X_PLUS:
-				faceArray = x_plus;
-				axis1 = AXIS_Y;
-				axis2 = AXIS_Z;
-				break;
-			case FACE_Y_MIN:
-				faceArray = y_minus;
-				axis1 = AXIS_X;
-				axis2 = AXIS_Z;
-				break;
-			case FACE_Y_PLUS:
-				faceArray = y_plus;
-				axis1 = AXIS_X;
-				axis2 = AXIS_Z;
-				break;
-			case FACE_Z_MIN:
-				faceArray = z_minus;
-				axis1 = AXIS_X;
-				axis2 = AXIS_Y;
-				break;
-			case FACE_Z_PLUS:
-			default:
-				faceArray = z_plus;
-				axis1 = AXIS_X;
-				axis2 = AXIS_Y;
-				break;
-		}
-		
-		int u = (int)std::fma(ray.dir.axis[axis1], bboxDist, ray.origin.axis[axis1] - offset.axis[axis1]);
-		int v = (int)std::fma(ray.dir.axis[axis2], bboxDist, ray.origin.axis[axis2] - offset.axis[axis2]);
-		int width = dim.axis[axis1];
-		int height = dim.axis[axis2];
-
-		return faceArray[ARRAY_INDEX(CLAMP(0, u, width - 1), CLAMP(0, v, height - 1), width)];
-	}
-	float lookup(Ray &ray, int face, float bboxDist, float precision) {
-		float returned = RAY_INVALID;
-		CacheEntry &cacheHit = index(ray, face, bboxDist);
-
-		if (cacheHit.valid && Vec3::eq(ray.dir, cacheHit.dir, precision)) {
-			if (cacheHit.tri != nullptr) {
-				float depth = cacheHit.tri->rayCast(ray);
+		if (cacheHit && cacheHit->key == directionKey(ray.dir)) {
+			if (cacheHit->tri != nullptr) {
+				float depth = cacheHit->tri->rayCast(ray);
 				if (depth != RAY_MISS) {
 					return depth;
 				} else {
@@ -115,26 +331,316 @@ public:
 				return RAY_MISS;
 			}
 		}
-		return returned;
+		return RAY_INVALID;
 	}
 	void set(const Ray &ray, int face, float bboxDist, bool setMiss = false) {
-		CacheEntry &cacheHit = index(ray, face, bboxDist);
+		CacheEntry *cacheHit = index(ray, face, bboxDist, true);
+		if (!cacheHit) {
+			return;
+		}
 
-		cacheHit.dir = ray.dir;
-		cacheHit.valid = true;
+		uint32_t key = directionKey(ray.dir);
+		if (cacheHit->key != key) {
+			widenSlopes(cacheFace(face), key);
+		}
+		cacheHit->key = key;
 		if (!setMiss) {
-			cacheHit.tri = ray.tri;
+			cacheHit->tri = ray.tri;
 		} else {
-			cacheHit.tri = nullptr;
+			cacheHit->tri = nullptr;
+		}
+	}
+	/* clears the entries of rays passing through any of the regions, no thread may be reading or writing the cache during the call
+	an entry only keeps its cell and quantized direction, so its ray is widened by a cell and the direction's rounding across the cache
+	each region is projected back onto each face along the face's range of directions, only cells under one of them are tested
+	and a cell's ray is tested against a tree over the regions rather than each of them
+	returns the entries cleared */
+	long invalidate(const std::vector<BBox> &regions) {
+		if (!allocated || regions.size() == 0) {
+			return 0;
+		}
+		float margin = 1 + ((Vec3::lengthOf(Vec3::sub(bounds.max, bounds.min)) * 2) / CACHE_DIR_STEPS);
+		std::vector<BBox> widened;
+		std::vector<int> order;
+		for (const BBox &region: regions) {
+			order.push_back(widened.size());
+			widened.push_back(BBox(Vec3::sub(region.min, Vec3(margin, margin, margin)), Vec3::add(region.max, Vec3(margin, margin, margin))));
+		}
+		std::vector<RegionNode> regionTree;
+		buildRegions(widened, order, 0, widened.size(), regionTree);
+		struct CellRect {
+			int min[2], max[2];
+		};
+		std::vector<CellRect> rects;
+		long cleared = 0;
+		for (int face = 0; face < FACE_NONE; ++face) {
+			int axis = face / 2, axis1 = faceAxes[face][0], axis2 = faceAxes[face][1];
+			float plane = face % 2 ? bounds.max.axis[axis] : bounds.min.axis[axis];
+			bool wide = wideFace[face].load(std::memory_order_relaxed);
+			if (!wide && slopeMin[face][0].load(std::memory_order_relaxed) > slopeMax[face][0].load(std::memory_order_relaxed)) {
+				// nothing was ever set on this face
+				continue;
+			}
+
+			// cell range of each region's shadow on the face, and the tiles under any of them
+			rects.clear();
+			CellRect all = {{faceCells[face][0], faceCells[face][1]}, {-1, -1}};
+			for (size_t r = 0; r < widened.size(); ++r) {
+				CellRect rect = {{0, 0}, {faceCells[face][0] - 1, faceCells[face][1] - 1}};
+				if (!wide) {
+					float near = face % 2 ? plane - widened[r].max.axis[axis] : widened[r].min.axis[axis] - plane;
+					float far = face % 2 ? plane - widened[r].min.axis[axis] : widened[r].max.axis[axis] - plane;
+					if (far < 0) {
+						continue;
+					}
+					near = std::max(near, 0.0f);
+					for (int m = 0; m < 2; ++m) {
+						int faceAxis = faceAxes[face][m];
+						float low = slopeMin[face][m].load(std::memory_order_relaxed), high = slopeMax[face][m].load(std::memory_order_relaxed);
+						float shiftMin = std::min(std::min(near * low, far * low), std::min(near * high, far * high));
+						float shiftMax = std::max(std::max(near * low, far * low), std::max(near * high, far * high));
+						// cells' rays start from their middles
+						float first = widened[r].min.axis[faceAxis] - shiftMax - offset.axis[faceAxis] - 0.5f;
+						float last = widened[r].max.axis[faceAxis] - shiftMin - offset.axis[faceAxis] - 0.5f;
+						rect.min[m] = (int)std::floor(std::max(first, 0.0f));
+						rect.max[m] = (int)std::ceil(std::min(last, (float)(faceCells[face][m] - 1)));
+					}
+					if (rect.min[0] > rect.max[0] || rect.min[1] > rect.max[1]) {
+						continue;
+					}
+				}
+				for (int m = 0; m < 2; ++m) {
+					all.min[m] = std::min(all.min[m], rect.min[m]);
+					all.max[m] = std::max(all.max[m], rect.max[m]);
+				}
+				rects.push_back(rect);
+			}
+			if (rects.empty()) {
+				continue;
+			}
+			int tileMinU = all.min[0] / CACHE_TILE_SIZE, tileMinV = all.min[1] / CACHE_TILE_SIZE;
+			int tilesU = (all.max[0] / CACHE_TILE_SIZE) - tileMinU + 1, tileCount = tilesU * ((all.max[1] / CACHE_TILE_SIZE) - tileMinV + 1);
+
+			#pragma omp parallel for schedule(dynamic) reduction(+:cleared)
+			for (int t = 0; t < tileCount; ++t) {
+				int tileU = (tileMinU + (t % tilesU)) * CACHE_TILE_SIZE, tileV = (tileMinV + (t / tilesU)) * CACHE_TILE_SIZE;
+				CacheTile *tile = tiles[face][((tileV / CACHE_TILE_SIZE) * faceTilesAcross[face]) + (tileU / CACHE_TILE_SIZE)].load(std::memory_order_relaxed);
+				if (!tile) {
+					continue;
+				}
+				// neighbouring entries mostly share a direction, it is only decoded again when the key changes
+				Ray ray(offset, Vec3(0, 0, 1));
+				uint32_t rayKey = 0;
+				for (int word = 0; word < CACHE_TILE_ENTRIES / 64; ++word) {
+					uint64_t bits = tile->used[word].load(std::memory_order_relaxed), clearedBits = 0;
+					for (; bits != 0; bits &= bits - 1) {
+						int e = (word * 64) + __builtin_ctzll(bits);
+						CacheEntry &entry = tile->entries[e];
+						int u = tileU + (e % CACHE_TILE_SIZE), v = tileV + (e / CACHE_TILE_SIZE);
+						bool under = false;
+						for (size_t r = 0; r < rects.size() && !under; ++r) {
+							under = u >= rects[r].min[0] && u <= rects[r].max[0] && v >= rects[r].min[1] && v <= rects[r].max[1];
+						}
+						if (!under || entry.key == 0) {
+							continue;
+						}
+						// the ray through the middle of the cell
+						Vec3 origin;
+						origin.axis[axis] = plane;
+						origin.axis[axis1] = offset.axis[axis1] + u + 0.5f;
+						origin.axis[axis2] = offset.axis[axis2] + v + 0.5f;
+						if (entry.key != rayKey) {
+							ray = Ray::unit(origin, keyDirection(entry.key));
+							rayKey = entry.key;
+						} else {
+							ray.origin = origin;
+						}
+						if (hitsRegion(regionTree, ray)) {
+							entry.key = 0;
+							entry.tri = nullptr;
+							clearedBits |= bits & -bits;
+							++cleared;
+						}
+					}
+					tile->used[word].fetch_and(~clearedBits, std::memory_order_relaxed);
+				}
+			}
+		}
+		return cleared;
+	}
+	// entries set in every allocated tile
+	long entries() const {
+		long count = 0;
+		for (int face = 0; face < FACE_NONE && allocated; ++face) {
+			for (int i = 0; i < faceTileCount[face]; ++i) {
+				const CacheTile *tile = tiles[face][i].load(std::memory_order_relaxed);
+				for (int word = 0; tile && word < CACHE_TILE_ENTRIES / 64; ++word) {
+					count += __builtin_popcountll(tile->used[word].load(std::memory_order_relaxed));
+				}
+			}
+		}
+		return count;
+	}
+	inline long memory() const {
+		return (tilesAllocated * sizeof(CacheTile)) + (allocated ? (faceTileCount[0] + faceTileCount[1] + faceTileCount[2] + faceTileCount[3] + faceTileCount[4] + faceTileCount[5]) * sizeof(*tiles[0]) : 0);
+	}
+
+	static inline long totalMemory() {
+		return memoryUsed.load();
+	}
+	static inline long budget() {
+		return memoryBudget;
+	}
+	static void setBudget(long bytes) {
+		memoryBudget = bytes;
+	}
+	/* marks the end of a frame and evicts least recently used tiles once the caches near the budget
+	tiles used this frame are kept, no thread may be reading or writing any cache during the call */
+	static void endFrame() {
+		uint32_t current = frame.fetch_add(1);
+		if (memoryUsed.load() <= memoryBudget * CACHE_EVICT_HIGH) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(cachesMutex);
+		struct Candidate {
+			uint32_t lastUsed;
+			ModelRayCache *cache;
+			int face, tile;
+		};
+		std::vector<Candidate> candidates;
+		for (ModelRayCache *cache: caches) {
+			for (int face = 0; face < FACE_NONE; ++face) {
+				for (int i = 0; i < cache->faceTileCount[face]; ++i) {
+					CacheTile *tile = cache->tiles[face][i].load(std::memory_order_relaxed);
+					if (tile && tile->lastUsed.load(std::memory_order_relaxed) != current) {
+						candidates.push_back({tile->lastUsed.load(std::memory_order_relaxed), cache, face, i});
+					}
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+			return a.lastUsed < b.lastUsed;
+		});
+		for (const Candidate &candidate: candidates) {
+			if (memoryUsed.load() <= memoryBudget * CACHE_EVICT_LOW) {
+				break;
+			}
+			delete candidate.cache->tiles[candidate.face][candidate.tile].exchange(nullptr);
+			--candidate.cache->tilesAllocated;
+			memoryUsed.fetch_sub(sizeof(CacheTile));
+			++evicted;
 		}
 	}
 };
 
+// acceleration structures a model can be traversed with, a flat list when the octree would be a single leaf anyway
+enum ACCEL{ACCEL_OCTREE, ACCEL_LIST, ACCEL_PAGED};
+
+class Model;
+typedef float (*ModelKernel)(Model &model, Ray &ray, float targetDepth);
+
 // 3D Model
 class Model {
 private:
 	ModelRayCache cache;
 	OctNode *octree;
+	// traversal kernels picked by selectKernels, one per query kind
+	ModelKernel closestKernel, occlusionKernel;
+	// dynamic models only, how to refit the octree, and every tri's bounds as of the last refit
+	OctreeRefit octreeRefit;
+	std::vector<BBox> triBounds;
+	float builtCost;
+	// octree built on another thread from a copy of the tris' corners, swapped in by the refit after it's done
+	std::thread rebuildThread;
+	std::atomic<bool> rebuildDone;
+	OctNode *rebuilt;
+	OctreeRefit rebuiltRefit;
+	std::vector<Vec3> rebuildCorners;
+	std::vector<BBox> rebuildBounds;
+
+	/* Model::rayCast specialized for one query kind, cache policy and accelerator
+	occlusion queries never read or fill the cache, a cached hit isn't always the nearest occluder */
+	template <int QUERY, bool CACHED, int ACCEL>
+	static float kernel(Model &model, Ray &ray, float targetDepth) {
+		int face;
+		float bboxDist = model.bbox.rayCastFace(ray, face);
+		if (bboxDist == RAY_MISS) {
+			return RAY_MISS;
+		}
+		if constexpr (QUERY == QUERY_OCCLUSION) {
+			if (bboxDist > targetDepth) {
+				return RAY_MISS;
+			}
+		}
+		if constexpr (CACHED) {
+			float lookup = model.cache.lookup(ray, face, bboxDist);
+			if (lookup != RAY_INVALID) {
+				return lookup;
+			}
+		}
+		float depth;
+		if constexpr (ACCEL == ACCEL_OCTREE) {
+			depth = Octree::traverse<QUERY>(model.octree, ray, targetDepth);
+		} else if constexpr (ACCEL == ACCEL_PAGED) {
+			depth = model.paged->trace<QUERY>(ray, targetDepth);
+		} else {
+			depth = Octree::traverseTris<QUERY>(model.tris, ray, targetDepth);
+		}
+		if constexpr (CACHED) {
+			model.cache.set(ray, face, bboxDist, depth == RAY_MISS);
+		}
+		return depth;
+	}
+	template <int QUERY, bool CACHED>
+	inline ModelKernel pickKernel(int accel) const {
+		if (accel == ACCEL_PAGED) {
+			return kernel<QUERY, false, ACCEL_PAGED>;
+		}
+		return accel == ACCEL_OCTREE ? kernel<QUERY, CACHED, ACCEL_OCTREE> : kernel<QUERY, CACHED, ACCEL_LIST>;
+	}
+
+	static inline int octreeDepth(size_t triCount) {
+		return std::min((int)std::round(std::log(triCount * OCTREE_NODES_PER_TRI) / std::log(8)), OCTREE_DEPTH_MAX);
+	}
+	// a dynamic model's bounds around its mesh's, the ray cache's grid is laid over them again so it starts empty
+	void setEnvelope(const BBox &mesh) {
+		Vec3 pad = Vec3::add(Vec3::scale(Vec3::sub(mesh.max, mesh.min), DYNAMIC_MARGIN), CACHE_MARGIN);
+		bbox = BBox(Vec3::sub(mesh.min, pad), Vec3::add(mesh.max, pad));
+		if (cache.allocated) {
+			cache.release();
+			cache.allocate(Vec3::sub(bbox.max, bbox.min), bbox.min);
+		}
+	}
+	void swapRebuilt() {
+		if (rebuildThread.joinable()) {
+			rebuildThread.join();
+		}
+		Octree::freeOctree(octree);
+		octree = rebuilt;
+		rebuilt = nullptr;
+		octreeRefit = std::move(rebuiltRefit);
+		rebuildCorners.clear();
+		rebuildBounds.clear();
+		rebuildDone = false;
+		++rebuilds;
+		selectKernels();
+	}
+	void startRebuild(const BBox &mesh) {
+		rebuildCorners.resize(tris.size() * 3);
+		for (size_t i = 0; i < tris.size(); ++i) {
+			for (int corner = 0; corner < 3; ++corner) {
+				rebuildCorners[(i * 3) + corner] = tris[i]->verts[corner]->pos;
+			}
+		}
+		rebuildBounds = triBounds;
+		rebuildThread = std::thread([this, mesh]() {
+			Profiler::nameThread("Octree rebuild");
+			PROFILE_ZONE("Octree rebuild");
+			rebuilt = Octree::calcOctree(mesh, tris, octreeDepth(tris.size()), &rebuildBounds);
+			rebuiltRefit.prepare(rebuilt, &rebuildCorners);
+			rebuildDone.store(true, std::memory_order_release);
+		});
+	}
 
 	void calcBBox() {
 		if (tris.size() > 0) {
@@ -149,13 +655,69 @@ private:
 				localbbox += tris[i]->bbox;
 			}
 			bbox = localbbox;
+		} else {
+			bbox = BBox(Vec3(0, 0, 0), Vec3(0, 0, 0));
 		}
 	}
 
+	// texture coords of a tri's corners, and log2 of the texels its texture packs into one world unit
+	struct TriTexCoords {
+		float u[3], v[3];
+		float lodBias;
+	};
+
+	/* mip bias of each textured tri from the ratio of its texture area to its surface area
+	one orthographic pixel covers TEXTURE_PIXEL_FOOTPRINT world units, so this is also log2 of texels per pixel head on */
+	void calcLodBias() {
+		for (size_t i = 0; i < tris.size(); ++i) {
+			const Material &material = materials[triMaterials[i]];
+			if (material.texture < 0) {
+				continue;
+			}
+			const Texture *texture = textures[material.texture];
+			TriTexCoords &coords = triTexCoords[i];
+			float uvArea = std::abs(((coords.u[1] - coords.u[0]) * (coords.v[2] - coords.v[0])) - ((coords.u[2] - coords.u[0]) * (coords.v[1] - coords.v[0]))) / 2;
+			float worldArea = Vec3::lengthOf(Vec3::cross(Vec3::sub(tris[i]->verts[1]->pos, tris[i]->verts[0]->pos), Vec3::sub(tris[i]->verts[2]->pos, tris[i]->verts[0]->pos))) / 2;
+			float texelsPerUnit = std::sqrt((uvArea * texture->width * texture->height) / std::max(worldArea, (float)FLOAT_MARGIN_PRECISE));
+			coords.lodBias = std::log2(std::max(texelsPerUnit * TEXTURE_PIXEL_FOOTPRINT, (float)FLOAT_MARGIN_PRECISE));
+		}
+	}
+	// parses one "v/vt/vn" corner of a face, vt is 0 if missing, moves line past it
+	static bool parseFaceCorner(const char *&line, int &v, int &vt) {
+		char *end;
+		v = strtol(line, &end, 10);
+		if (end == line) {
+			return false;
+		}
+		vt = 0;
+		if (*end == '/' && end[1] != '/') {
+			vt = strtol(end + 1, &end, 10);
+		}
+		line = end + strcspn(end, " \t");
+		return true;
+	}
+
 public:
 	std::vector<Vert *> verts;
 	std::vector<Tri *> tris;
 	BBox bbox;
+	int accel;
+	// out of core geometry, when set verts, tris and the octree are empty
+	PagedGeometry *paged;
+	// surface tables indexed by Tri::index, materials[0] is the default for tris before any usemtl
+	std::vector<Material> materials;
+	std::vector<Texture *> textures;
+	std::vector<uint16_t> triMaterials;
+	// only filled when the model has a textured material
+	std::vector<TriTexCoords> triTexCoords;
+	// verts may move between frames, see setDynamic
+	bool dynamic;
+	// the last refit's time, tris it found moved, ray cache entries it invalidated and the octree's cost over its cost when built
+	double refitMs;
+	long refitMoved, refitInvalidated;
+	float refitCost;
+	// refits, octrees rebuilt in the background and swapped in, and times the mesh outgrew its bounds
+	long refits, rebuilds, regrown;
 
 	#define OBJ_PIXELS_PER_UNIT 100
 	#define OBJ_UNITS_TO_PIXELS(units) (units * OBJ_PIXELS_PER_UNIT)
@@ -166,10 +728,19 @@ public:
 	#define OBJ_PREFIX_VERTEX_NORMAL "vn"
 	#define OBJ_PREFIX_VERTEX_TEXTURE "vt"
 	#define OBJ_PREFIX_FACE "f "
-	Model (const std::string &filename, bool cached) {
+	#define OBJ_PREFIX_MATERIAL_LIBRARY "mtllib "
+	#define OBJ_PREFIX_USE_MATERIAL "usemtl "
+	Model (const std::string &filename, bool cached) : builtCost(0), rebuildDone(false), rebuilt(nullptr), paged(nullptr), dynamic(false),
+		refitMs(0), refitMoved(0), refitInvalidated(0), refitCost(1), refits(0), rebuilds(0), regrown(0) {
+		PROFILE_ZONE("Model load");
 		char lineBuffer[MODEL_LOAD_LINE_BUFFER];
+		char name[MODEL_LOAD_LINE_BUFFER];
 		std::ifstream file(filename);
 		int vCount = 0, vNormalCount = 0, vTextureCount = 0, fCount = 0;
+		materials.push_back(Material());
+		int material = 0;
+		std::vector<float> texCoords;
+		std::vector<int> faceTexCoords;
 		while (file) {
 			file.getline(lineBuffer, MODEL_LOAD_LINE_BUFFER);
 			if (strncmp(OBJ_PREFIX_VERTEX, lineBuffer, OBJ_PREFIX_SIZE) == 0) {
@@ -186,31 +757,221 @@ public:
 				// to handle vertex normals, just set verts[vNormalCount].normal here
 				++vNormalCount;
 			} else if (strncmp(OBJ_PREFIX_VERTEX_TEXTURE, lineBuffer, OBJ_PREFIX_SIZE) == 0) {
-				// to handle vertex texture coords, just set verts[vTextureCount].texture here
+				float u = 0, v = 0;
+				sscanf(lineBuffer, "vt %f %f", &u, &v);
+				texCoords.push_back(u);
+				texCoords.push_back(v);
 				++vTextureCount;
 			} else if (strncmp(OBJ_PREFIX_FACE, lineBuffer, OBJ_PREFIX_SIZE) == 0) {
-				int v1, v2, v3;
-				sscanf(lineBuffer, "f %d/%*s %d/%*s %d/%*s", &v1, &v2, &v3);
+				int v[3], vt[3];
+				const char *line = lineBuffer + OBJ_PREFIX_SIZE;
+				if (!parseFaceCorner(line, v[0], vt[0]) || !parseFaceCorner(line, v[1], vt[1]) || !parseFaceCorner(line, v[2], vt[2])) {
+					continue;
+				}
 				// haha quirky off-by-one numbering system
-				tris.push_back(new Tri(verts[v1 - 1], verts[v2 - 1], verts[v3 - 1]));
+				tris.push_back(new Tri(verts[v[0] - 1], verts[v[1] - 1], verts[v[2] - 1], tris.size()));
+				triMaterials.push_back(material);
+				for (int corner = 0; corner < 3; ++corner) {
+					faceTexCoords.push_back(vt[corner]);
+				}
 				++fCount;
+			} else if (strncmp(OBJ_PREFIX_MATERIAL_LIBRARY, lineBuffer, strlen(OBJ_PREFIX_MATERIAL_LIBRARY)) == 0) {
+				if (sscanf(lineBuffer, "mtllib %511s", name) == 1) {
+					MTL::load(MTL::directory(filename) + name, materials, textures);
+				}
+			} else if (strncmp(OBJ_PREFIX_USE_MATERIAL, lineBuffer, strlen(OBJ_PREFIX_USE_MATERIAL)) == 0) {
+				// unknown names fall back to the default material
+				material = 0;
+				if (sscanf(lineBuffer, "usemtl %511s", name) == 1) {
+					for (size_t i = 1; i < materials.size(); ++i) {
+						if (materials[i].name == name) {
+							material = i;
+						}
+					}
+				}
 			}
 		}
 
+		if (textures.size() > 0) {
+			triTexCoords.resize(tris.size());
+			for (size_t i = 0; i < tris.size(); ++i) {
+				for (int corner = 0; corner < 3; ++corner) {
+					int vt = faceTexCoords[(i * 3) + corner];
+					bool valid = vt > 0 && (size_t)vt * 2 <= texCoords.size();
+					triTexCoords[i].u[corner] = valid ? texCoords[(vt - 1) * 2] : 0;
+					triTexCoords[i].v[corner] = valid ? texCoords[((vt - 1) * 2) + 1] : 0;
+				}
+			}
+			calcLodBias();
+		}
+
 		printf("Loaded model \"%s\", %ld verts, %ld tris\n", filename.c_str(), verts.size(), tris.size());
+		printf("\tMaterials: %ld, textures: %ld\n", materials.size() - 1, textures.size());
 		calcBBox();
 		printf("\tBBox: min(%f %f %f), max(%f %f %f)\n", bbox.min.axis[AXIS_X], bbox.min.axis[AXIS_Y], bbox.min.axis[AXIS_Z], bbox.max.axis[AXIS_X], bbox.max.axis[AXIS_Y], bbox.max.axis[AXIS_Z]);
-		int octreeNodesRequired = tris.size() * OCTREE_NODES_PER_TRI;
-		int octreeDepth = std::min((int)std::round(std::log(octreeNodesRequired) / std::log(8)), OCTREE_DEPTH_MAX);
-		octree = Octree::calcOctree(bbox, tris, octreeDepth);
-		printf("\tOctree: depth %d\n", octreeDepth);
+		int depth = octreeDepth(tris.size());
+		{
+			PROFILE_ZONE("Octree build");
+			octree = Octree::calcOctree(bbox, tris, depth);
+		}
+		printf("\tOctree: depth %d\n", depth);
 
-		if (cached) {
+		if (cached && tris.size() > 0) {
 			printf("\tCache: ");
 			cache.allocate(Vec3::sub(bbox.max, bbox.min), bbox.min);
 		}
+		selectKernels();
+	}
+
+	// geometry paged in from an opened cluster file as rays reach it, see PagedGeometry
+	Model (PagedGeometry *paged) : octree(nullptr), builtCost(0), rebuildDone(false), rebuilt(nullptr), paged(paged), dynamic(false),
+		refitMs(0), refitMoved(0), refitInvalidated(0), refitCost(1), refits(0), rebuilds(0), regrown(0) {
+		bbox = paged->bbox;
+		materials = paged->materials;
+		if (materials.size() == 0) {
+			materials.push_back(Material());
+		}
+		selectKernels();
+	}
+
+	~Model () {
+		if (rebuildThread.joinable()) {
+			rebuildThread.join();
+		}
+		Octree::freeOctree(rebuilt);
+	}
+
+	/* lets the verts move between frames, refit must be called after moving them and before tracing
+	the model's bounds become the mesh's padded by DYNAMIC_MARGIN, so motion inside them keeps the ray cache, paged models can't be dynamic */
+	void setDynamic() {
+		if (dynamic || paged || tris.size() == 0) {
+			return;
+		}
+		dynamic = true;
+		triBounds.resize(tris.size());
+		for (size_t i = 0; i < tris.size(); ++i) {
+			triBounds[i] = tris[i]->bbox;
+		}
+		setEnvelope(bbox);
+		octreeRefit.prepare(octree);
+		octreeRefit.refit();
+		builtCost = octreeRefit.cost();
+	}
+	/* takes the verts' new positions, the octree keeps its subdivision and only its bounds are refit, bottom up in parallel
+	tris that moved invalidate the cache entries of rays through where they were and where they are now
+	once refits have made the octree DYNAMIC_REBUILD_COST times costlier a new one is built on another thread, a later refit swaps it in
+	no thread may trace the model during the call, like ModelRayCache::endFrame */
+	void refit() {
+		if (!dynamic) {
+			return;
+		}
+		PROFILE_ZONE("Refit");
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool swapped = rebuildDone.load(std::memory_order_acquire);
+		if (swapped) {
+			swapRebuilt();
+		}
+
+		int size = tris.size();
+		std::vector<uint8_t> moved(size);
+		#pragma omp parallel for
+		for (int i = 0; i < size; ++i) {
+			tris[i]->update();
+			const BBox &now = tris[i]->bbox, &before = triBounds[i];
+			moved[i] = !Vec3::eq(now.min, before.min) || !Vec3::eq(now.max, before.max);
+		}
+		// where moved tris were and are, by which cell of a grid over the bounds they're in
+		const int cells = DYNAMIC_DIRTY_GRID * DYNAMIC_DIRTY_GRID * DYNAMIC_DIRTY_GRID;
+		BBox dirty[cells];
+		bool dirtied[cells] = {false};
+		BBox mesh = tris[0]->bbox;
+		Vec3 cellSize = Vec3::scale(Vec3::sub(bbox.max, bbox.min), 1.0f / DYNAMIC_DIRTY_GRID);
+		refitMoved = 0;
+		for (int i = 0; i < size; ++i) {
+			mesh += tris[i]->bbox;
+			if (!moved[i]) {
+				continue;
+			}
+			BBox region = triBounds[i];
+			region += tris[i]->bbox;
+			int cell = 0;
+			for (int axis = 0; axis < AXIS_NUM; ++axis) {
+				float center = (region.min.axis[axis] + region.max.axis[axis]) / 2;
+				int index = cellSize.axis[axis] > 0 ? (int)((center - bbox.min.axis[axis]) / cellSize.axis[axis]) : 0;
+				cell = (cell * DYNAMIC_DIRTY_GRID) + CLAMP(0, index, DYNAMIC_DIRTY_GRID - 1);
+			}
+			if (dirtied[cell]) {
+				dirty[cell] += region;
+			} else {
+				dirty[cell] = region;
+				dirtied[cell] = true;
+			}
+			triBounds[i] = tris[i]->bbox;
+			++refitMoved;
+		}
+
+		octreeRefit.refit();
+		float cost = octreeRefit.cost();
+		if (swapped) {
+			builtCost = cost;
+		}
+		refitCost = builtCost > 0 ? cost / builtCost : 1;
+
+		refitInvalidated = 0;
+		if (!bbox.containsPoint(mesh.min) || !bbox.containsPoint(mesh.max)) {
+			// outgrown, the cache's grid moves with the bounds
+			refitInvalidated = cache.entries();
+			setEnvelope(mesh);
+			++regrown;
+		} else if (refitMoved > 0 && cache.allocated) {
+			std::vector<BBox> regions;
+			for (int cell = 0; cell < cells; ++cell) {
+				if (dirtied[cell]) {
+					regions.push_back(dirty[cell]);
+				}
+			}
+			refitInvalidated = cache.invalidate(regions);
+		}
+
+		++refits;
+		refitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (refitCost > DYNAMIC_REBUILD_COST && !rebuildThread.joinable() && !rebuildDone.load(std::memory_order_acquire)) {
+			startRebuild(mesh);
+		}
+	}
+	// blocks until a background rebuild is done, the next refit swaps it in
+	void finishRebuild() {
+		if (rebuildThread.joinable()) {
+			rebuildThread.join();
+		}
+	}
+	// ray cache entries currently set
+	inline long cacheEntries() const {
+		return cache.allocated ? cache.entries() : 0;
 	}
 
+	// the dispatch point, call again after changing what the kernels depend on
+	void selectKernels() {
+		if (paged) {
+			accel = ACCEL_PAGED;
+		} else {
+			accel = (octree && octree->tris.size() != 0) ? ACCEL_LIST : ACCEL_OCTREE;
+		}
+		closestKernel = cache.allocated ? pickKernel<QUERY_CLOSEST, true>(accel) : pickKernel<QUERY_CLOSEST, false>(accel);
+		occlusionKernel = pickKernel<QUERY_OCCLUSION, false>(accel);
+	}
+	// closest hit or occlusion test through the kernel selected for this model
+	template <int QUERY>
+	inline float trace(Ray &ray, float targetDepth = RAY_MISS) {
+		if constexpr (QUERY == QUERY_CLOSEST) {
+			return closestKernel(*this, ray, targetDepth);
+		} else {
+			return occlusionKernel(*this, ray, targetDepth);
+		}
+	}
+
+	// generic path with the query chosen per call, the specialized kernels are benchmarked against it
+
 	float rayCast(Ray &ray, float targetDepth = RAY_MISS, bool shadowRay = false) {
 		// check if the ray intersects the model's bounding box, if not, return false
 		// then raycast using octree acceleration
@@ -223,11 +984,13 @@ public:
 			// cache lookup
 			float lookup = RAY_INVALID;
 			if (!shadowRay && cache.allocated) {
-				lookup = cache.lookup(ray, face, bboxDist, 0.001);
+				lookup = cache.lookup(ray, face, bboxDist);
 			}
 
 			float depth = RAY_MISS;
-			if (lookup == RAY_INVALID) {
+			if (paged) {
+				depth = shadowRay ? paged->trace<QUERY_OCCLUSION>(ray, targetDepth) : paged->trace<QUERY_CLOSEST>(ray, targetDepth);
+			} else if (lookup == RAY_INVALID) {
 				depth = Octree::rayCastOctree(octree, ray, targetDepth, shadowRay);
 				// cache set
 				if (!shadowRay && cache.allocated) {
@@ -241,28 +1004,229 @@ public:
 		}
 		return RAY_MISS;
 	}
+
+	/* sets the ray's surface color from the material of the tri it hit, hit is the intersection in model space
+	textured materials are sampled at the mip level matching the orthographic pixel footprint, widened at grazing angles */
+	inline void surface(Ray &ray, const Vec3 &hit) const {
+		const Tri *tri = ray.tri;
+		// paged hits have no Tri, their diffuse was set as they were found
+		if (!tri) {
+			return;
+		}
+		const Material &material = materials[triMaterials[tri->index]];
+		if (material.texture < 0) {
+			ray.meshInfo.diffuse = material.diffuse;
+			return;
+		}
+		// barycentric coords of the hit
+		Vec3 edge1 = Vec3::sub(tri->verts[1]->pos, tri->verts[0]->pos);
+		Vec3 edge2 = Vec3::sub(tri->verts[2]->pos, tri->verts[0]->pos);
+		Vec3 toHit = Vec3::sub(hit, tri->verts[0]->pos);
+		float d11 = Vec3::dot(edge1, edge1), d12 = Vec3::dot(edge1, edge2), d22 = Vec3::dot(edge2, edge2);
+		float dh1 = Vec3::dot(toHit, edge1), dh2 = Vec3::dot(toHit, edge2);
+		float denominator = (d11 * d22) - (d12 * d12);
+		float w1 = denominator != 0 ? ((d22 * dh1) - (d12 * dh2)) / denominator : 0;
+		float w2 = denominator != 0 ? ((d11 * dh2) - (d12 * dh1)) / denominator : 0;
+		float w0 = 1 - w1 - w2;
+
+		const TriTexCoords &coords = triTexCoords[tri->index];
+		float u = (coords.u[0] * w0) + (coords.u[1] * w1) + (coords.u[2] * w2);
+		float v = (coords.v[0] * w0) + (coords.v[1] * w1) + (coords.v[2] * w2);
+		float cosine = std::max(std::abs(Vec3::dot(ray.dir, tri->normal)), TEXTURE_MIN_COSINE);
+		ray.meshInfo.diffuse = Vec3::mul(material.diffuse, textures[material.texture]->sample(u, v, coords.lodBias - std::log2(cosine)));
+	}
+
+	// bytes of ray cache currently allocated for this model
+	inline long cacheMemory() const {
+		return cache.allocated ? cache.memory() : 0;
+	}
+
+	void occludePacket(ShadowPacket &packet) const {
+		if (paged && !packet.culls(bbox)) {
+			paged->occludePacket(packet);
+		} else if (!packet.culls(bbox)) {
+			int indices[PACKET_MAX_RAYS];
+			int count = 0;
+			for (size_t i = 0; i < packet.size(); ++i) {
+				indices[count++] = i;
+			}
+			Octree::occludePacket(octree, packet, indices, count);
+		}
+	}
 };
 
+/* One placement of a model, many instances share its tris, octree and ray cache
+the model is transformed by linear(rotation, scale, shear) and then moved by pos, rays are transformed into model space instead */
 class ModelInstance {
+private:
+	/* model space ray for a world space one, the model's kernels expect a normalized direction so depths along it
+	are scale times the world depths, scale is 1 for rotations */
+	inline Ray toModel(const Ray &ray, float &scale) const {
+		Vec3 dir = Mat3::transform(inverse, ray.dir);
+		scale = Vec3::lengthOf(dir);
+		Ray modelRay = Ray::unit(Mat3::transform(inverse, Vec3::sub(ray.origin, pos)), Vec3::scale(dir, 1 / scale));
+		modelRay.depth = ray.depth == RAY_MISS ? RAY_MISS : ray.depth * scale;
+		return modelRay;
+	}
+	// back to world space once a transformed instance was hit, the normal only for closest hits
+	inline void fromModel(Ray &ray, Ray &modelRay, float depth, bool normal) const {
+		modelRay.depth = depth;
+		if (normal) {
+			modelRay.meshInfo.normal = Vec3::normalize(Mat3::transformTransposed(inverse, modelRay.meshInfo.normal));
+		}
+		Ray::setHit(ray, modelRay);
+		// paged hits carry their color
+		if (model->paged) {
+			ray.meshInfo.diffuse = modelRay.meshInfo.diffuse;
+		}
+	}
+	// a box of the model's through linear
+	inline BBox boxBounds(const BBox &box) const {
+		if (!transformed) {
+			return box;
+		}
+		Vec3 first = Mat3::transform(linear, box.min);
+		BBox result(first, first);
+		for (int corner = 1; corner < 8; ++corner) {
+			Vec3 point((corner & 1) ? box.max.axis[AXIS_X] : box.min.axis[AXIS_X], (corner & 2) ? box.max.axis[AXIS_Y] : box.min.axis[AXIS_Y],
+				(corner & 4) ? box.max.axis[AXIS_Z] : box.min.axis[AXIS_Z]);
+			Vec3 p = Mat3::transform(linear, point);
+			result += BBox(p, p);
+		}
+		return result;
+	}
+	inline void setBounds() {
+		if (!transformed) {
+			linearBounds = model->bbox;
+			return;
+		}
+		// tight bounds from every transformed vert, paged models only keep their bounds in memory and dynamic ones move their verts
+		if (model->verts.size() > 0 && !model->dynamic) {
+			Vec3 first = Mat3::transform(linear, model->verts[0]->pos);
+			linearBounds = BBox(first, first);
+			for (const Vert *vert: model->verts) {
+				Vec3 p = Mat3::transform(linear, vert->pos);
+				linearBounds += BBox(p, p);
+			}
+			return;
+		}
+		linearBounds = boxBounds(model->bbox);
+	}
 public:
 	Model *model;
 	Vec3 pos;
+	// model to world without pos, and its inverse
+	Mat3 linear, inverse;
+	// false while linear is the identity, rays are only translated then
+	bool transformed;
+	// the model's bounds through linear, pos is added by bounds()
+	BBox linearBounds;
 
-	ModelInstance () {}
-	ModelInstance (Model *model, Vec3 pos) : model(model), pos(pos) {}
+	ModelInstance () : model(nullptr), transformed(false) {}
+	ModelInstance (Model *model, Vec3 pos) : model(model), pos(pos), linear(Mat3::identity()), inverse(Mat3::identity()), transformed(false) {
+		setBounds();
+	}
+	ModelInstance (Model *model, Vec3 pos, const Mat3 &linear) : model(model), pos(pos) {
+		setLinear(linear);
+	}
+	// rotation, scale and shear around the model's origin, must not be singular
+	void setLinear(const Mat3 &linear) {
+		this->linear = linear;
+		inverse = Mat3::inverse(linear);
+		transformed = !Mat3::isIdentity(linear);
+		setBounds();
+	}
+	// world space bounds, exact for the current transform, a dynamic model's bounds may have grown on any refit
+	inline BBox bounds() const {
+		BBox box = model->dynamic ? boxBounds(model->bbox) : linearBounds;
+		return BBox(Vec3::add(box.min, pos), Vec3::add(box.max, pos));
+	}
 	float rayCast(Ray &ray, float targetDepth = RAY_MISS, bool shadowRay = false) const {
-		// offset ray to account for instance position
-		Ray subRay = ray;
-		Ray::translate(subRay, Vec3::scale(pos, -1));
-
-		float depth = model->rayCast(subRay, targetDepth, shadowRay);
-		// ray intersection
-		if (depth != RAY_MISS) {
-			// set all non-positional parameters
-			Ray::setNonPos(ray, subRay);
+		if (!transformed) {
+			// offset ray to account for instance position
+			Ray subRay = Ray::probe(ray);
+			Ray::translate(subRay, Vec3::scale(pos, -1));
+			float depth = model->rayCast(subRay, targetDepth, shadowRay);
+			// ray intersection
+			if (depth != RAY_MISS) {
+				Ray::setHit(ray, subRay);
+				if (model->paged) {
+					ray.meshInfo.diffuse = subRay.meshInfo.diffuse;
+				}
+			}
+			return depth;
+		}
+		float scale;
+		Ray modelRay = toModel(ray, scale);
+		float depth = model->rayCast(modelRay, targetDepth == RAY_MISS ? RAY_MISS : targetDepth * scale, shadowRay);
+		if (depth == RAY_MISS) {
+			return RAY_MISS;
+		}
+		depth /= scale;
+		fromModel(ray, modelRay, depth, !shadowRay);
+		return depth;
+	}
+	template <int QUERY>
+	inline float trace(Ray &ray, float targetDepth = RAY_MISS) const {
+		if (!transformed) {
+			Ray subRay = Ray::probe(ray);
+			Ray::translate(subRay, Vec3::scale(pos, -1));
+			float depth = model->trace<QUERY>(subRay, targetDepth);
+			if (depth != RAY_MISS) {
+				Ray::setHit(ray, subRay);
+				if (model->paged) {
+					ray.meshInfo.diffuse = subRay.meshInfo.diffuse;
+				}
+			}
+			return depth;
 		}
+		float scale;
+		Ray modelRay = toModel(ray, scale);
+		float depth = model->trace<QUERY>(modelRay, targetDepth == RAY_MISS ? RAY_MISS : targetDepth * scale);
+		if (depth == RAY_MISS) {
+			return RAY_MISS;
+		}
+		depth /= scale;
+		fromModel(ray, modelRay, depth, QUERY == QUERY_CLOSEST);
 		return depth;
 	}
+	// surface color of a closest hit on this instance, depth along the world space ray
+	inline void surface(Ray &ray, float depth) const {
+		Vec3 hit = Vec3::sub(Vec3::add(ray.origin, Vec3::scale(ray.dir, depth)), pos);
+		if (!transformed) {
+			model->surface(ray, hit);
+			return;
+		}
+		// textures pick their mip level from the model space direction
+		Ray modelRay = Ray::unit(Vec3(0, 0, 0), Vec3::normalize(Mat3::transform(inverse, ray.dir)));
+		modelRay.tri = ray.tri;
+		modelRay.meshInfo.diffuse = ray.meshInfo.diffuse;
+		model->surface(modelRay, Mat3::transform(inverse, hit));
+		ray.meshInfo.diffuse = modelRay.meshInfo.diffuse;
+	}
+	void occludePacket(ShadowPacket &packet) const {
+		if (!transformed) {
+			// offset packet to account for instance position
+			packet.setOffset(Vec3::scale(pos, -1));
+			model->occludePacket(packet);
+			return;
+		}
+		// the frustum is world space, past it each ray is tested on its own
+		packet.setOffset(Vec3(0, 0, 0));
+		if (packet.culls(bounds())) {
+			return;
+		}
+		for (size_t i = 0; i < packet.size() && packet.active > 0; ++i) {
+			if (!packet.occluded[i]) {
+				Ray ray = Ray::probe(packet.rays[i]);
+				float depth = trace<QUERY_OCCLUSION>(ray, packet.lengths[i]);
+				if (depth != RAY_MISS && !geqMargin(depth, packet.lengths[i])) {
+					packet.occluded[i] = true;
+					--packet.active;
+				}
+			}
+		}
+	}
 };
 
 #endif
@@ -1,3 +1,15 @@
+#ifndef OCTREE
+#define OCTREE
+
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "ray.h"
+#include "bbox.h"
+#include "tri.h"
+#include "packet.h"
+
 // OctNode class for octrees
 class OctNode {
 public:
@@ -10,7 +22,23 @@ namespace Octree {
 	#define OCTREE_NODES_PER_TRI 4
 	#define OCTREE_DEPTH_MAX 10
 	#define OCTREE_LEAF_TRIANGLES 20
-	static OctNode *calcOctree (const BBox &bbox, const std::vector<Tri *> &tris, int depth) {
+	// ray distance to a subnode's bounding box
+	struct SubnodeDepth {
+		int index;
+		float depth;
+	};
+	// adds a subnode to a buffer of at most 8 kept nearest first, equal depths stay in the order they were added
+	static inline void insertSubnode(SubnodeDepth *buffer, int &entries, int index, float depth) {
+		int i = entries++;
+		for (; i > 0 && buffer[i - 1].depth > depth; --i) {
+			buffer[i] = buffer[i - 1];
+		}
+		buffer[i].index = index;
+		buffer[i].depth = depth;
+	}
+	/* triBounds, indexed by Tri::index, replaces the tris' own bounds when set
+	so a copy of them can be built from while the tris themselves change */
+	static OctNode *calcOctree (const BBox &bbox, const std::vector<Tri *> &tris, int depth, const std::vector<BBox> *triBounds = nullptr) {
 		if (tris.size() == 0) {
 			return nullptr;
 		}
@@ -44,7 +72,7 @@ namespace Octree {
 
 		for (Tri *tri: tris) {
 			for (int i = 0; i < 8; ++i) {
-				if (BBox::overlap(bboxes[i], tri->bbox)) {
+				if (BBox::overlap(bboxes[i], triBounds ? (*triBounds)[tri->index] : tri->bbox)) {
 					triangleLists[i].push_back(tri);
 				}
 			}
@@ -54,11 +82,20 @@ namespace Octree {
 		nodeptr->bbox = bbox;
 		#pragma omp parallel for
 		for (int i = 0; i < 8; ++i) {
-			nodeptr->subnodes[i] = calcOctree(bboxes[i], triangleLists[i], depth - 1);
+			nodeptr->subnodes[i] = calcOctree(bboxes[i], triangleLists[i], depth - 1, triBounds);
 		}
 
 		return nodeptr;
 	}
+	static void freeOctree(OctNode *node) {
+		if (!node) {
+			return;
+		}
+		for (int i = 0; i < 8; ++i) {
+			freeOctree(node->subnodes[i]);
+		}
+		delete node;
+	}
 
 	static float rayCastOctree(const OctNode *curNode, Ray &ray, float targetDepth = RAY_MISS, bool shadowRay = false) {
 		if (!curNode) {
@@ -71,7 +108,8 @@ namespace Octree {
 			for (Tri *tri: curNode->tris) {
 				if (tri->rayCast(ray) < depth) {
 					depth = ray.depth;
-					if (shadowRay) {
+					// the tri being shaded is hit right at targetDepth, only nearer tris occlude it
+					if (shadowRay && !geqMargin(depth, targetDepth)) {
 						return depth;
 					}
 				}
@@ -79,29 +117,19 @@ namespace Octree {
 			return depth;
 		} else {
 			// non-leaf node
-			// ray distance to each subnode bounding box
-			struct subnodeDepth {
-				int index;
-				float depth;
-			} subnodeDepthBuffer[8];
+			// ray distance to each subnode bounding box, sorted nearest first
+			SubnodeDepth subnodeDepthBuffer[8];
 			int subnodeDepthBufferEntries = 0;
-
-			// calculate ray distance to each subnode bounding box
 			for (int i = 0; i < 8; ++i) {
 				OctNode *nextNode = curNode->subnodes[i];
 				if (nextNode) {
 					float depth = nextNode->bbox.rayCast(ray);
 					if (depth != RAY_MISS) {
-						subnodeDepthBuffer[subnodeDepthBufferEntries].index = i;
-						subnodeDepthBuffer[subnodeDepthBufferEntries].depth = depth;
-						++subnodeDepthBufferEntries;
+						insertSubnode(subnodeDepthBuffer, subnodeDepthBufferEntries, i, depth);
 					}
 				}
 			}
 
-			//sort subnode buffer by ray distance
-			std::sort(subnodeDepthBuffer, subnodeDepthBuffer + subnodeDepthBufferEntries, [](const struct subnodeDepth &a, const struct subnodeDepth &b) {return a.depth < b.depth;});
-
 			// iterate through subnodes in order, stopping on first ray intersection
 			float depth = targetDepth;
 			for (int i = 0; i < subnodeDepthBufferEntries; ++i) {
@@ -114,7 +142,7 @@ namespace Octree {
 				if (curDepth < depth) {
 					depth = curDepth;
 				}
-				if (shadowRay && depth < targetDepth) {
+				if (shadowRay && !geqMargin(depth, targetDepth)) {
 					return depth;
 				}
 			}
@@ -122,4 +150,301 @@ namespace Octree {
 			return depth;
 		}
 	}
+
+	/* rayCastOctree specialized at compile time for one query kind
+	closest hits never test for an early exit, occlusion tests return as soon as anything is nearer than targetDepth */
+	template <int QUERY>
+	static inline float traverseTris(const std::vector<Tri *> &tris, Ray &ray, float targetDepth) {
+		float depth = targetDepth;
+		for (const Tri *tri: tris) {
+			if (tri->rayCast(ray) < depth) {
+				depth = ray.depth;
+				// the tri being shaded is hit right at targetDepth, only nearer tris occlude it
+				if constexpr (QUERY == QUERY_OCCLUSION) {
+					if (!geqMargin(depth, targetDepth)) {
+						return depth;
+					}
+				}
+			}
+		}
+		return depth;
+	}
+	template <int QUERY>
+	static float traverse(const OctNode *curNode, Ray &ray, float targetDepth) {
+		if (!curNode) {
+			return RAY_MISS;
+		} else if (curNode->tris.size() != 0) {
+			return traverseTris<QUERY>(curNode->tris, ray, targetDepth);
+		}
+
+		SubnodeDepth subnodeDepthBuffer[8];
+		int subnodeDepthBufferEntries = 0;
+		for (int i = 0; i < 8; ++i) {
+			OctNode *nextNode = curNode->subnodes[i];
+			if (nextNode) {
+				float depth = nextNode->bbox.rayCast(ray);
+				// occlusion rays end at targetDepth, nodes beyond it can't hold an occluder
+				if (depth != RAY_MISS && (QUERY == QUERY_CLOSEST || depth <= targetDepth)) {
+					insertSubnode(subnodeDepthBuffer, subnodeDepthBufferEntries, i, depth);
+				}
+			}
+		}
+
+		float depth = targetDepth;
+		for (int i = 0; i < subnodeDepthBufferEntries; ++i) {
+			if (depth < subnodeDepthBuffer[i].depth) {
+				break;
+			}
+			float curDepth = traverse<QUERY>(curNode->subnodes[subnodeDepthBuffer[i].index], ray, targetDepth);
+			if (curDepth < depth) {
+				depth = curDepth;
+				if constexpr (QUERY == QUERY_OCCLUSION) {
+					if (!geqMargin(depth, targetDepth)) {
+						return depth;
+					}
+				}
+			}
+		}
+		return depth;
+	}
+
+	/* marks the given rays of the packet occluded by anything in the octree
+	nodes and tris outside the packet frustum are skipped for every ray, then each ray only visits the nodes it passes through */
+	static void occludePacket(const OctNode *curNode, ShadowPacket &packet, const int *indices, int count) {
+		if (!curNode || packet.active == 0 || packet.culls(curNode->bbox)) {
+			return;
+		}
+		int nodeIndices[PACKET_MAX_RAYS];
+		int nodeCount = packet.filter(curNode->bbox, indices, count, nodeIndices);
+		if (nodeCount == 0) {
+			return;
+		} else if (curNode->tris.size() != 0) {
+			// leaf node
+			for (Tri *tri: curNode->tris) {
+				if (!packet.culls(tri->bbox)) {
+					packet.occlude(tri, nodeIndices, nodeCount);
+					if (packet.active == 0) {
+						return;
+					}
+				}
+			}
+		} else {
+			// non-leaf node
+			for (int i = 0; i < 8; ++i) {
+				occludePacket(curNode->subnodes[i], packet, nodeIndices, nodeCount);
+			}
+		}
+	}
 }
+
+/* Refits an octree's bounds to its tris after their verts moved, keeping the subdivision it was built with
+tris are split between leaves by overlap, so each leaf only bounds the part of each of its tris that was inside its cell
+those parts are kept as polygon corners in the tri's barycentric coordinates, which stay on the tri however its verts move,
+so a refit leaf is as tight as a built one until the tris deform unevenly
+tris only in a leaf because their bounds overlapped its cell are dropped from it, and leaves left empty from the octree */
+class OctreeRefit {
+private:
+	// corners of one tri's part in one leaf, count is -1 if all of the tri was inside
+	struct Part {
+		uint32_t first;
+		int count;
+	};
+	// a clipped polygon's corner, with its barycentric weights of the tri's second and third corners
+	struct Corner {
+		Vec3 pos;
+		float w1, w2;
+	};
+	#define OCTREE_REFIT_CORNERS 12
+	// levels by depth with the root first, leaves in the order of parts, leafParts[i] is leaf i's first part
+	std::vector<std::vector<OctNode *>> levels;
+	std::vector<OctNode *> leaves;
+	std::vector<uint32_t> leafParts;
+	std::vector<Part> parts;
+	std::vector<float> weights;
+
+	void addLevels(OctNode *node, size_t depth) {
+		if (!node) {
+			return;
+		}
+		if (levels.size() <= depth) {
+			levels.resize(depth + 1);
+		}
+		levels[depth].push_back(node);
+		if (node->tris.size() != 0) {
+			leaves.push_back(node);
+		}
+		for (int i = 0; i < 8; ++i) {
+			addLevels(node->subnodes[i], depth + 1);
+		}
+	}
+	// true if nothing is left under the node, empty subnodes are freed on the way
+	static bool prune(OctNode *node) {
+		if (node->tris.size() != 0) {
+			return false;
+		}
+		bool empty = true;
+		for (int i = 0; i < 8; ++i) {
+			if (node->subnodes[i] && prune(node->subnodes[i])) {
+				delete node->subnodes[i];
+				node->subnodes[i] = nullptr;
+			}
+			empty &= !node->subnodes[i];
+		}
+		return empty;
+	}
+	// Sutherland-Hodgman against one side of the cell, keeps the side where sign * (pos - plane) >= 0
+	static int clip(const Corner *in, int count, Corner *out, int axis, float plane, float sign) {
+		int outCount = 0;
+		for (int i = 0; i < count; ++i) {
+			const Corner &a = in[i], &b = in[(i + 1) % count];
+			float da = sign * (a.pos.axis[axis] - plane), db = sign * (b.pos.axis[axis] - plane);
+			if (da >= 0) {
+				out[outCount++] = a;
+			}
+			if ((da >= 0) != (db >= 0)) {
+				float t = da / (da - db);
+				Corner &c = out[outCount++];
+				c.pos = Vec3::add(a.pos, Vec3::scale(Vec3::sub(b.pos, a.pos), t));
+				c.w1 = a.w1 + ((b.w1 - a.w1) * t);
+				c.w2 = a.w2 + ((b.w2 - a.w2) * t);
+			}
+		}
+		return outCount;
+	}
+	/* the part of the tri with corners c inside the cell, with a count of 0 if none of it is
+	the cell is widened by the margin calcOctree assigned tris with, so tris lying on its sides keep their part */
+	Part clipTri(const Vec3 *c, const BBox &built, std::vector<float> &out) const {
+		Vec3 margin(FLOAT_MARGIN_CLOSE, FLOAT_MARGIN_CLOSE, FLOAT_MARGIN_CLOSE);
+		BBox cell(Vec3::sub(built.min, margin), Vec3::add(built.max, margin));
+		BBox triBounds(c[0], c[1]);
+		triBounds += BBox(c[2], c[2]);
+		if (cell.containsPoint(triBounds.min) && cell.containsPoint(triBounds.max)) {
+			return {0, -1};
+		}
+		Corner polygon[2][OCTREE_REFIT_CORNERS] = {{{c[0], 0, 0}, {c[1], 1, 0}, {c[2], 0, 1}}};
+		int count = 3, current = 0;
+		for (int axis = 0; axis < AXIS_NUM && count > 0; ++axis) {
+			count = clip(polygon[current], count, polygon[1 - current], axis, cell.min.axis[axis], 1);
+			current = 1 - current;
+			count = clip(polygon[current], count, polygon[1 - current], axis, cell.max.axis[axis], -1);
+			current = 1 - current;
+		}
+		Part part = {(uint32_t)(out.size() / 2), count};
+		for (int i = 0; i < count; ++i) {
+			out.push_back(polygon[current][i].w1);
+			out.push_back(polygon[current][i].w2);
+		}
+		return part;
+	}
+public:
+	/* splits the tris between the leaves of a freshly built octree, whose leaf bounds are still their cells
+	corners, 3 per Tri::index, are the positions the octree was built from if not the tris' current ones */
+	void prepare(OctNode *root, const std::vector<Vec3> *corners = nullptr) {
+		levels.clear();
+		leaves.clear();
+		addLevels(root, 0);
+		std::vector<std::vector<Part>> leafPartLists(leaves.size());
+		std::vector<std::vector<float>> leafWeights(leaves.size());
+		#pragma omp parallel for schedule(dynamic, 16)
+		for (size_t l = 0; l < leaves.size(); ++l) {
+			std::vector<Tri *> inside;
+			for (Tri *tri: leaves[l]->tris) {
+				Vec3 c[3];
+				for (int corner = 0; corner < 3; ++corner) {
+					c[corner] = corners ? (*corners)[(tri->index * 3) + corner] : tri->verts[corner]->pos;
+				}
+				Part part = clipTri(c, leaves[l]->bbox, leafWeights[l]);
+				if (part.count != 0) {
+					inside.push_back(tri);
+					leafPartLists[l].push_back(part);
+				}
+			}
+			leaves[l]->tris.swap(inside);
+		}
+		// the leaves still holding tris stay in the same order
+		if (root) {
+			prune(root);
+		}
+		levels.clear();
+		leaves.clear();
+		addLevels(root, 0);
+		leafParts.clear();
+		parts.clear();
+		weights.clear();
+		for (size_t l = 0; l < leafPartLists.size(); ++l) {
+			if (leafPartLists[l].size() == 0) {
+				continue;
+			}
+			leafParts.push_back(parts.size());
+			uint32_t offset = weights.size() / 2;
+			for (Part part: leafPartLists[l]) {
+				part.first += offset;
+				parts.push_back(part);
+			}
+			weights.insert(weights.end(), leafWeights[l].begin(), leafWeights[l].end());
+		}
+		leafParts.push_back(parts.size());
+	}
+	// leaves first, then the nodes above them from the deepest level up, each in parallel
+	void refit() {
+		#pragma omp parallel for schedule(dynamic, 16)
+		for (size_t l = 0; l < leaves.size(); ++l) {
+			OctNode *leaf = leaves[l];
+			bool first = true;
+			BBox bbox;
+			for (uint32_t p = leafParts[l]; p < leafParts[l + 1]; ++p) {
+				const Part &part = parts[p];
+				const Tri *tri = leaf->tris[p - leafParts[l]];
+				if (part.count < 0) {
+					bbox = first ? tri->bbox : (bbox += tri->bbox);
+					first = false;
+					continue;
+				}
+				const Vec3 &a = tri->verts[0]->pos;
+				Vec3 edge1 = Vec3::sub(tri->verts[1]->pos, a), edge2 = Vec3::sub(tri->verts[2]->pos, a);
+				for (int i = 0; i < part.count; ++i) {
+					const float *w = &weights[(part.first + i) * 2];
+					Vec3 pos = Vec3::add(a, Vec3::add(Vec3::scale(edge1, w[0]), Vec3::scale(edge2, w[1])));
+					if (first) {
+						bbox = BBox(pos, pos);
+						first = false;
+					} else {
+						bbox += BBox(pos, pos);
+					}
+				}
+			}
+			leaf->bbox = bbox;
+		}
+		for (size_t level = levels.size(); level-- > 0;) {
+			const std::vector<OctNode *> &nodes = levels[level];
+			#pragma omp parallel for schedule(dynamic, 16)
+			for (size_t n = 0; n < nodes.size(); ++n) {
+				OctNode *node = nodes[n];
+				if (node->tris.size() != 0) {
+					continue;
+				}
+				bool first = true;
+				for (int i = 0; i < 8; ++i) {
+					if (node->subnodes[i]) {
+						node->bbox = first ? node->subnodes[i]->bbox : (node->bbox += node->subnodes[i]->bbox);
+						first = false;
+					}
+				}
+			}
+		}
+	}
+	// expected tri tests of a ray through the root, leaf surface areas times their tris over the root's, grows as refits loosen the tree
+	float cost() const {
+		if (levels.size() == 0) {
+			return 0;
+		}
+		double sum = 0;
+		for (const OctNode *leaf: leaves) {
+			sum += (double)leaf->bbox.surfaceArea() * leaf->tris.size();
+		}
+		float rootArea = levels[0][0]->bbox.surfaceArea();
+		return rootArea > 0 ? sum / rootArea : 0;
+	}
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef PACKET
+#define PACKET
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+#include "common.h"
+#include "vec3.h"
+#include "ray.h"
+#include "bbox.h"
+#include "tri.h"
+
+// Shadow ray packets
+// side in pixels of the screen tiles shadow rays are grouped by
+#define PACKET_TILE_SIZE 16
+#define PACKET_MAX_RAYS (PACKET_TILE_SIZE * PACKET_TILE_SIZE)
+// every ray must lean at least this much along the packet's main axis for the frustum to stay narrow
+#define PACKET_MIN_AXIS_DIR 0.1
+// boxes are only culled this far outside the frustum, tri tests have margins of their own
+#define PACKET_CULL_MARGIN 1
+#define PACKET_PLANES 6
+
+/* Shadow rays sharing an origin, ie: one point light, bounded by a frustum
+whole instances, octree nodes and tris outside the frustum are skipped for every ray at once */
+class ShadowPacket {
+public:
+	std::vector<Ray> rays;
+	std::vector<float> lengths;
+	std::vector<uint8_t> occluded;
+	// rays not yet known to be occluded
+	int active;
+	// world space origin shared by every ray
+	Vec3 origin;
+	// a point p is inside the frustum when dot(planeNormal, p) + planeOffset >= 0 for every plane
+	Vec3 planeNormal[PACKET_PLANES];
+	float planeOffset[PACKET_PLANES], worldPlaneOffset[PACKET_PLANES];
+
+	ShadowPacket () : active(0) {
+		rays.reserve(PACKET_MAX_RAYS);
+		lengths.reserve(PACKET_MAX_RAYS);
+		occluded.reserve(PACKET_MAX_RAYS);
+	}
+	void clear() {
+		rays.clear();
+		lengths.clear();
+		occluded.clear();
+		active = 0;
+	}
+	void add(const Ray &ray, float length) {
+		rays.push_back(ray);
+		rays.back().depth = RAY_MISS;
+		lengths.push_back(length);
+		occluded.push_back(false);
+		++active;
+	}
+	inline size_t size() const {
+		return rays.size();
+	}
+	// builds the bounding frustum, returns false if the rays don't share an origin or spread too wide to bound
+	bool build() {
+		if (rays.size() == 0) {
+			return false;
+		}
+		origin = rays[0].origin;
+		Vec3 mean(0, 0, 0);
+		for (const Ray &ray: rays) {
+			if (ray.origin.axis[AXIS_X] != origin.axis[AXIS_X] || ray.origin.axis[AXIS_Y] != origin.axis[AXIS_Y] || ray.origin.axis[AXIS_Z] != origin.axis[AXIS_Z]) {
+				return false;
+			}
+			Vec3::m_add(mean, ray.dir);
+		}
+
+		// main axis of the packet, every ray advances along it in the same direction
+		int major = AXIS_X;
+		for (int axis = AXIS_Y; axis < AXIS_NUM; ++axis) {
+			if (std::abs(mean.axis[axis]) > std::abs(mean.axis[major])) {
+				major = axis;
+			}
+		}
+		float sign = mean.axis[major] < 0 ? -1 : 1;
+		int minor[2] = {(major + 1) % AXIS_NUM, (major + 2) % AXIS_NUM};
+
+		// slopes of the rays against the main axis, and how far along it they reach
+		float slopeMin[2] = {RAY_MISS, RAY_MISS}, slopeMax[2] = {-RAY_MISS, -RAY_MISS};
+		float reach = 0;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			float along = rays[i].dir.axis[major] * sign;
+			if (along < PACKET_MIN_AXIS_DIR) {
+				return false;
+			}
+			for (int m = 0; m < 2; ++m) {
+				float slope = rays[i].dir.axis[minor[m]] / along;
+				slopeMin[m] = std::min(slopeMin[m], slope);
+				slopeMax[m] = std::max(slopeMax[m], slope);
+			}
+			reach = std::max(reach, lengths[i] * along);
+		}
+
+		// side planes, each contains the origin
+		for (int m = 0; m < 2; ++m) {
+			Vec3 lower(0, 0, 0), upper(0, 0, 0);
+			lower.axis[minor[m]] = 1;
+			lower.axis[major] = -slopeMin[m] * sign;
+			upper.axis[minor[m]] = -1;
+			upper.axis[major] = slopeMax[m] * sign;
+			planeNormal[m * 2] = Vec3::normalize(lower);
+			planeNormal[(m * 2) + 1] = Vec3::normalize(upper);
+		}
+		// near plane through the origin, far plane past the end of the longest ray
+		planeNormal[4] = Vec3(0, 0, 0);
+		planeNormal[4].axis[major] = sign;
+		planeNormal[5] = Vec3(0, 0, 0);
+		planeNormal[5].axis[major] = -sign;
+		for (int p = 0; p < PACKET_PLANES; ++p) {
+			planeOffset[p] = -Vec3::dot(planeNormal[p], origin);
+		}
+		planeOffset[5] += reach;
+		for (int p = 0; p < PACKET_PLANES; ++p) {
+			worldPlaneOffset[p] = planeOffset[p];
+		}
+		return true;
+	}
+	// true if the box lies entirely outside the frustum
+	inline bool culls(const BBox &bbox) const {
+		for (int p = 0; p < PACKET_PLANES; ++p) {
+			// corner of the box furthest along the plane normal
+			float dist = planeOffset[p];
+			for (int axis = 0; axis < AXIS_NUM; ++axis) {
+				dist += planeNormal[p].axis[axis] * (planeNormal[p].axis[axis] > 0 ? bbox.max.axis[axis] : bbox.min.axis[axis]);
+			}
+			if (dist < -PACKET_CULL_MARGIN) {
+				return true;
+			}
+		}
+		return false;
+	}
+	// moves the packet from world space by offset, like Ray::translate, always starting from the world space rays
+	void setOffset(const Vec3 &offset) {
+		Vec3 offsetOrigin = Vec3::add(origin, offset);
+		for (Ray &ray: rays) {
+			ray.origin = offsetOrigin;
+		}
+		for (int p = 0; p < PACKET_PLANES; ++p) {
+			planeOffset[p] = worldPlaneOffset[p] - Vec3::dot(planeNormal[p], offset);
+		}
+	}
+	/* copies the indices of rays that are still unoccluded and whose segment may pass through the box into out
+	returns how many were copied, in and out may be the same */
+	inline int filter(const BBox &bbox, const int *in, int count, int *out) const {
+		int kept = 0;
+		for (int j = 0; j < count; ++j) {
+			int i = in[j];
+			if (!occluded[i]) {
+				float depth = bbox.rayCast(rays[i]);
+				if (depth != RAY_MISS && depth < lengths[i] + PACKET_CULL_MARGIN) {
+					out[kept++] = i;
+				}
+			}
+		}
+		return kept;
+	}
+	// test the given rays against one tri, the tri at the end of a ray is not an occluder
+	inline void occlude(const Tri *tri, const int *indices, int count) {
+		for (int j = 0; j < count; ++j) {
+			int i = indices[j];
+			if (!occluded[i]) {
+				float depth = tri->rayCast(rays[i]);
+				if (depth != RAY_MISS && !geqMargin(depth, lengths[i])) {
+					occluded[i] = true;
+					--active;
+				}
+			}
+		}
+	}
+};
+
+#endif
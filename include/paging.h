@@ -0,0 +1,566 @@
+#ifndef PAGING
+#define PAGING
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "vec3.h"
+#include "ray.h"
+#include "bbox.h"
+#include "tri.h"
+#include "octree.h"
+#include "packet.h"
+#include "material.h"
+#include "profiler.h"
+
+// Out of core geometry
+#define PAGING_MAGIC 0x52544350
+#define PAGING_VERSION 1
+// most tris in one cluster, clusters are split at the median of their longest axis until they fit
+#define PAGING_CLUSTER_TRIS 4096
+// clusters start on page boundaries so each one can be paged in and out on its own
+#define PAGING_PAGE_SIZE 4096
+// sections inside a cluster start on cache line boundaries
+#define PAGING_ALIGN 64
+// resident cluster memory shared by every paged model, least recently used clusters are evicted past it
+#define PAGING_BUDGET_MB 256
+// once over budget, clusters are evicted until this fraction of it is left in use
+#define PAGING_EVICT_LOW 0.75
+// top level nodes a traversal can have pending
+#define PAGING_STACK_SIZE 64
+
+// tri as stored in a cluster, positions instead of vert pointers so it is used straight from the mapping
+struct PagedTri {
+	Vec3 verts[3];
+	Vec3 normal;
+	BBox bbox;
+	// position in the source model's tri list, and its material
+	uint32_t index, material;
+};
+// flattened octree node of a cluster, subnodes index the cluster's nodes, -1 for none
+struct PagedNode {
+	BBox bbox;
+	int32_t subnodes[8];
+	// leaves hold the cluster's tris leafTris[firstTri] to leafTris[firstTri + triCount - 1]
+	uint32_t firstTri, triCount;
+};
+// where a cluster is in the file, its nodes, then leaf tri indices, then tris
+struct PagedCluster {
+	BBox bbox;
+	uint64_t offset, bytes;
+	uint32_t nodes, leafTris, tris, padding;
+};
+// resident hierarchy over the clusters, a node has two children or is a cluster
+struct PagedTopNode {
+	BBox bbox;
+	int32_t children[2];
+	int32_t cluster;
+};
+struct PagedMaterial {
+	Vec3 diffuse, specular;
+	float shininess;
+};
+// file header, followed by the top nodes, the cluster table, the materials and then the clusters
+struct PagedFileHeader {
+	uint32_t magic, version, topNodes, clusters, materials, tris;
+	BBox bbox;
+};
+
+/* Model geometry split into spatially coherent clusters, each with its own octree, in a memory mapped file
+only the top level hierarchy and cluster table are resident, clusters are paged in the first time a ray reaches them
+and evicted least recently used first once every paged model together is over budget */
+class PagedGeometry {
+private:
+	int fd;
+	const uint8_t *mapping;
+	size_t bytes;
+	std::vector<PagedTopNode> top;
+	std::vector<PagedCluster> clusters;
+	// touch count each cluster was last reached at and whether it is counted as resident
+	struct ClusterState {
+		std::atomic<uint64_t> lastUsed;
+		std::atomic<bool> resident;
+	};
+	ClusterState *state;
+
+	static inline std::atomic<long> residentBytes{0};
+	static inline long memoryBudget = (long)PAGING_BUDGET_MB * SIZE_MB;
+	// counts every cluster touch, so clusters reached in one frame still have an order, and where it stood when the frame began
+	static inline std::atomic<uint64_t> touches{1};
+	static inline uint64_t frameStart = 1;
+	static inline std::vector<PagedGeometry *> registry;
+	// guards paging in and out and the registry, ray traversal never takes it
+	static inline std::mutex pagingMutex;
+
+	static inline size_t align(size_t offset, size_t alignment) {
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+	static inline size_t leafTrisOffset(const PagedCluster &cluster) {
+		return align(cluster.nodes * sizeof(PagedNode), PAGING_ALIGN);
+	}
+	static inline size_t trisOffset(const PagedCluster &cluster) {
+		return align(leafTrisOffset(cluster) + (cluster.leafTris * sizeof(uint32_t)), PAGING_ALIGN);
+	}
+
+	// nearest hit in one cluster, mirrors Octree::traverse on the flattened nodes
+	template <int QUERY>
+	static float traverse(const PagedNode *nodes, const uint32_t *leafTris, const PagedTri *tris, int node, Ray &ray, float targetDepth, const PagedTri *&hit) {
+		const PagedNode &curNode = nodes[node];
+		float depth = targetDepth;
+		if (curNode.triCount != 0) {
+			for (uint32_t i = curNode.firstTri; i < curNode.firstTri + curNode.triCount; ++i) {
+				const PagedTri &tri = tris[leafTris[i]];
+				float triDepth = Tri::intersect(tri.verts[0], tri.verts[1], tri.verts[2], tri.normal, tri.bbox, ray);
+				if (triDepth != RAY_MISS && triDepth < depth) {
+					ray.meshInfo.normal = tri.normal;
+					ray.tri = nullptr;
+					ray.depth = triDepth;
+					depth = triDepth;
+					hit = &tri;
+					if constexpr (QUERY == QUERY_OCCLUSION) {
+						if (!geqMargin(depth, targetDepth)) {
+							return depth;
+						}
+					}
+				}
+			}
+			return depth;
+		}
+
+		Octree::SubnodeDepth subnodeDepthBuffer[8];
+		int subnodeDepthBufferEntries = 0;
+		for (int i = 0; i < 8; ++i) {
+			if (curNode.subnodes[i] >= 0) {
+				float subDepth = nodes[curNode.subnodes[i]].bbox.rayCast(ray);
+				if (subDepth != RAY_MISS && (QUERY == QUERY_CLOSEST || subDepth <= targetDepth)) {
+					Octree::insertSubnode(subnodeDepthBuffer, subnodeDepthBufferEntries, curNode.subnodes[i], subDepth);
+				}
+			}
+		}
+
+		for (int i = 0; i < subnodeDepthBufferEntries; ++i) {
+			if (depth < subnodeDepthBuffer[i].depth) {
+				break;
+			}
+			float curDepth = traverse<QUERY>(nodes, leafTris, tris, subnodeDepthBuffer[i].index, ray, targetDepth, hit);
+			if (curDepth < depth) {
+				depth = curDepth;
+				if constexpr (QUERY == QUERY_OCCLUSION) {
+					if (!geqMargin(depth, targetDepth)) {
+						return depth;
+					}
+				}
+			}
+		}
+		return depth;
+	}
+
+	// marks the cluster as the most recently used, paging it in if it isn't resident
+	inline void touch(int cluster) {
+		ClusterState &clusterState = state[cluster];
+		clusterState.lastUsed.store(touches.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+		if (!clusterState.resident.load(std::memory_order_acquire)) {
+			pageIn(cluster);
+		}
+	}
+	void pageIn(int cluster) {
+		PROFILE_ZONE("Page in");
+		std::lock_guard<std::mutex> lock(pagingMutex);
+		ClusterState &clusterState = state[cluster];
+		if (clusterState.resident.load(std::memory_order_relaxed)) {
+			return;
+		}
+		const PagedCluster &info = clusters[cluster];
+		// read the whole cluster ahead instead of faulting it in page by page during traversal
+		madvise((void *)(mapping + info.offset), info.bytes, MADV_WILLNEED);
+		clusterState.resident.store(true, std::memory_order_release);
+		residentBytes += info.bytes;
+		++framePageIns;
+		framePageInBytes += info.bytes;
+		if (residentBytes > memoryBudget) {
+			evict(this, cluster);
+		}
+	}
+	void pageOut(int cluster) {
+		const PagedCluster &info = clusters[cluster];
+		// a ray still inside the cluster faults it back in from the file, so this is safe mid frame
+		madvise((void *)(mapping + info.offset), info.bytes, MADV_DONTNEED);
+		posix_fadvise(fd, info.offset, info.bytes, POSIX_FADV_DONTNEED);
+		state[cluster].resident.store(false, std::memory_order_release);
+		residentBytes -= info.bytes;
+		++evicted;
+	}
+	/* least recently used clusters out until PAGING_EVICT_LOW of the budget is in use, keeping the one being paged in
+	clusters reached this frame are likely reached again by the next rays, so those only go as far as needed to fit the budget */
+	static void evict(const PagedGeometry *keepModel, int keepCluster) {
+		struct Candidate {
+			PagedGeometry *model;
+			int cluster;
+			uint64_t lastUsed;
+		};
+		std::vector<Candidate> candidates;
+		for (PagedGeometry *model: registry) {
+			for (size_t i = 0; i < model->clusters.size(); ++i) {
+				if (model->state[i].resident.load(std::memory_order_relaxed) && !(model == keepModel && (int)i == keepCluster)) {
+					candidates.push_back({model, (int)i, model->state[i].lastUsed.load(std::memory_order_relaxed)});
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {return a.lastUsed < b.lastUsed;});
+		long low = memoryBudget * PAGING_EVICT_LOW;
+		for (const Candidate &candidate: candidates) {
+			if (residentBytes <= (candidate.lastUsed >= frameStart ? memoryBudget : low)) {
+				break;
+			}
+			candidate.model->pageOut(candidate.cluster);
+		}
+	}
+
+	// builds the cluster tree over tris[begin, end) in place, appending top nodes, returns the node's index
+	static int buildTop(std::vector<Tri *> &tris, size_t begin, size_t end, int clusterTris, std::vector<PagedTopNode> &top, std::vector<std::pair<size_t, size_t>> &ranges) {
+		BBox bbox = tris[begin]->bbox;
+		for (size_t i = begin; i < end; ++i) {
+			bbox += tris[i]->bbox;
+		}
+		int node = top.size();
+		PagedTopNode topNode;
+		topNode.bbox = bbox;
+		topNode.children[0] = topNode.children[1] = -1;
+		topNode.cluster = end - begin <= (size_t)clusterTris ? (int)ranges.size() : -1;
+		top.push_back(topNode);
+		if (topNode.cluster >= 0) {
+			ranges.push_back({begin, end});
+			return node;
+		}
+		int axis = AXIS_X;
+		for (int a = AXIS_Y; a < AXIS_NUM; ++a) {
+			if (bbox.max.axis[a] - bbox.min.axis[a] > bbox.max.axis[axis] - bbox.min.axis[axis]) {
+				axis = a;
+			}
+		}
+		size_t middle = begin + ((end - begin) / 2);
+		std::nth_element(tris.begin() + begin, tris.begin() + middle, tris.begin() + end, [axis](const Tri *a, const Tri *b) {
+			return a->bbox.min.axis[axis] + a->bbox.max.axis[axis] < b->bbox.min.axis[axis] + b->bbox.max.axis[axis];
+		});
+		int left = buildTop(tris, begin, middle, clusterTris, top, ranges);
+		int right = buildTop(tris, middle, end, clusterTris, top, ranges);
+		top[node].children[0] = left;
+		top[node].children[1] = right;
+		return node;
+	}
+	// flattens an octree into nodes and leaf tri lists, freeing it, returns the node's index
+	static int flatten(OctNode *octNode, const std::unordered_map<const Tri *, uint32_t> &localIndex, std::vector<PagedNode> &nodes, std::vector<uint32_t> &leafTris) {
+		if (!octNode) {
+			return -1;
+		}
+		int node = nodes.size();
+		PagedNode pagedNode;
+		pagedNode.bbox = octNode->bbox;
+		pagedNode.firstTri = leafTris.size();
+		pagedNode.triCount = octNode->tris.size();
+		std::fill(pagedNode.subnodes, pagedNode.subnodes + 8, -1);
+		nodes.push_back(pagedNode);
+		for (const Tri *tri: octNode->tris) {
+			leafTris.push_back(localIndex.at(tri));
+		}
+		for (int i = 0; i < 8; ++i) {
+			int subnode = octNode->tris.size() == 0 ? flatten(octNode->subnodes[i], localIndex, nodes, leafTris) : -1;
+			nodes[node].subnodes[i] = subnode;
+		}
+		delete octNode;
+		return node;
+	}
+public:
+	BBox bbox;
+	std::vector<Material> materials;
+	uint32_t tris;
+	// page ins and their bytes since the last endFrame, and in the frame before it
+	static inline std::atomic<long> framePageIns{0}, framePageInBytes{0};
+	static inline long lastFramePageIns = 0, lastFramePageInBytes = 0;
+	static inline std::atomic<long> totalPageIns{0}, evicted{0};
+
+	PagedGeometry () : fd(-1), mapping(nullptr), bytes(0), state(nullptr), tris(0) {}
+	PagedGeometry (const PagedGeometry &) = delete;
+	PagedGeometry &operator=(const PagedGeometry &) = delete;
+	~PagedGeometry () {
+		close();
+	}
+
+	/* writes tris into a cluster file, triMaterials and materials as in Model
+	clusters are built and written one at a time, the caller's tri list is reordered */
+	static bool write(const std::string &filename, std::vector<Tri *> tris, const std::vector<uint16_t> &triMaterials, const std::vector<Material> &materials, int clusterTris = PAGING_CLUSTER_TRIS) {
+		PROFILE_ZONE("Cluster build");
+		if (tris.size() == 0) {
+			printf("Nothing to page out to \"%s\"\n", filename.c_str());
+			return false;
+		}
+		std::vector<PagedTopNode> top;
+		std::vector<std::pair<size_t, size_t>> ranges;
+		buildTop(tris, 0, tris.size(), clusterTris, top, ranges);
+
+		PagedFileHeader header;
+		header.magic = PAGING_MAGIC;
+		header.version = PAGING_VERSION;
+		header.topNodes = top.size();
+		header.clusters = ranges.size();
+		header.materials = materials.size();
+		header.tris = tris.size();
+		header.bbox = top[0].bbox;
+		std::vector<PagedCluster> table(ranges.size());
+		std::vector<PagedMaterial> pagedMaterials;
+		for (const Material &material: materials) {
+			pagedMaterials.push_back({material.diffuse, material.specular, material.shininess});
+		}
+
+		FILE *file = fopen(filename.c_str(), "wb");
+		if (!file) {
+			printf("Could not open \"%s\"\n", filename.c_str());
+			return false;
+		}
+		// tables are written last, once the clusters' offsets are known
+		size_t offset = align(sizeof(header) + (top.size() * sizeof(PagedTopNode)) + (table.size() * sizeof(PagedCluster)) + (pagedMaterials.size() * sizeof(PagedMaterial)), PAGING_PAGE_SIZE);
+		std::vector<uint8_t> blob;
+		for (size_t c = 0; c < ranges.size(); ++c) {
+			std::unordered_map<const Tri *, uint32_t> localIndex;
+			std::vector<Tri *> clusterTris(tris.begin() + ranges[c].first, tris.begin() + ranges[c].second);
+			std::vector<PagedTri> pagedTris;
+			BBox clusterBBox = clusterTris[0]->bbox;
+			for (Tri *tri: clusterTris) {
+				localIndex[tri] = pagedTris.size();
+				pagedTris.push_back({{tri->verts[0]->pos, tri->verts[1]->pos, tri->verts[2]->pos}, tri->normal, tri->bbox, tri->index, tri->index < triMaterials.size() ? triMaterials[tri->index] : 0u});
+				clusterBBox += tri->bbox;
+			}
+			int octreeDepth = std::min((int)std::round(std::log(clusterTris.size() * OCTREE_NODES_PER_TRI) / std::log(8)), OCTREE_DEPTH_MAX);
+			std::vector<PagedNode> nodes;
+			std::vector<uint32_t> leafTris;
+			flatten(Octree::calcOctree(clusterBBox, clusterTris, octreeDepth), localIndex, nodes, leafTris);
+
+			PagedCluster &cluster = table[c];
+			cluster.bbox = clusterBBox;
+			cluster.nodes = nodes.size();
+			cluster.leafTris = leafTris.size();
+			cluster.tris = pagedTris.size();
+			cluster.padding = 0;
+			cluster.offset = offset;
+			cluster.bytes = trisOffset(cluster) + (pagedTris.size() * sizeof(PagedTri));
+			blob.assign(align(cluster.bytes, PAGING_PAGE_SIZE), 0);
+			memcpy(blob.data(), nodes.data(), nodes.size() * sizeof(PagedNode));
+			memcpy(blob.data() + leafTrisOffset(cluster), leafTris.data(), leafTris.size() * sizeof(uint32_t));
+			memcpy(blob.data() + trisOffset(cluster), pagedTris.data(), pagedTris.size() * sizeof(PagedTri));
+			fseek(file, offset, SEEK_SET);
+			fwrite(blob.data(), 1, blob.size(), file);
+			offset += blob.size();
+		}
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(top.data(), sizeof(PagedTopNode), top.size(), file);
+		fwrite(table.data(), sizeof(PagedCluster), table.size(), file);
+		fwrite(pagedMaterials.data(), sizeof(PagedMaterial), pagedMaterials.size(), file);
+		bool written = !ferror(file);
+		fclose(file);
+		printf("Wrote \"%s\", %ld tris in %ld clusters, %.2f MB\n", filename.c_str(), (long)tris.size(), (long)ranges.size(), offset / (float)SIZE_MB);
+		return written;
+	}
+
+	// maps a cluster file and reads its top level, false if it can't be read
+	bool open(const std::string &filename) {
+		close();
+		fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			printf("Could not open \"%s\"\n", filename.c_str());
+			return false;
+		}
+		PagedFileHeader header;
+		bytes = lseek(fd, 0, SEEK_END);
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != PAGING_MAGIC || header.version != PAGING_VERSION) {
+			printf("\"%s\" is not a cluster file\n", filename.c_str());
+			close();
+			return false;
+		}
+		top.resize(header.topNodes);
+		clusters.resize(header.clusters);
+		std::vector<PagedMaterial> pagedMaterials(header.materials);
+		size_t offset = sizeof(header);
+		bool complete = pread(fd, top.data(), top.size() * sizeof(PagedTopNode), offset) == (ssize_t)(top.size() * sizeof(PagedTopNode));
+		offset += top.size() * sizeof(PagedTopNode);
+		complete &= pread(fd, clusters.data(), clusters.size() * sizeof(PagedCluster), offset) == (ssize_t)(clusters.size() * sizeof(PagedCluster));
+		offset += clusters.size() * sizeof(PagedCluster);
+		complete &= pread(fd, pagedMaterials.data(), pagedMaterials.size() * sizeof(PagedMaterial), offset) == (ssize_t)(pagedMaterials.size() * sizeof(PagedMaterial));
+		for (const PagedCluster &cluster: clusters) {
+			complete &= cluster.offset + cluster.bytes <= bytes;
+		}
+		if (!complete || top.size() == 0) {
+			printf("\"%s\" is truncated\n", filename.c_str());
+			close();
+			return false;
+		}
+
+		// address space only, nothing is read until a ray reaches a cluster
+		void *mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapped == MAP_FAILED) {
+			printf("Could not map \"%s\"\n", filename.c_str());
+			close();
+			return false;
+		}
+		mapping = (const uint8_t *)mapped;
+		madvise(mapped, bytes, MADV_RANDOM);
+		state = new ClusterState[clusters.size()];
+		for (size_t i = 0; i < clusters.size(); ++i) {
+			state[i].lastUsed = 0;
+			state[i].resident = false;
+		}
+		bbox = header.bbox;
+		tris = header.tris;
+		materials.clear();
+		for (const PagedMaterial &pagedMaterial: pagedMaterials) {
+			Material material;
+			material.diffuse = pagedMaterial.diffuse;
+			material.specular = pagedMaterial.specular;
+			material.shininess = pagedMaterial.shininess;
+			materials.push_back(material);
+		}
+		{
+			std::lock_guard<std::mutex> lock(pagingMutex);
+			registry.push_back(this);
+		}
+		printf("Opened \"%s\", %u tris in %ld clusters, %.2f MB on disk, %.2f KB resident\n", filename.c_str(), tris, (long)clusters.size(), bytes / (float)SIZE_MB,
+			((top.size() * sizeof(PagedTopNode)) + (clusters.size() * (sizeof(PagedCluster) + sizeof(ClusterState)))) / 1024.0f);
+		return true;
+	}
+	void close() {
+		std::lock_guard<std::mutex> lock(pagingMutex);
+		if (state) {
+			for (size_t i = 0; i < clusters.size(); ++i) {
+				if (state[i].resident) {
+					residentBytes -= clusters[i].bytes;
+				}
+			}
+			delete[] state;
+			state = nullptr;
+			registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+		}
+		if (mapping) {
+			munmap((void *)mapping, bytes);
+			mapping = nullptr;
+		}
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	/* closest hit or occlusion test, clusters nearest first through the top level
+	closest hits set the surface color straight away, paged tris have no Tri for Model::surface to look up */
+	template <int QUERY>
+	float trace(Ray &ray, float targetDepth = RAY_MISS) {
+		struct Pending {
+			int node;
+			float depth;
+		} stack[PAGING_STACK_SIZE];
+		int pending = 0;
+		float rootDepth = top[0].bbox.rayCast(ray);
+		if (rootDepth == RAY_MISS) {
+			return RAY_MISS;
+		}
+		stack[pending++] = {0, rootDepth};
+
+		float depth = targetDepth;
+		const PagedTri *hit = nullptr;
+		while (pending > 0) {
+			Pending next = stack[--pending];
+			// nothing in the node can be nearer than what was already hit, or than the end of an occlusion ray
+			if (depth < next.depth) {
+				continue;
+			}
+			const PagedTopNode &node = top[next.node];
+			if (node.cluster >= 0) {
+				touch(node.cluster);
+				const PagedCluster &cluster = clusters[node.cluster];
+				const uint8_t *base = mapping + cluster.offset;
+				float clusterDepth = traverse<QUERY>((const PagedNode *)base, (const uint32_t *)(base + leafTrisOffset(cluster)), (const PagedTri *)(base + trisOffset(cluster)), 0, ray, targetDepth, hit);
+				if (clusterDepth < depth) {
+					depth = clusterDepth;
+					if constexpr (QUERY == QUERY_OCCLUSION) {
+						if (!geqMargin(depth, targetDepth)) {
+							return depth;
+						}
+					}
+				}
+				continue;
+			}
+			// nearer child on top of the stack
+			float childDepth[2];
+			for (int i = 0; i < 2; ++i) {
+				childDepth[i] = top[node.children[i]].bbox.rayCast(ray);
+			}
+			int nearer = childDepth[1] < childDepth[0] ? 1 : 0;
+			for (int i: {1 - nearer, nearer}) {
+				if (childDepth[i] != RAY_MISS && pending < PAGING_STACK_SIZE) {
+					stack[pending++] = {node.children[i], childDepth[i]};
+				}
+			}
+		}
+		if (QUERY == QUERY_CLOSEST && hit) {
+			ray.meshInfo.diffuse = materials[hit->material].diffuse;
+		}
+		return depth;
+	}
+	// packets have no frustum traversal of their own here, each unoccluded ray is tested on its own
+	void occludePacket(ShadowPacket &packet) {
+		for (size_t i = 0; i < packet.size() && packet.active > 0; ++i) {
+			if (!packet.occluded[i]) {
+				Ray ray = packet.rays[i];
+				float depth = trace<QUERY_OCCLUSION>(ray, packet.lengths[i]);
+				if (depth != RAY_MISS && !geqMargin(depth, packet.lengths[i])) {
+					packet.occluded[i] = true;
+					--packet.active;
+				}
+			}
+		}
+	}
+
+	// bytes of the cluster file, resident or not
+	inline size_t fileSize() const {
+		return bytes;
+	}
+	inline size_t clusterCount() const {
+		return clusters.size();
+	}
+	static inline long memory() {
+		return residentBytes.load(std::memory_order_relaxed);
+	}
+	static inline long budget() {
+		return memoryBudget;
+	}
+	// takes effect at the next page in
+	static void setBudget(long bytes) {
+		std::lock_guard<std::mutex> lock(pagingMutex);
+		memoryBudget = bytes;
+	}
+	// call once per frame from the thread driving the frame loop, keeps this frame's page in counts for reporting
+	static void endFrame() {
+		lastFramePageIns = framePageIns.exchange(0);
+		lastFramePageInBytes = framePageInBytes.exchange(0);
+		totalPageIns += lastFramePageIns;
+		std::lock_guard<std::mutex> lock(pagingMutex);
+		frameStart = touches.load(std::memory_order_relaxed);
+	}
+	static inline bool active() {
+		return registry.size() > 0;
+	}
+};
+
+#endif
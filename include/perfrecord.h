@@ -0,0 +1,223 @@
+#ifndef PERF_RECORD
+#define PERF_RECORD
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "common.h"
+
+// Performance records
+// frames rendered before any sample is kept, the ray cache fills and the first frame pays for page faults
+#define PERF_WARMUP_FRAMES 2
+// smallest relative change reported as a regression or improvement, covers what varies between runs but not within one
+#define PERF_MIN_CHANGE 0.05
+// a change must also be this many times the combined noise of both values
+#define PERF_NOISE_SIGMAS 3
+// written to and expected in every record, bump it when the layout changes
+#define PERF_RECORD_VERSION 1
+// a change beyond the thresholds is a regression, an improvement, or neither
+enum PERF_CHANGE{PERF_CHANGE_NONE, PERF_CHANGE_IMPROVED, PERF_CHANGE_REGRESSED};
+
+// one measured quantity, value with its standard error(0 if exact) over the samples it came from
+struct PerfMetric {
+	std::string name, unit;
+	bool higherBetter;
+	double value, noise;
+	int samples;
+};
+
+/* Results of one performance run, with what it ran on so only like runs are compared
+written as JSON with one metric per line, read back by the same layout rather than any JSON, see perfcompare.cpp */
+class PerfRecord {
+private:
+	static inline double percentile(const std::vector<double> &sorted, int percent) {
+		size_t count = sorted.size();
+		return sorted[std::min(count - 1, (count * percent) / 100)];
+	}
+	/* standard error of a percentile, taken from the samples themselves so a few stalled frames don't swamp it
+	half the spread of the samples a binomial standard deviation of ranks either side of the percentile's
+	a tail with too few frames beyond it to say that much is as uncertain as its distance from the median */
+	static double percentileNoise(const std::vector<double> &sorted, int percent) {
+		size_t count = sorted.size();
+		size_t index = std::min(count - 1, (count * percent) / 100);
+		size_t ranks = std::max((size_t)std::ceil(std::sqrt(count * (percent / 100.0) * (1 - (percent / 100.0)))), (size_t)1);
+		if (index + ranks >= count) {
+			return std::fabs(sorted[index] - percentile(sorted, 50));
+		}
+		return (sorted[index + ranks] - sorted[index >= ranks ? index - ranks : 0]) / 2;
+	}
+public:
+	std::string scene, host, build;
+	int width, height, threads, frames;
+	long time;
+	std::vector<PerfMetric> metrics;
+
+	PerfRecord () : width(0), height(0), threads(0), frames(0), time(0) {}
+	PerfRecord (const std::string &scene, int width, int height, int threads) : scene(scene), build(__VERSION__),
+		width(width), height(height), threads(threads), frames(0), time(std::time(nullptr)) {
+		char name[256] = "";
+		gethostname(name, sizeof(name) - 1);
+		host = name;
+	}
+
+	void add(const std::string &name, const std::string &unit, bool higherBetter, double value, double noise = 0, int samples = 1) {
+		metrics.push_back({name, unit, higherBetter, value, noise, samples});
+	}
+	// median of per frame samples, 0 from no samples so the metric is still in the record
+	void addMedian(const std::string &name, const std::string &unit, bool higherBetter, std::vector<double> samples) {
+		if (samples.empty()) {
+			add(name, unit, higherBetter, 0, 0, 0);
+			return;
+		}
+		std::sort(samples.begin(), samples.end());
+		add(name, unit, higherBetter, percentile(samples, 50), percentileNoise(samples, 50), samples.size());
+	}
+	// p50, p90 and p99 of per frame samples, lower is better, the tails rest on fewer frames so they come out noisier
+	void addPercentiles(const std::string &name, const std::string &unit, std::vector<double> samples) {
+		std::sort(samples.begin(), samples.end());
+		int percents[] = {50, 90, 99};
+		for (int percent: percents) {
+			if (samples.empty()) {
+				add(name + "_p" + std::to_string(percent), unit, false, 0, 0, 0);
+			} else {
+				add(name + "_p" + std::to_string(percent), unit, false, percentile(samples, percent), percentileNoise(samples, percent), samples.size());
+			}
+		}
+	}
+	// peak resident memory of this process so far, in MB
+	static double peakMemory() {
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) {
+			return 0;
+		}
+		// kilobytes on Linux
+		return usage.ru_maxrss / 1024.0;
+	}
+	const PerfMetric *find(const std::string &name) const {
+		for (const PerfMetric &metric: metrics) {
+			if (metric.name == name) {
+				return &metric;
+			}
+		}
+		return nullptr;
+	}
+
+	bool write(const char *filename) const {
+		FILE *file = fopen(filename, "w");
+		if (!file) {
+			printf("Could not open \"%s\"\n", filename);
+			return false;
+		}
+		fprintf(file, "{\n");
+		fprintf(file, "\t\"version\": %d,\n", PERF_RECORD_VERSION);
+		fprintf(file, "\t\"scene\": \"%s\",\n", scene.c_str());
+		fprintf(file, "\t\"host\": \"%s\",\n", host.c_str());
+		fprintf(file, "\t\"build\": \"%s\",\n", build.c_str());
+		fprintf(file, "\t\"time\": %ld,\n", time);
+		fprintf(file, "\t\"width\": %d,\n", width);
+		fprintf(file, "\t\"height\": %d,\n", height);
+		fprintf(file, "\t\"threads\": %d,\n", threads);
+		fprintf(file, "\t\"frames\": %d,\n", frames);
+		fprintf(file, "\t\"metrics\": [\n");
+		for (size_t i = 0; i < metrics.size(); ++i) {
+			const PerfMetric &metric = metrics[i];
+			fprintf(file, "\t\t{\"name\": \"%s\", \"unit\": \"%s\", \"better\": \"%s\", \"value\": %.9g, \"noise\": %.9g, \"samples\": %d}%s\n", metric.name.c_str(),
+				metric.unit.c_str(), metric.higherBetter ? "higher" : "lower", metric.value, metric.noise, metric.samples, i + 1 < metrics.size() ? "," : "");
+		}
+		fprintf(file, "\t]\n}\n");
+		fclose(file);
+		return true;
+	}
+	// reads a record written by write, false if it can't be opened or isn't one
+	bool read(const char *filename) {
+		FILE *file = fopen(filename, "r");
+		if (!file) {
+			printf("Could not open \"%s\"\n", filename);
+			return false;
+		}
+		int version = 0;
+		metrics.clear();
+		char line[1024], text[256];
+		while (fgets(line, sizeof(line), file)) {
+			PerfMetric metric;
+			char name[128], unit[64], better[16];
+			if (sscanf(line, " {\"name\": \"%127[^\"]\", \"unit\": \"%63[^\"]\", \"better\": \"%15[^\"]\", \"value\": %lf, \"noise\": %lf, \"samples\": %d}",
+				name, unit, better, &metric.value, &metric.noise, &metric.samples) == 6) {
+				metric.name = name;
+				metric.unit = unit;
+				metric.higherBetter = strcmp(better, "higher") == 0;
+				metrics.push_back(metric);
+			} else if (sscanf(line, " \"scene\": \"%255[^\"]\"", text) == 1) {
+				scene = text;
+			} else if (sscanf(line, " \"host\": \"%255[^\"]\"", text) == 1) {
+				host = text;
+			} else if (sscanf(line, " \"build\": \"%255[^\"]\"", text) == 1) {
+				build = text;
+			} else {
+				sscanf(line, " \"version\": %d", &version);
+				sscanf(line, " \"time\": %ld", &time);
+				sscanf(line, " \"width\": %d", &width);
+				sscanf(line, " \"height\": %d", &height);
+				sscanf(line, " \"threads\": %d", &threads);
+				sscanf(line, " \"frames\": %d", &frames);
+			}
+		}
+		fclose(file);
+		if (version != PERF_RECORD_VERSION) {
+			printf("\"%s\" is not a version %d performance record\n", filename, PERF_RECORD_VERSION);
+			return false;
+		}
+		return true;
+	}
+
+	/* how test changed from base, relative change is positive when worse
+	significant only past both minChange and sigmas times the noise of the two values together */
+	static int change(const PerfMetric &base, const PerfMetric &test, double minChange, double sigmas, double &relative) {
+		double difference = base.higherBetter ? base.value - test.value : test.value - base.value;
+		relative = base.value != 0 ? difference / std::fabs(base.value) : 0;
+		double noise = std::sqrt((base.noise * base.noise) + (test.noise * test.noise));
+		if (std::fabs(relative) <= minChange || std::fabs(difference) <= sigmas * noise) {
+			return PERF_CHANGE_NONE;
+		}
+		return difference > 0 ? PERF_CHANGE_REGRESSED : PERF_CHANGE_IMPROVED;
+	}
+	/* prints every metric of base next to test, returns the number of significant regressions
+	a metric base measured that test lost, or has no samples for, counts as one, as whatever stopped measuring it may have broken it */
+	static int compare(const PerfRecord &base, const PerfRecord &test, double minChange = PERF_MIN_CHANGE, double sigmas = PERF_NOISE_SIGMAS) {
+		const char *labels[] = {"", "improved", "REGRESSED"};
+		int regressions = 0;
+		printf("%-24s %14s %14s %9s %10s  %s\n", "metric", "base", "test", "change", "threshold", "");
+		for (const PerfMetric &baseMetric: base.metrics) {
+			const PerfMetric *testMetric = test.find(baseMetric.name);
+			if (!testMetric || (testMetric->samples == 0 && baseMetric.samples > 0)) {
+				printf("%-24s %14.4g %14s %9s %10s  %s\n", baseMetric.name.c_str(), baseMetric.value, testMetric ? "no samples" : "missing", "", "", labels[PERF_CHANGE_REGRESSED]);
+				++regressions;
+				continue;
+			}
+			double relative;
+			int result = change(baseMetric, *testMetric, minChange, sigmas, relative);
+			regressions += result == PERF_CHANGE_REGRESSED;
+			double noise = std::sqrt((baseMetric.noise * baseMetric.noise) + (testMetric->noise * testMetric->noise));
+			double threshold = std::max(minChange, baseMetric.value != 0 ? sigmas * noise / std::fabs(baseMetric.value) : 0);
+			// shown as a change for the better or worse, so the sign reads the same for every metric
+			printf("%-24s %14.4g %14.4g %+8.1f%% %9.1f%%  %s\n", baseMetric.name.c_str(), baseMetric.value, testMetric->value, -100 * relative,
+				100 * threshold, labels[result]);
+		}
+		for (const PerfMetric &testMetric: test.metrics) {
+			if (!base.find(testMetric.name)) {
+				printf("%-24s %14s %14.4g\n", testMetric.name.c_str(), "new", testMetric.value);
+			}
+		}
+		return regressions;
+	}
+};
+
+#endif
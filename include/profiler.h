@@ -0,0 +1,205 @@
+#ifndef PROFILER
+#define PROFILER
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+// Frame profiler
+// zones each thread keeps, older ones are overwritten, must be a power of 2
+#define PROFILER_RING_SIZE 65536
+#define PROFILER_RING_MASK (PROFILER_RING_SIZE - 1)
+// frames captured by a capture started without an explicit range
+#define PROFILER_CAPTURE_FRAMES 60
+#define PROFILER_THREAD_NAME 32
+
+// one finished zone
+struct ProfileEvent {
+	const char *name;
+	uint64_t start, end;
+	uint32_t frame;
+	// zone specific value, ie: a row or tile index, -1 for none
+	int32_t arg;
+};
+
+// zones recorded by one thread, only that thread writes, the capture reads once the frames it wants are over
+struct ProfileRing {
+	ProfileEvent events[PROFILER_RING_SIZE];
+	std::atomic<uint64_t> head;
+	int tid;
+	char name[PROFILER_THREAD_NAME];
+	ProfileRing (int tid) : head(0), tid(tid) {
+		snprintf(name, sizeof(name), "thread %d", tid);
+	}
+};
+
+/* Scoped zones recorded into per thread rings, written out as Chrome trace events(chrome://tracing, Perfetto)
+nothing is recorded outside a capture, a zone then costs one relaxed load */
+class Profiler {
+private:
+	static inline std::atomic<bool> recording{false};
+	static inline std::atomic<uint32_t> frame{0};
+	static inline uint32_t firstFrame = 0, lastFrame = 0;
+	static inline bool armed = false;
+	static inline std::string filename;
+	static inline std::vector<ProfileRing *> rings;
+	static inline std::mutex ringsMutex;
+	static inline thread_local ProfileRing *ring = nullptr;
+
+	static ProfileRing *localRing() {
+		if (!ring) {
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			ring = new ProfileRing(rings.size());
+			rings.push_back(ring);
+		}
+		return ring;
+	}
+	static void writeTrace() {
+		FILE *file = fopen(filename.c_str(), "w");
+		if (!file) {
+			printf("Profiler: could not open \"%s\"\n", filename.c_str());
+			return;
+		}
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		long written = 0, overwritten = 0;
+		// timestamps are relative to the earliest zone so they stay precise as doubles
+		uint64_t origin = UINT64_MAX;
+		for (const ProfileRing *threadRing: rings) {
+			uint64_t head = threadRing->head.load(std::memory_order_acquire);
+			for (uint64_t i = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0; i < head; ++i) {
+				const ProfileEvent &event = threadRing->events[i & PROFILER_RING_MASK];
+				if (event.frame >= firstFrame && event.frame <= lastFrame) {
+					origin = std::min(origin, event.start);
+				}
+			}
+		}
+
+		fprintf(file, "{\"traceEvents\":[\n");
+		bool first = true;
+		for (const ProfileRing *threadRing: rings) {
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", threadRing->tid, threadRing->name);
+			first = false;
+			uint64_t head = threadRing->head.load(std::memory_order_acquire);
+			uint64_t tail = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+			// the ring wrapped while the range was still being recorded
+			if (tail > 0 && threadRing->events[tail & PROFILER_RING_MASK].frame >= firstFrame) {
+				overwritten += tail;
+			}
+			for (uint64_t i = tail; i < head; ++i) {
+				const ProfileEvent &event = threadRing->events[i & PROFILER_RING_MASK];
+				if (event.frame < firstFrame || event.frame > lastFrame) {
+					continue;
+				}
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u", event.name, threadRing->tid,
+					(event.start - origin) / 1000.0, (event.end - event.start) / 1000.0, event.frame);
+				if (event.arg >= 0) {
+					fprintf(file, ",\"arg\":%d", event.arg);
+				}
+				fprintf(file, "}}");
+				++written;
+			}
+		}
+		fprintf(file, "\n]}\n");
+		fclose(file);
+		printf("Profiler: wrote %ld zones of frames %u-%u to \"%s\"", written, firstFrame, lastFrame, filename.c_str());
+		if (overwritten > 0) {
+			printf(", %ld older zones were overwritten, raise PROFILER_RING_SIZE for longer captures", overwritten);
+		}
+		printf("\n");
+	}
+public:
+	static inline uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static inline bool active() {
+		return recording.load(std::memory_order_relaxed);
+	}
+	static inline uint32_t currentFrame() {
+		return frame.load(std::memory_order_relaxed);
+	}
+	static inline void record(const char *name, uint64_t start, uint64_t end, int32_t arg) {
+		ProfileRing *threadRing = localRing();
+		uint64_t head = threadRing->head.load(std::memory_order_relaxed);
+		threadRing->events[head & PROFILER_RING_MASK] = {name, start, end, frame.load(std::memory_order_relaxed), arg};
+		threadRing->head.store(head + 1, std::memory_order_release);
+	}
+	// name shown for the calling thread's track
+	static void nameThread(const char *name) {
+		snprintf(localRing()->name, PROFILER_THREAD_NAME, "%s", name);
+	}
+	// records frames first to last inclusive and writes them to file once last ends, frames already started are recorded from now
+	static void capture(uint32_t first, uint32_t last, const std::string &file) {
+		firstFrame = first;
+		lastFrame = std::max(first, last);
+		filename = file;
+		armed = true;
+		recording = currentFrame() >= firstFrame;
+	}
+	static inline bool capturing() {
+		return armed;
+	}
+	/* call once per frame from the thread driving the frame loop, with no zones open on other threads
+	starts and stops recording at the ends of the captured range */
+	static void endFrame() {
+		uint32_t ended = frame.fetch_add(1);
+		if (!armed) {
+			return;
+		}
+		if (ended >= lastFrame) {
+			recording = false;
+			armed = false;
+			writeTrace();
+		} else if (ended + 1 >= firstFrame) {
+			recording = true;
+		}
+	}
+};
+
+#ifndef PROFILER_DISABLED
+// records the enclosing scope as one zone
+class ProfileZone {
+private:
+	const char *name;
+	uint64_t start;
+	int32_t arg;
+public:
+	ProfileZone (const char *name, int32_t arg = -1) : name(name), start(0), arg(arg) {
+		if (Profiler::active()) {
+			start = Profiler::now();
+		}
+	}
+	~ProfileZone () {
+		end();
+	}
+	// closes the zone before the end of its scope
+	inline void end() {
+		if (start != 0) {
+			Profiler::record(name, start, Profiler::now(), arg);
+			start = 0;
+		}
+	}
+};
+#else
+// compiled out, zones built directly cost nothing either
+class ProfileZone {
+public:
+	ProfileZone (const char *, int32_t = -1) {}
+	inline void end() {}
+};
+#endif
+
+#define PROFILE_CONCAT_INNER(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_INNER(a,b)
+#ifndef PROFILER_DISABLED
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_ZONE_ARG(name,arg) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name, arg)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_ZONE_ARG(name,arg)
+#endif
+
+#endif
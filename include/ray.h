@@ -7,7 +7,7 @@
 class MeshInfo {
 public:
 	Vec3 normal, diffuse;
-	MeshInfo () {}
+	MeshInfo () : normal(0, 0, 0), diffuse(0, 0, 0) {}
 };
 
 class Tri;
@@ -32,6 +32,31 @@ public:
 		this->dir = Vec3::normalize(dir);
 		calcInverse();
 	}
+	// dir must already be normalized
+	static inline Ray unit(const Vec3 &origin, const Vec3 &dir) {
+		Ray ray;
+		ray.origin = origin;
+		ray.dir = dir;
+		ray.calcInverse();
+		ray.depth = RAY_MISS;
+		return ray;
+	}
+	/* copy of the ray's positional part and the nearest depth found so far, for testing one instance
+	the surface data of earlier hits isn't copied, setHit takes back only what the instance test found */
+	static inline Ray probe(const Ray &ray) {
+		Ray probe;
+		probe.origin = ray.origin;
+		probe.dir = ray.dir;
+		probe.dir_inverse = ray.dir_inverse;
+		probe.depth = ray.depth;
+		return probe;
+	}
+	// takes the hit a probe found, the diffuse color is only looked up for the closest hit of all
+	static inline void setHit(Ray &ray, const Ray &probe) {
+		ray.meshInfo.normal = probe.meshInfo.normal;
+		ray.tri = probe.tri;
+		ray.depth = probe.depth;
+	}
 	static inline void setNonPos(Ray &ray, const Ray &source){
 		// sets non positional parameters of ray from source
 		// Useful when the output of a locally transformed ray needs to be passed on
@@ -0,0 +1,322 @@
+#ifndef RENDER_SERVICE
+#define RENDER_SERVICE
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#include "common.h"
+#include "vec3.h"
+#include "model.h"
+#include "scene.h"
+#include "paging.h"
+#include "profiler.h"
+
+// Render service
+// rows of a request traced per task, small so an urgent request never waits long for a thread
+#define SERVICE_TASK_ROWS 8
+// requests completed after which no new task starts until the pool drains, so the per frame caches still get their endFrame under constant load
+#define SERVICE_DRAIN_REQUESTS 16
+// deadline of a request that has none
+#define SERVICE_NO_DEADLINE 0
+// completed requests kept for latency percentiles, older ones are dropped so a long running service doesn't grow
+#define SERVICE_RESULTS_KEPT 4096
+
+// a camera registered with the service, rendering one of its scenes
+struct ServiceView {
+	std::string name;
+	int scene;
+	Vec3 pos;
+	int width, height;
+	// every request of the view completed so far, and those past their deadline
+	long completed, missed;
+};
+
+// how one request went, ms from submitting it
+struct ServiceResult {
+	long request;
+	int view, priority;
+	// until its first task started, until its last task finished, and the deadline it was given
+	double queueMs, latencyMs, deadlineMs;
+	bool missed;
+};
+
+/* Renders frame requests for any number of views of any number of scenes on one shared pool of threads
+scenes are registered by pointer and every request renders through the same Model objects, only instance and light
+pointers are copied per request, so geometry and acceleration structures are never duplicated per view
+requests are split into row tasks, and each free thread takes a task from the highest priority request, earliest deadline first */
+class RenderService {
+private:
+	typedef std::chrono::steady_clock Clock;
+	struct Request {
+		long id;
+		int view, priority;
+		// the view as it was when submitted, with its own instance bins
+		Camera camera;
+		uint32_t *pixels;
+		Clock::time_point submitted, deadline, started;
+		// next row to hand out, rows not yet finished
+		int nextRow, rowsLeft;
+		double deadlineMs;
+	};
+	std::vector<const Scene *> scenes;
+	std::vector<Request *> active;
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable work, finished;
+	bool stopping, draining;
+	int inFlight, sinceEndFrame;
+	long nextId;
+	Clock::time_point start;
+
+	static inline double millis(Clock::time_point from, Clock::time_point to) {
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+	// the request the next task comes from, nullptr if every request's rows are handed out
+	Request *pick() const {
+		Request *best = nullptr;
+		for (Request *request: active) {
+			if (request->nextRow >= request->camera.height) {
+				continue;
+			}
+			if (!best || request->priority > best->priority || (request->priority == best->priority &&
+				(request->deadline < best->deadline || (request->deadline == best->deadline && request->id < best->id)))) {
+				best = request;
+			}
+		}
+		return best;
+	}
+	// called with the lock held
+	void complete(Request *request, Clock::time_point now) {
+		ServiceResult result;
+		result.request = request->id;
+		result.view = request->view;
+		result.priority = request->priority;
+		result.queueMs = millis(request->submitted, request->started);
+		result.latencyMs = millis(request->submitted, now);
+		result.deadlineMs = request->deadlineMs;
+		result.missed = now > request->deadline;
+		results.push_back(result);
+		if (results.size() > SERVICE_RESULTS_KEPT) {
+			results.pop_front();
+		}
+		++views[result.view].completed;
+		views[result.view].missed += result.missed;
+		active.erase(std::find(active.begin(), active.end(), request));
+		delete request;
+		++requests;
+		if (++sinceEndFrame >= SERVICE_DRAIN_REQUESTS) {
+			draining = true;
+		}
+		finished.notify_all();
+	}
+	void run(int index) {
+		char name[32];
+		snprintf(name, sizeof(name), "service %d", index);
+		Profiler::nameThread(name);
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			work.wait(lock, [this]() {
+				return stopping || (!draining && pick());
+			});
+			if (stopping) {
+				return;
+			}
+			Request *request = pick();
+			int firstRow = request->nextRow;
+			int rows = std::min(SERVICE_TASK_ROWS, request->camera.height - firstRow);
+			request->nextRow += rows;
+			Clock::time_point taskStart = Clock::now();
+			if (firstRow == 0) {
+				request->started = taskStart;
+			}
+			++inFlight;
+			lock.unlock();
+
+			{
+				PROFILE_ZONE_ARG("Service task", request->view);
+				const Camera &camera = request->camera;
+				for (int y = firstRow; y < firstRow + rows; ++y) {
+					for (int x = 0; x < camera.width; ++x) {
+						request->pixels[ARRAY_INDEX(x, y, camera.width)] = camera.renderPixel(x, y);
+					}
+				}
+			}
+
+			lock.lock();
+			Clock::time_point now = Clock::now();
+			--inFlight;
+			++tasks;
+			pixels += (long)rows * request->camera.width;
+			busyMicros += std::chrono::duration_cast<std::chrono::microseconds>(now - taskStart).count();
+			request->rowsLeft -= rows;
+			if (request->rowsLeft == 0) {
+				complete(request, now);
+			}
+			// nothing is tracing, the per frame caches can move on
+			if (inFlight == 0 && (draining || !pick())) {
+				ModelRayCache::endFrame();
+				PagedGeometry::endFrame();
+				Profiler::endFrame();
+				++frames;
+				sinceEndFrame = 0;
+				draining = false;
+				work.notify_all();
+			}
+		}
+	}
+public:
+	std::vector<ServiceView> views;
+	// the last SERVICE_RESULTS_KEPT completed requests in completion order, see takeResults
+	std::deque<ServiceResult> results;
+	long requests, tasks, pixels, busyMicros;
+	// times the pool drained and the caches' endFrame ran
+	long frames;
+
+	RenderService (int threadCount = std::thread::hardware_concurrency()) : stopping(false), draining(false), inFlight(0), sinceEndFrame(0), nextId(0), start(Clock::now()),
+		requests(0), tasks(0), pixels(0), busyMicros(0), frames(0) {
+		for (int i = 0; i < std::max(threadCount, 1); ++i) {
+			threads.emplace_back(&RenderService::run, this, i);
+		}
+	}
+	RenderService (const RenderService &) = delete;
+	RenderService &operator=(const RenderService &) = delete;
+	// finishes every submitted request first
+	~RenderService () {
+		waitIdle();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work.notify_all();
+		for (std::thread &thread: threads) {
+			thread.join();
+		}
+	}
+	inline int threadCount() const {
+		return threads.size();
+	}
+	// the scene isn't copied and must outlive the service, change it only while no request is outstanding(see waitIdle)
+	int addScene(const Scene *scene) {
+		std::lock_guard<std::mutex> lock(mutex);
+		scenes.push_back(scene);
+		return scenes.size() - 1;
+	}
+	// -1 for a scene that wasn't added or an empty view, whose requests would have no rows to complete them
+	int addView(const std::string &name, int scene, const Vec3 &pos, int width, int height) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (scene < 0 || scene >= (int)scenes.size() || width <= 0 || height <= 0) {
+			return -1;
+		}
+		views.push_back({name, scene, pos, width, height, 0, 0});
+		return views.size() - 1;
+	}
+	// moves a view, requests already submitted keep the position they were submitted with
+	void moveView(int view, const Vec3 &pos) {
+		std::lock_guard<std::mutex> lock(mutex);
+		views[view].pos = pos;
+	}
+	/* queues a frame of the view, pixels gets width * height RGBX8888 pixels and must stay valid until the request completes
+	higher priorities go first, then earlier deadlines, deadlineMs counts from now, SERVICE_NO_DEADLINE for none
+	returns -1 without queueing anything if the view wasn't added */
+	long submit(int view, uint32_t *pixels, int priority = 0, double deadlineMs = SERVICE_NO_DEADLINE) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (view < 0 || view >= (int)views.size()) {
+				return -1;
+			}
+		}
+		Request *request = new Request();
+		request->submitted = Clock::now();
+		request->deadlineMs = deadlineMs;
+		request->deadline = deadlineMs > 0 ? request->submitted + std::chrono::microseconds((long)(deadlineMs * 1000)) : Clock::time_point::max();
+		request->view = view;
+		request->priority = priority;
+		request->pixels = pixels;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const ServiceView &serviceView = views[view];
+			request->camera = Camera(serviceView.pos, serviceView.width, serviceView.height);
+			request->camera.scene = *scenes[serviceView.scene];
+		}
+		request->nextRow = 0;
+		request->rowsLeft = request->camera.height;
+		// binned by the submitting thread, so a request's bins match the scene as it was when submitted
+		request->camera.binInstances();
+		// a worker may finish and free the request as soon as it's queued
+		long id;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			id = request->id = nextId++;
+			active.push_back(request);
+		}
+		work.notify_all();
+		return id;
+	}
+	// blocks until the request has completed
+	void wait(long id) {
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this, id]() {
+			return std::none_of(active.begin(), active.end(), [id](const Request *request) {
+				return request->id == id;
+			});
+		});
+	}
+	// blocks until every submitted request has completed, scenes may be changed after
+	void waitIdle() {
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this]() {
+			return active.empty() && inFlight == 0;
+		});
+	}
+	// hands over the kept results, printStats then only has the view totals for them
+	std::vector<ServiceResult> takeResults() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<ServiceResult> taken(results.begin(), results.end());
+		results.clear();
+		return taken;
+	}
+	/* latency per view over the kept results, request and missed deadline totals and throughput of the whole pool
+	busy throughput is per thread while tracing, wall throughput is everything rendered over the service's lifetime */
+	void printStats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		double seconds = millis(start, Clock::now()) / 1000;
+		printf("%-12s %8s %8s %10s %10s %10s %10s %8s\n", "view", "priority", "requests", "queue ms", "median ms", "p95 ms", "max ms", "missed");
+		for (size_t view = 0; view < views.size(); ++view) {
+			const ServiceView &serviceView = views[view];
+			std::vector<double> latencies, queues;
+			int priority = 0;
+			for (const ServiceResult &result: results) {
+				if (result.view == (int)view) {
+					latencies.push_back(result.latencyMs);
+					queues.push_back(result.queueMs);
+					priority = result.priority;
+				}
+			}
+			if (latencies.empty()) {
+				if (serviceView.completed > 0) {
+					printf("%-12s %8s %8ld %10s %10s %10s %10s %8ld\n", serviceView.name.c_str(), "", serviceView.completed, "", "", "", "", serviceView.missed);
+				}
+				continue;
+			}
+			std::sort(latencies.begin(), latencies.end());
+			std::sort(queues.begin(), queues.end());
+			size_t count = latencies.size();
+			printf("%-12s %8d %8ld %10.2f %10.2f %10.2f %10.2f %8ld\n", serviceView.name.c_str(), priority, serviceView.completed, queues[count / 2],
+				latencies[count / 2], latencies[std::min(count - 1, (count * 95) / 100)], latencies.back(), serviceView.missed);
+		}
+		printf("%ld requests, %ld tasks on %d threads in %.3fs, %.2f requests/s, %.2f Mpix/s wall, %.2f Mpix/s per busy thread, %.0f%% busy\n",
+			requests, tasks, threadCount(), seconds, seconds > 0 ? requests / seconds : 0, seconds > 0 ? pixels / seconds / 1000000.0 : 0,
+			busyMicros > 0 ? pixels / (double)busyMicros : 0, seconds > 0 ? 100 * busyMicros / (seconds * 1000000.0 * threadCount()) : 0);
+		printf("\tcaches ended %ld frames, ray cache %.2f MB\n", frames, ModelRayCache::totalMemory() / (float)SIZE_MB);
+	}
+};
+
+#endif
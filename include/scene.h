@@ -3,44 +3,159 @@
 
 #include <vector>
 #include <limits>
+#include <algorithm>
 
 #include "common.h"
 #include "vec3.h"
 #include "ray.h"
 #include "model.h"
 #include "light.h"
+#include "accumulator.h"
+#include "packet.h"
 
 // Scene
 #define AMBIENT_LIGHT 0
+#define BACKGROUND_COLOR Vec3(0x1F / 255.0, 0x1F / 255.0, 0x1F / 255.0)
+// fraction of a surface's color taken from its mirror reflection
+#define SCENE_REFLECTIVITY 0
+#define SCENE_MAX_BOUNCES 2
+// reflected rays start this far off the surface so they don't hit it again
+#define REFLECT_OFFSET 0.1
+
+// instance binned to a screen tile, near is the depth along a primary ray before which it can't be hit
+struct BinEntry {
+	int instance;
+	float near;
+};
+// instances binned to one screen tile, nearest first
+struct BinRange {
+	const BinEntry *begin, *end;
+};
+
+// what a primary sample saw, for finding the pixels adaptive anti-aliasing refines
+struct SampleInfo {
+	// hit tri, nullptr on a miss or for models that don't keep tris(paged)
+	const Tri *tri;
+	Vec3 normal;
+	// index of the instance hit, -1 on a miss
+	int instance;
+	float depth;
+	// bit per light(the first 32), set if the light was blocked
+	uint32_t shadowed;
+	// rays traced for the sample, shadow rays and bounces included
+	int rays;
+	SampleInfo () : tri(nullptr), instance(-1), depth(RAY_MISS), shadowed(0), rays(0) {}
+};
+
 class Scene {
 public:
 	std::vector<ModelInstance *> models;
 	std::vector<Light *> lights;
 	float ambientLight;
+	float reflectivity;
+	int maxBounces;
 
-	Scene () : ambientLight(AMBIENT_LIGHT) {}
+	Scene () : ambientLight(AMBIENT_LIGHT), reflectivity(SCENE_REFLECTIVITY), maxBounces(SCENE_MAX_BOUNCES) {}
 	void addModel(ModelInstance *model) {
 		models.push_back(model);
 	}
 	void addLight(Light *light) {
 		lights.push_back(light);
 	}
-	float rayCast(Ray &ray, float targetDepth = RAY_MISS, bool shadowRay = false) const {
+	/* closest hit or occlusion test of every instance through each model's specialized kernels
+	instance is set to the index of the closest model hit, if given */
+	template <int QUERY>
+	float trace(Ray &ray, float targetDepth = RAY_MISS, int *instance = nullptr) const {
 		float depth = targetDepth;
-		for (ModelInstance *model: models) {
-			float newDepth = model->rayCast(ray, targetDepth, shadowRay);
+		int closest = -1;
+		for (size_t i = 0; i < models.size(); ++i) {
+			float newDepth = models[i]->trace<QUERY>(ray, targetDepth);
+			if (newDepth < depth) {
+				depth = newDepth;
+				if constexpr (QUERY == QUERY_OCCLUSION) {
+					if (!geqMargin(depth, targetDepth)) {
+						return depth;
+					}
+				} else {
+					closest = i;
+				}
+			}
+		}
+		// the surface is only looked up once, for the hit that won
+		if (QUERY == QUERY_CLOSEST && closest >= 0) {
+			models[closest]->surface(ray, depth);
+			if (instance) {
+				*instance = closest;
+			}
+		}
+		return depth;
+	}
+	/* closest hit of a primary ray among the instances binned to its tile, same result as trace<QUERY_CLOSEST>
+	instances are nearest first so once a hit is closer than the next one's near depth the rest can't beat it */
+	float traceBinned(Ray &ray, const BinRange &bin, int *instance = nullptr) const {
+		float depth = RAY_MISS;
+		int closest = -1;
+		for (const BinEntry *entry = bin.begin; entry != bin.end && entry->near <= depth; ++entry) {
+			float newDepth = models[entry->instance]->trace<QUERY_CLOSEST>(ray);
+			if (newDepth < depth || (newDepth == depth && newDepth != RAY_MISS && entry->instance < closest)) {
+				depth = newDepth;
+				closest = entry->instance;
+			}
+		}
+		if (closest >= 0) {
+			models[closest]->surface(ray, depth);
+			if (instance) {
+				*instance = closest;
+			}
+		}
+		return depth;
+	}
+	// generic path with the query chosen per call, instance is set to the index of the closest model hit, if given
+	float rayCast(Ray &ray, float targetDepth = RAY_MISS, bool shadowRay = false, int *instance = nullptr) const {
+		float depth = targetDepth;
+		int closest = -1;
+		for (size_t i = 0; i < models.size(); ++i) {
+			float newDepth = models[i]->rayCast(ray, targetDepth, shadowRay);
 			if (newDepth < depth) {
 				depth = newDepth;
+				closest = i;
 			}
-			if (shadowRay && leqMargin(depth, targetDepth)) {
+			if (shadowRay && !geqMargin(depth, targetDepth)) {
 				return depth;
 			}
 		}
+		if (!shadowRay && closest >= 0) {
+			models[closest]->surface(ray, depth);
+			if (instance) {
+				*instance = closest;
+			}
+		}
 		return depth;
 	}
-	uint32_t renderRay(Ray &ray) const {
+	// occlusion test of a whole packet of shadow rays, equivalent to rayCast with shadowRay set for each of them
+	void occludePacket(ShadowPacket &packet) const {
+		for (ModelInstance *model: models) {
+			model->occludePacket(packet);
+			if (packet.active == 0) {
+				return;
+			}
+		}
+	}
+	/* shaded color of the ray before clamping, lightOffset moves every light to soften shadows when accumulating
+	bin is the primary ray's screen tile, if the camera binned its instances, info gets what the primary ray saw, if given */
+	Vec3 shadeRay(Ray &ray, const Vec3 &lightOffset = Vec3(0, 0, 0), int bounce = 0, const BinRange *bin = nullptr, SampleInfo *info = nullptr) const {
 		// geometry raycast
-		float depth = rayCast(ray);
+		int instance = -1;
+		float depth = bin ? traceBinned(ray, *bin, &instance) : trace<QUERY_CLOSEST>(ray, RAY_MISS, &instance);
+		if (info) {
+			++info->rays;
+			if (bounce == 0) {
+				info->tri = depth != RAY_MISS ? ray.tri : nullptr;
+				info->normal = ray.meshInfo.normal;
+				info->instance = instance;
+				info->depth = depth;
+			}
+		}
 
 		// light raycast
 		if (depth != RAY_MISS) {
@@ -49,13 +164,22 @@ public:
 			float totalLum = AMBIENT_LIGHT;
 			Vec3 avgColor(ray.meshInfo.diffuse);
 
-			for (Light *light: lights) {
+			for (size_t l = 0; l < lights.size(); ++l) {
+				Light *light = lights[l];
 				if (light->shouldCastToPoint(its)) {
-					Vec3 lightVec = Vec3::sub(its, light->pos);
-					Ray lightRay(light->pos, lightVec);
+					Vec3 lightPos = Vec3::add(light->pos, lightOffset);
+					Vec3 lightVec = Vec3::sub(its, lightPos);
+					Ray lightRay(lightPos, lightVec);
 					float lightRayLen = Vec3::lengthOf(lightVec);
 
-					if ((!light->shadowCast || eqMargin(rayCast(lightRay, lightRayLen, true), lightRayLen))) {
+					bool lit = !light->shadowCast || eqMargin(trace<QUERY_OCCLUSION>(lightRay, lightRayLen), lightRayLen);
+					if (info) {
+						info->rays += light->shadowCast;
+						if (bounce == 0 && !lit && l < 32) {
+							info->shadowed |= 1u << l;
+						}
+					}
+					if (lit) {
 						float sDot = std::max(Vec3::dot(ray.meshInfo.normal, lightRay.dir), 0.0f);
 						float sIntensity = light->intensity(lightRayLen);
 						float sLum = (sIntensity * sDot);
@@ -67,29 +191,197 @@ public:
 
 			Vec3::m_normalize(avgColor);
 			Vec3::m_scale(avgColor, totalLum);
-			Vec3::m_cap(avgColor, COLOR_MAX);
-			return 0x00000000 | ((int)(avgColor.axis[COLOR_R] * 255) << 24) | ((int)(avgColor.axis[COLOR_G] * 255) << 16) | ((int)(avgColor.axis[COLOR_B] * 255) << 8);
+
+			if (reflectivity > 0 && bounce < maxBounces) {
+				Vec3 reflectDir = reflect(ray.dir, ray.meshInfo.normal);
+				Ray reflectRay(Vec3::add(its, Vec3::scale(reflectDir, REFLECT_OFFSET)), reflectDir);
+				Vec3 reflectColor = shadeRay(reflectRay, lightOffset, bounce + 1, nullptr, info);
+				Vec3::m_scale(avgColor, 1 - reflectivity);
+				Vec3::m_add(avgColor, Vec3::scale(reflectColor, reflectivity));
+			}
+			return avgColor;
 		}
 
-		return 0x1F1F1F00;
+		return BACKGROUND_COLOR;
+	}
+	static inline Vec3 reflect(const Vec3 &dir, const Vec3 &normal) {
+		return Vec3::sub(dir, Vec3::scale(normal, 2 * Vec3::dot(dir, normal)));
+	}
+	uint32_t renderRay(Ray &ray, const BinRange *bin = nullptr) const {
+		Vec3 color = shadeRay(ray, Vec3(0, 0, 0), 0, bin);
+		Vec3::m_cap(color, COLOR_MAX);
+		return PACK_COLOR(color.axis[COLOR_R], color.axis[COLOR_G], color.axis[COLOR_B]);
+	}
+};
+
+// Screen space instance bins
+// side of a bin in pixels
+#define BIN_TILE_SIZE 32
+// pixels added around each instance's projected bounds, covers jittered samples and rounding
+#define BIN_MARGIN 2
+// scenes with fewer instances trace every instance, the 6 pillar bench frame gains nothing from bins but the crowd does
+#define BIN_MIN_INSTANCES 8
+
+/* Lists of the instances whose world bounds project onto each screen tile, sorted by depth along the view direction
+all primary rays of an orthographic camera share a direction, so each instance covers an exact screen rectangle
+only valid for the view and instance positions they were built for, rebuild once both are final each frame */
+class InstanceBins {
+private:
+	// each instance's rect in tiles, inclusive, empty if minX > maxX
+	struct Rect {
+		int minX, minY, maxX, maxY;
+		float near;
+	};
+	std::vector<Rect> rects;
+	// tile t's instances are entries[offsets[t]] to entries[offsets[t + 1]]
+	std::vector<int> offsets;
+	std::vector<BinEntry> entries;
+	int width, height, tilesX, tilesY;
+	bool built;
+public:
+	InstanceBins () : width(0), height(0), tilesX(0), tilesY(0), built(false) {}
+
+	// origin is the primary ray origin of pixel (0, 0), dir the view direction
+	void build(const Scene &scene, const Vec3 &origin, const Vec3 &viewDir, int width, int height) {
+		PROFILE_ZONE("Bin instances");
+		Vec3 dir = Vec3::normalize(viewDir);
+		this->width = width;
+		this->height = height;
+		tilesX = (width + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+		tilesY = (height + BIN_TILE_SIZE - 1) / BIN_TILE_SIZE;
+		int instances = scene.models.size();
+		int tiles = tilesX * tilesY;
+		rects.resize(instances);
+
+		// slide each corner of the world bounds back along the view direction onto the screen plane
+		#pragma omp parallel for
+		for (int i = 0; i < instances; ++i) {
+			const ModelInstance *instance = scene.models[i];
+			BBox bounds = instance->bounds();
+			const Vec3 &min = bounds.min, &max = bounds.max;
+			float minX = std::numeric_limits<float>::max(), minY = minX, maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+			Rect &rect = rects[i];
+			rect.near = std::numeric_limits<float>::max();
+			for (int corner = 0; corner < 8; ++corner) {
+				Vec3 point((corner & 1) ? max.axis[AXIS_X] : min.axis[AXIS_X], (corner & 2) ? max.axis[AXIS_Y] : min.axis[AXIS_Y], (corner & 4) ? max.axis[AXIS_Z] : min.axis[AXIS_Z]);
+				float depth = (point.axis[AXIS_Z] - origin.axis[AXIS_Z]) / dir.axis[AXIS_Z];
+				float x = point.axis[AXIS_X] - (dir.axis[AXIS_X] * depth) - origin.axis[AXIS_X];
+				float y = point.axis[AXIS_Y] - (dir.axis[AXIS_Y] * depth) - origin.axis[AXIS_Y];
+				minX = std::min(minX, x);
+				minY = std::min(minY, y);
+				maxX = std::max(maxX, x);
+				maxY = std::max(maxY, y);
+				rect.near = std::min(rect.near, depth);
+			}
+			rect.minX = std::max((int)std::floor((minX - BIN_MARGIN) / BIN_TILE_SIZE), 0);
+			rect.minY = std::max((int)std::floor((minY - BIN_MARGIN) / BIN_TILE_SIZE), 0);
+			rect.maxX = std::min((int)std::floor((maxX + BIN_MARGIN) / BIN_TILE_SIZE), tilesX - 1);
+			rect.maxY = std::min((int)std::floor((maxY + BIN_MARGIN) / BIN_TILE_SIZE), tilesY - 1);
+		}
+
+		// count, then fill each tile's list, tiles are independent
+		offsets.assign(tiles + 1, 0);
+		#pragma omp parallel for
+		for (int tile = 0; tile < tiles; ++tile) {
+			int x = tile % tilesX, y = tile / tilesX;
+			for (const Rect &rect: rects) {
+				offsets[tile + 1] += x >= rect.minX && x <= rect.maxX && y >= rect.minY && y <= rect.maxY;
+			}
+		}
+		for (int tile = 0; tile < tiles; ++tile) {
+			offsets[tile + 1] += offsets[tile];
+		}
+		entries.resize(offsets[tiles]);
+		#pragma omp parallel for
+		for (int tile = 0; tile < tiles; ++tile) {
+			int x = tile % tilesX, y = tile / tilesX;
+			BinEntry *entry = entries.data() + offsets[tile];
+			for (int i = 0; i < instances; ++i) {
+				const Rect &rect = rects[i];
+				if (x >= rect.minX && x <= rect.maxX && y >= rect.minY && y <= rect.maxY) {
+					*entry++ = {i, rect.near};
+				}
+			}
+			std::sort(entries.data() + offsets[tile], entry, [](const BinEntry &a, const BinEntry &b) {
+				return a.near < b.near || (a.near == b.near && a.instance < b.instance);
+			});
+		}
+		built = true;
+	}
+	// primary rays trace every instance again until the next build
+	inline void clear() {
+		built = false;
+	}
+	// sets range to the instances the primary ray of pixel (x, y) can hit, false if the pixel wasn't binned
+	inline bool bin(int x, int y, BinRange &range) const {
+		if (!built || x < 0 || y < 0 || x >= width || y >= height) {
+			return false;
+		}
+		int tile = ARRAY_INDEX(x / BIN_TILE_SIZE, y / BIN_TILE_SIZE, tilesX);
+		range = {entries.data() + offsets[tile], entries.data() + offsets[tile + 1]};
+		return true;
+	}
+	// instances in the average tile's list
+	float averageBinSize() const {
+		return tilesX * tilesY > 0 ? entries.size() / (float)(tilesX * tilesY) : 0;
 	}
 };
 
 // Camera
+#define CAMERA_ORTHO_DIR Vec3(0.1, -0.2, -1)
 class Camera {
 public:
 	Scene scene;
 	Vec3 pos;
-	Camera () {}
-	Camera (Vec3 pos) : pos(pos) {}
-	uint32_t renderPixel(int x, int y) const {
+	// size of the image in pixels, centered on pos
+	int width, height;
+	// primary ray candidates per screen tile, rebuilt by binInstances
+	InstanceBins bins;
+	Camera () : width(SCREEN_WIDTH), height(SCREEN_HEIGHT) {}
+	Camera (Vec3 pos, int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT) : pos(pos), width(width), height(height) {}
+	/* call once the view and every instance are in place for the frame, primary rays trace every instance until then
+	scenes of fewer than minInstances aren't binned, they trace every instance anyway */
+	void binInstances(size_t minInstances = BIN_MIN_INSTANCES) {
+		if (scene.models.size() < minInstances) {
+			bins.clear();
+			return;
+		}
+		bins.build(scene, primaryOrigin(0, 0), CAMERA_ORTHO_DIR, width, height);
+	}
+	inline Vec3 primaryOrigin(float x, float y) const {
+		return Vec3((int)pos.axis[AXIS_X] + x - (width / 2), (int)pos.axis[AXIS_Y] + y - (height / 2), pos.axis[AXIS_Z]);
+	}
+	Ray primaryRay(float x, float y) const {
 		// Orthographic
-		Ray ray(Vec3((int)pos.axis[AXIS_X] + x - (SCREEN_WIDTH / 2), (int)pos.axis[AXIS_Y] + y - (SCREEN_HEIGHT / 2), pos.axis[AXIS_Z]), Vec3(0.1, -0.2, -1));
+		return Ray(primaryOrigin(x, y), CAMERA_ORTHO_DIR);
 		// Perspective
 		//float focalLength = 1000;
-		//Ray ray(Vec3(pos.axis[AXIS_X], pos.axis[AXIS_Y], pos.axis[AXIS_Z]), Vec3(x - (SCREEN_WIDTH / 2), y - (SCREEN_HEIGHT / 2), -1 * focalLength));
+		//return Ray(Vec3(pos.axis[AXIS_X], pos.axis[AXIS_Y], pos.axis[AXIS_Z]), Vec3(x - (SCREEN_WIDTH / 2), y - (SCREEN_HEIGHT / 2), -1 * focalLength));
+	}
+	uint32_t renderPixel(int x, int y) const {
+		Ray ray = primaryRay(x, y);
+		BinRange bin;
+		if (bins.bin(x, y, bin)) {
+			return scene.renderRay(ray, &bin);
+		}
 		return scene.renderRay(ray);
 	}
+	// one jittered HDR sample of a pixel for the accumulator
+	Vec3 samplePixel(int x, int y, unsigned int sample, SampleInfo *info = nullptr) const {
+		float offsetX, offsetY;
+		Vec3 lightOffset;
+		Accumulator::jitter(x, y, sample, offsetX, offsetY, lightOffset);
+		return shadeSubPixel(x, y, offsetX, offsetY, lightOffset, info);
+	}
+	// HDR sample of pixel (x, y) offset by less than half a pixel, the offset stays within the pixel's bin
+	Vec3 shadeSubPixel(int x, int y, float offsetX, float offsetY, const Vec3 &lightOffset, SampleInfo *info = nullptr) const {
+		Ray ray = primaryRay(x + offsetX, y + offsetY);
+		BinRange bin;
+		if (bins.bin(x, y, bin)) {
+			return scene.shadeRay(ray, lightOffset, 0, &bin, info);
+		}
+		return scene.shadeRay(ray, lightOffset, 0, nullptr, info);
+	}
 };
 
 #endif
@@ -0,0 +1,301 @@
+#ifndef SHARED_FRAMES
+#define SHARED_FRAMES
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+// Shared memory frame output
+#define SHARED_FRAMES_MAGIC 0x52544652
+#define SHARED_FRAMES_VERSION 1
+#define SHARED_FRAMES_NAME "/raytracer-frames"
+#define SHARED_FRAMES_SLOTS 4
+// slot headers and pixels start on cache line boundaries
+#define SHARED_FRAMES_ALIGN 64
+// times a consumer retries when the newest frame is overwritten while it looks it up
+#define SHARED_FRAMES_ACQUIRE_RETRIES 4
+enum FRAME_FORMAT{FRAME_FORMAT_RGBX8888 = 1};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "shared frame counters must be lock free to work across processes");
+
+/* Layout of the shared memory object: one SharedFramesHeader, then slots of slotBytes each, a SharedFrameSlot followed by its pixels
+every field other than the atomics is written once before magic is published, or while the slot's sequence is odd */
+struct SharedFramesHeader {
+	std::atomic<uint32_t> magic;
+	uint32_t version, slots, slotBytes, width, height, pitch, format;
+	// index of the newest published frame + 1, 0 before the first
+	std::atomic<uint64_t> published;
+	// frames overwritten before any consumer finished reading them, only counted while a consumer is attached
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint32_t> consumers;
+};
+
+struct SharedFrameSlot {
+	// seqlock, odd while the producer writes the slot, 2 * (frame + 1) once the frame is published
+	std::atomic<uint64_t> sequence;
+	// sequence of the last frame in this slot a consumer finished reading
+	std::atomic<uint64_t> consumed;
+	uint64_t frame;
+	// steady clock(CLOCK_MONOTONIC) ns when the frame was published
+	uint64_t timestamp;
+	uint32_t width, height, pitch, format;
+};
+
+namespace SharedFrames {
+	static inline size_t align(size_t bytes) {
+		return (bytes + SHARED_FRAMES_ALIGN - 1) & ~(size_t)(SHARED_FRAMES_ALIGN - 1);
+	}
+	static inline size_t headerBytes() {
+		return align(sizeof(SharedFramesHeader));
+	}
+	static inline size_t slotHeaderBytes() {
+		return align(sizeof(SharedFrameSlot));
+	}
+	static inline uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static inline SharedFrameSlot *slot(void *memory, const SharedFramesHeader *header, uint64_t frame) {
+		return (SharedFrameSlot *)((uint8_t *)memory + headerBytes() + ((frame % header->slots) * header->slotBytes));
+	}
+	static inline uint32_t *pixels(SharedFrameSlot *slot) {
+		return (uint32_t *)((uint8_t *)slot + slotHeaderBytes());
+	}
+}
+
+/* Producer end of a ring of frames in POSIX shared memory
+publishing never waits on consumers, the oldest slot is always overwritten and a frame nobody read is counted as dropped */
+class SharedFrameWriter {
+private:
+	std::string name;
+	void *memory;
+	size_t bytes;
+	SharedFramesHeader *header;
+	SharedFrameSlot *writing;
+public:
+	// frames published so far, the next frame's index
+	uint64_t frames;
+
+	SharedFrameWriter () : memory(nullptr), bytes(0), header(nullptr), writing(nullptr), frames(0) {}
+	SharedFrameWriter (const SharedFrameWriter &) = delete;
+	SharedFrameWriter &operator=(const SharedFrameWriter &) = delete;
+	~SharedFrameWriter () {
+		close();
+	}
+	// creates or replaces the shared memory object name, false if it can't be created or mapped or the ring would be empty
+	bool open(const std::string &name, int width, int height, int slots = SHARED_FRAMES_SLOTS) {
+		close();
+		if (width <= 0 || height <= 0 || slots < 1) {
+			printf("Shared frames need at least 1 slot of at least 1x1, not %d of %dx%d\n", slots, width, height);
+			return false;
+		}
+		this->name = name;
+		uint32_t pitch = width * sizeof(uint32_t);
+		size_t slotBytes = SharedFrames::align(SharedFrames::slotHeaderBytes() + ((size_t)pitch * height));
+		bytes = SharedFrames::headerBytes() + (slotBytes * slots);
+
+		// a fresh object so consumers of an earlier run see the new header, not a resized old one
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0) {
+			printf("Could not create shared memory \"%s\"\n", name.c_str());
+			return false;
+		}
+		if (ftruncate(fd, bytes) != 0) {
+			printf("Could not size shared memory \"%s\" to %ld bytes\n", name.c_str(), (long)bytes);
+			::close(fd);
+			shm_unlink(name.c_str());
+			return false;
+		}
+		memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (memory == MAP_FAILED) {
+			printf("Could not map shared memory \"%s\"\n", name.c_str());
+			memory = nullptr;
+			shm_unlink(name.c_str());
+			return false;
+		}
+
+		// the object starts zeroed, so every sequence is 0(never written)
+		header = new (memory) SharedFramesHeader();
+		header->version = SHARED_FRAMES_VERSION;
+		header->slots = slots;
+		header->slotBytes = slotBytes;
+		header->width = width;
+		header->height = height;
+		header->pitch = pitch;
+		header->format = FRAME_FORMAT_RGBX8888;
+		for (int i = 0; i < slots; ++i) {
+			new (SharedFrames::slot(memory, header, i)) SharedFrameSlot();
+		}
+		header->magic.store(SHARED_FRAMES_MAGIC, std::memory_order_release);
+		frames = 0;
+		printf("Shared frames: \"%s\", %d slots of %dx%d RGBX8888, %.2f MB\n", name.c_str(), slots, width, height, bytes / (float)SIZE_MB);
+		return true;
+	}
+	void close() {
+		if (memory) {
+			munmap(memory, bytes);
+			// consumers keep their mapping, the name is freed for the next run
+			shm_unlink(name.c_str());
+			memory = nullptr;
+			header = nullptr;
+		}
+	}
+	inline bool opened() const {
+		return memory != nullptr;
+	}
+	inline uint32_t pitch() const {
+		return header->pitch;
+	}
+	// frames overwritten before any attached consumer read them
+	inline uint64_t dropped() const {
+		return header ? header->dropped.load(std::memory_order_relaxed) : 0;
+	}
+	inline uint32_t consumers() const {
+		return header ? header->consumers.load(std::memory_order_relaxed) : 0;
+	}
+	// claims the oldest slot for the next frame and returns where its pixels go, rows pitch() bytes apart
+	uint32_t *beginFrame() {
+		writing = SharedFrames::slot(memory, header, frames);
+		uint64_t previous = writing->sequence.load(std::memory_order_relaxed);
+		if (previous != 0 && writing->consumed.load(std::memory_order_acquire) != previous && header->consumers.load(std::memory_order_relaxed) > 0) {
+			header->dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		writing->sequence.store((2 * frames) + 1, std::memory_order_relaxed);
+		// consumers that see the pixel writes below also see the odd sequence
+		std::atomic_thread_fence(std::memory_order_release);
+		return SharedFrames::pixels(writing);
+	}
+	// makes the frame written since beginFrame the newest one
+	void publish() {
+		writing->frame = frames;
+		writing->timestamp = SharedFrames::now();
+		writing->width = header->width;
+		writing->height = header->height;
+		writing->pitch = header->pitch;
+		writing->format = header->format;
+		writing->sequence.store(2 * (frames + 1), std::memory_order_release);
+		header->published.store(frames + 1, std::memory_order_release);
+		++frames;
+	}
+};
+
+// one frame a consumer is reading, pixels point straight into the shared slot
+struct SharedFrame {
+	const uint32_t *pixels;
+	uint64_t frame, timestamp;
+	uint32_t width, height, pitch, format;
+};
+
+/* Consumer end, maps the producer's ring and takes the newest frame each time, any number may attach
+a frame can be overwritten while it is being read, release says whether it was intact */
+class SharedFrameReader {
+private:
+	void *memory;
+	size_t bytes;
+	SharedFramesHeader *header;
+	SharedFrameSlot *reading;
+	uint64_t readingSequence, lastFrame;
+public:
+	// frames the producer published that this consumer never took, and frames overwritten while it read them
+	uint64_t skipped, torn, read;
+
+	SharedFrameReader () : memory(nullptr), bytes(0), header(nullptr), reading(nullptr), readingSequence(0), lastFrame(0), skipped(0), torn(0), read(0) {}
+	SharedFrameReader (const SharedFrameReader &) = delete;
+	SharedFrameReader &operator=(const SharedFrameReader &) = delete;
+	~SharedFrameReader () {
+		close();
+	}
+	// false if there is no producer ring called name
+	bool open(const std::string &name) {
+		close();
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0 || (size_t)info.st_size < SharedFrames::headerBytes()) {
+			::close(fd);
+			return false;
+		}
+		bytes = info.st_size;
+		memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (memory == MAP_FAILED) {
+			memory = nullptr;
+			return false;
+		}
+		header = (SharedFramesHeader *)memory;
+		if (header->magic.load(std::memory_order_acquire) != SHARED_FRAMES_MAGIC || header->version != SHARED_FRAMES_VERSION ||
+			SharedFrames::headerBytes() + ((size_t)header->slots * header->slotBytes) > bytes) {
+			munmap(memory, bytes);
+			memory = nullptr;
+			return false;
+		}
+		header->consumers.fetch_add(1, std::memory_order_relaxed);
+		lastFrame = header->published.load(std::memory_order_acquire);
+		return true;
+	}
+	void close() {
+		if (memory) {
+			header->consumers.fetch_sub(1, std::memory_order_relaxed);
+			munmap(memory, bytes);
+			memory = nullptr;
+			header = nullptr;
+		}
+	}
+	inline const SharedFramesHeader *info() const {
+		return header;
+	}
+	// newest frame if there is one this consumer hasn't taken yet, must be released before the next acquire
+	bool acquire(SharedFrame &frame) {
+		for (int retry = 0; retry < SHARED_FRAMES_ACQUIRE_RETRIES; ++retry) {
+			uint64_t published = header->published.load(std::memory_order_acquire);
+			if (published == lastFrame) {
+				return false;
+			}
+			SharedFrameSlot *slot = SharedFrames::slot(memory, header, published - 1);
+			uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+			// already overwritten by a newer frame, look up the newest again
+			if (sequence != 2 * published) {
+				continue;
+			}
+			frame.pixels = SharedFrames::pixels(slot);
+			frame.frame = slot->frame;
+			frame.timestamp = slot->timestamp;
+			frame.width = slot->width;
+			frame.height = slot->height;
+			frame.pitch = slot->pitch;
+			frame.format = slot->format;
+			skipped += published - lastFrame - 1;
+			lastFrame = published;
+			reading = slot;
+			readingSequence = sequence;
+			return true;
+		}
+		return false;
+	}
+	// done with the acquired frame, false if the producer started overwriting it meanwhile and what was read is torn
+	bool release() {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (reading->sequence.load(std::memory_order_relaxed) != readingSequence) {
+			++torn;
+			return false;
+		}
+		reading->consumed.store(readingSequence, std::memory_order_release);
+		++read;
+		return true;
+	}
+};
+
+#endif
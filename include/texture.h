@@ -0,0 +1,146 @@
+#ifndef TEXTURE
+#define TEXTURE
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include "common.h"
+#include "vec3.h"
+
+// Textures
+// texels are stored in square tiles of this many texels a side(as a power of 2), Morton ordered within a tile
+#define TEXTURE_TILE_BITS 3
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_BITS)
+#define TEXTURE_TILE_TEXELS (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE)
+// world units covered by one pixel of the orthographic camera
+#define TEXTURE_PIXEL_FOOTPRINT 1
+// surfaces seen more edge on than this still pick a finite mip level
+#define TEXTURE_MIN_COSINE 0.05f
+
+/* RGBX8888 image with its full mip chain
+each level is split into tiles so texels that are close in 2D share cache lines, whatever direction a surface is sampled in */
+class Texture {
+private:
+	struct Level {
+		int width, height, tilesAcross;
+		size_t offset;
+	};
+	std::vector<Level> mips;
+	std::vector<uint32_t> texels;
+
+	// interleaves the low TEXTURE_TILE_BITS bits of x and y
+	static inline uint32_t morton(uint32_t x, uint32_t y) {
+		uint32_t index = 0;
+		for (int bit = 0; bit < TEXTURE_TILE_BITS; ++bit) {
+			index |= ((x >> bit) & 1) << (bit * 2);
+			index |= ((y >> bit) & 1) << ((bit * 2) + 1);
+		}
+		return index;
+	}
+	inline size_t address(const Level &level, int x, int y) const {
+		int tile = ((y >> TEXTURE_TILE_BITS) * level.tilesAcross) + (x >> TEXTURE_TILE_BITS);
+		return level.offset + ((size_t)tile * TEXTURE_TILE_TEXELS) + morton(x, y);
+	}
+	void addLevel(int levelWidth, int levelHeight, const std::vector<float> &rgb) {
+		Level level;
+		level.width = levelWidth;
+		level.height = levelHeight;
+		level.tilesAcross = (levelWidth + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		int tilesDown = (levelHeight + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		level.offset = texels.size();
+		texels.resize(texels.size() + ((size_t)level.tilesAcross * tilesDown * TEXTURE_TILE_TEXELS), 0);
+		for (int y = 0; y < levelHeight; ++y) {
+			for (int x = 0; x < levelWidth; ++x) {
+				const float *texel = &rgb[ARRAY_INDEX(x, y, levelWidth) * COLOR_NUM];
+				texels[address(level, x, y)] = PACK_COLOR(texel[COLOR_R], texel[COLOR_G], texel[COLOR_B]);
+			}
+		}
+		mips.push_back(level);
+	}
+public:
+	int width, height;
+	std::string name;
+
+	// builds every level from RGBX8888 pixels, row by row
+	Texture (int width, int height, const uint32_t *pixels, const std::string &name = "") : width(width), height(height), name(name) {
+		std::vector<float> rgb(width * height * COLOR_NUM);
+		for (int i = 0; i < width * height; ++i) {
+			rgb[(i * COLOR_NUM) + COLOR_R] = ((pixels[i] >> 24) & 0xFF) / 255.0f;
+			rgb[(i * COLOR_NUM) + COLOR_G] = ((pixels[i] >> 16) & 0xFF) / 255.0f;
+			rgb[(i * COLOR_NUM) + COLOR_B] = ((pixels[i] >> 8) & 0xFF) / 255.0f;
+		}
+		int levelWidth = width, levelHeight = height;
+		addLevel(levelWidth, levelHeight, rgb);
+		// box filter each level down to 1x1, odd edges reuse their last texel
+		while (levelWidth > 1 || levelHeight > 1) {
+			int nextWidth = std::max(levelWidth / 2, 1), nextHeight = std::max(levelHeight / 2, 1);
+			std::vector<float> next(nextWidth * nextHeight * COLOR_NUM);
+			for (int y = 0; y < nextHeight; ++y) {
+				for (int x = 0; x < nextWidth; ++x) {
+					int x0 = std::min(x * 2, levelWidth - 1), x1 = std::min((x * 2) + 1, levelWidth - 1);
+					int y0 = std::min(y * 2, levelHeight - 1), y1 = std::min((y * 2) + 1, levelHeight - 1);
+					for (int color = 0; color < COLOR_NUM; ++color) {
+						next[(ARRAY_INDEX(x, y, nextWidth) * COLOR_NUM) + color] = (rgb[(ARRAY_INDEX(x0, y0, levelWidth) * COLOR_NUM) + color] + rgb[(ARRAY_INDEX(x1, y0, levelWidth) * COLOR_NUM) + color] +
+							rgb[(ARRAY_INDEX(x0, y1, levelWidth) * COLOR_NUM) + color] + rgb[(ARRAY_INDEX(x1, y1, levelWidth) * COLOR_NUM) + color]) / 4;
+					}
+				}
+			}
+			rgb.swap(next);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+			addLevel(levelWidth, levelHeight, rgb);
+		}
+		printf("Loaded texture \"%s\" %dx%d, %ld mip levels, %.2f MB\n", name.c_str(), width, height, (long)mips.size(), memory() / (float)SIZE_MB);
+	}
+	// binary PPM(P6, 8 bit), returns nullptr if the file can't be read
+	static Texture *loadPPM(const std::string &filename) {
+		FILE *file = fopen(filename.c_str(), "rb");
+		if (!file) {
+			printf("Could not open texture \"%s\"\n", filename.c_str());
+			return nullptr;
+		}
+		int ppmWidth, ppmHeight, maxValue;
+		if (fscanf(file, "P6 %d %d %d", &ppmWidth, &ppmHeight, &maxValue) != 3 || maxValue != 255 || ppmWidth <= 0 || ppmHeight <= 0 || fgetc(file) == EOF) {
+			printf("Unsupported texture \"%s\", only 8 bit binary PPM is read\n", filename.c_str());
+			fclose(file);
+			return nullptr;
+		}
+		std::vector<uint8_t> rgb(ppmWidth * ppmHeight * COLOR_NUM);
+		bool complete = fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+		fclose(file);
+		if (!complete) {
+			printf("Texture \"%s\" is truncated\n", filename.c_str());
+			return nullptr;
+		}
+		std::vector<uint32_t> pixels(ppmWidth * ppmHeight);
+		for (size_t i = 0; i < pixels.size(); ++i) {
+			pixels[i] = ((uint32_t)rgb[(i * COLOR_NUM) + COLOR_R] << 24) | ((uint32_t)rgb[(i * COLOR_NUM) + COLOR_G] << 16) | ((uint32_t)rgb[(i * COLOR_NUM) + COLOR_B] << 8);
+		}
+		return new Texture(ppmWidth, ppmHeight, pixels.data(), filename);
+	}
+	inline int levels() const {
+		return mips.size();
+	}
+	inline size_t memory() const {
+		return texels.size() * sizeof(uint32_t);
+	}
+	/* nearest texel of the nearest mip level, coordinates wrap
+	lod is log2 of the texels covered by one pixel along each axis at level 0 */
+	inline Vec3 sample(float u, float v, float lod) const {
+		int level = CLAMP(0, (int)(lod + 0.5f), (int)mips.size() - 1);
+		const Level &mip = mips[level];
+		// image rows run top down, v runs bottom up
+		u -= std::floor(u);
+		v = 1 - (v - std::floor(v));
+		int x = std::min((int)(u * mip.width), mip.width - 1);
+		int y = std::min((int)(v * mip.height), mip.height - 1);
+		uint32_t texel = texels[address(mip, x, y)];
+		return Vec3(((texel >> 24) & 0xFF) / 255.0f, ((texel >> 16) & 0xFF) / 255.0f, ((texel >> 8) & 0xFF) / 255.0f);
+	}
+};
+
+#endif
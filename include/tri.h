@@ -27,8 +27,10 @@ public:
 	Vert *verts[3];
 	Vec3 normal;
 	BBox bbox;
+	// position in the model's tri list, indexes its per tri surface tables
+	unsigned int index;
 
-	Tri (Vert *a, Vert *b, Vert *c) {
+	Tri (Vert *a, Vert *b, Vert *c, unsigned int index = 0) : index(index) {
 		verts[0] = a;
 		verts[1] = b;
 		verts[2] = c;
@@ -36,29 +38,30 @@ public:
 		calcBBox();
 	}
 
-	float rayCast(Ray &ray) const {
+	// recalculates the normal and bounds once the verts have moved
+	inline void update() {
+		calcNormal();
+		calcBBox();
+	}
+
+	/* depth at which the ray hits the tri with corners a, b, c, RAY_MISS if it doesn't or isn't nearer than ray.depth
+	shared with tris stored without vert pointers, ie: paged geometry */
+	static inline float intersect(const Vec3 &a, const Vec3 &b, const Vec3 &c, const Vec3 &normal, const BBox &bbox, const Ray &ray) {
 		// first check if it intersects the bounding box, then do the math for tri intersection
-		// if it intersected, modify the ray and return true
-		// this is the only area that should modify the ray
 		// ray intersects the bounding box
 		if (bbox.rayCast(ray) != RAY_MISS) {
 			float l_dot_n = Vec3::dot(ray.dir, normal);
 			// ray is not parallel to the surface
 			if (l_dot_n != 0) {
-				Vec3 p0_minus_l0 = Vec3::sub(verts[0]->pos, ray.origin);
+				Vec3 p0_minus_l0 = Vec3::sub(a, ray.origin);
 				float depth = Vec3::dot(p0_minus_l0, normal) / l_dot_n;
 				// possible ray intersection with triangle plane is nearer than previous ones
 				if (depth < ray.depth && depth >= 0) {
 					Vec3 its = Vec3::add(ray.origin, Vec3::scale(ray.dir, depth));
 					// check if intersection lies within tri boundaries
-					if (geqMargin(Vec3::dot(Vec3::cross(Vec3::sub(verts[1]->pos, verts[0]->pos), Vec3::sub(its, verts[0]->pos)), normal), 0)) {
-						if (geqMargin(Vec3::dot(Vec3::cross(Vec3::sub(verts[2]->pos, verts[1]->pos), Vec3::sub(its, verts[1]->pos)), normal), 0)) {
-							if (geqMargin(Vec3::dot(Vec3::cross(Vec3::sub(verts[0]->pos, verts[2]->pos), Vec3::sub(its, verts[2]->pos)), normal), 0)) {
-								// ray intersects tri closer than previous intersections, update it
-								ray.meshInfo.normal = normal;
-								ray.tri = this;
-								ray.depth = depth;
-								ray.meshInfo.diffuse = Vec3(1, 1, 1); //TODO set this from texture
+					if (geqMargin(Vec3::dot(Vec3::cross(Vec3::sub(b, a), Vec3::sub(its, a)), normal), 0)) {
+						if (geqMargin(Vec3::dot(Vec3::cross(Vec3::sub(c, b), Vec3::sub(its, b)), normal), 0)) {
+							if (geqMargin(Vec3::dot(Vec3::cross(Vec3::sub(a, c), Vec3::sub(its, c)), normal), 0)) {
 								return depth;
 							}
 						}
@@ -68,6 +71,19 @@ public:
 		}
 		return RAY_MISS;
 	}
+	float rayCast(Ray &ray) const {
+		// if it intersected, modify the ray and return the depth
+		// this is the only area that should modify the ray
+		float depth = intersect(verts[0]->pos, verts[1]->pos, verts[2]->pos, normal, bbox, ray);
+		if (depth != RAY_MISS) {
+			// ray intersects tri closer than previous intersections, update it
+			ray.meshInfo.normal = normal;
+			ray.tri = this;
+			ray.depth = depth;
+			// diffuse is looked up from the model's materials once the closest hit is known
+		}
+		return depth;
+	}
 };
 
 #endif
@@ -39,6 +39,10 @@ public:
 		v.axis[AXIS_Y] *= scale;
 		v.axis[AXIS_Z] *= scale;
 	}
+	// component wise product, ie: tinting a color
+	static inline Vec3 mul(const Vec3 &a, const Vec3 &b) {
+		return Vec3(a.axis[AXIS_X] * b.axis[AXIS_X], a.axis[AXIS_Y] * b.axis[AXIS_Y], a.axis[AXIS_Z] * b.axis[AXIS_Z]);
+	}
 	static inline Vec3 divide(const Vec3 &a, float divisor) {
 		return Vec3(a.axis[AXIS_X] / divisor, a.axis[AXIS_Y] / divisor, a.axis[AXIS_Z] / divisor);
 	}
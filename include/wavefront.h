@@ -0,0 +1,514 @@
+#ifndef WAVEFRONT
+#define WAVEFRONT
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+
+#include "common.h"
+#include "vec3.h"
+#include "ray.h"
+#include "light.h"
+#include "scene.h"
+#include "accumulator.h"
+#include "packet.h"
+#include "profiler.h"
+
+// Wavefront renderer
+// pixels traced together by each pass through the stages, bounds the queue memory
+#define WAVEFRONT_SIZE 65536
+enum WAVEFRONT_SORT{WAVEFRONT_SORT_NONE, WAVEFRONT_SORT_DIRECTION, WAVEFRONT_SORT_MODEL, WAVEFRONT_SORT_NUM};
+// what a light does for a hit, filled in by the shade and occlusion stages
+enum LIGHT_STATE{LIGHT_UNLIT, LIGHT_LIT, LIGHT_OCCLUSION_TEST};
+
+template<typename T>
+static inline void gatherArray(std::vector<T> &dest, const std::vector<T> &source, const std::vector<int> &indices) {
+	dest.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i) {
+		dest[i] = source[indices[i]];
+	}
+}
+
+// quantized direction, similar directions get neighbouring keys
+static inline uint32_t directionKey(float x, float y, float z) {
+	float len = std::sqrt((x * x) + (y * y) + (z * z));
+	uint32_t qx = (uint32_t)(((x / len) + 1) * 127.5f);
+	uint32_t qy = (uint32_t)(((y / len) + 1) * 127.5f);
+	uint32_t qz = (uint32_t)(((z / len) + 1) * 127.5f);
+	return (qx << 16) | (qy << 8) | qz;
+}
+
+// Structure of arrays queue of rays waiting for their closest hit
+class RayQueue {
+public:
+	// origin and direction as passed to the Ray constructor
+	std::vector<float> originX, originY, originZ, dirX, dirY, dirZ;
+	// wavefront pixel the ray contributes to and how much of its color it carries
+	std::vector<int> pixel;
+	std::vector<float> weight;
+	// set by the extend stage
+	std::vector<float> depth;
+	std::vector<int> instance;
+	std::vector<float> normalX, normalY, normalZ, diffuseR, diffuseG, diffuseB;
+
+	inline size_t size() const {
+		return pixel.size();
+	}
+	void resize(size_t count) {
+		originX.resize(count);
+		originY.resize(count);
+		originZ.resize(count);
+		dirX.resize(count);
+		dirY.resize(count);
+		dirZ.resize(count);
+		pixel.resize(count);
+		weight.resize(count);
+		depth.resize(count);
+		instance.resize(count);
+		normalX.resize(count);
+		normalY.resize(count);
+		normalZ.resize(count);
+		diffuseR.resize(count);
+		diffuseG.resize(count);
+		diffuseB.resize(count);
+	}
+	inline void set(size_t i, const Vec3 &origin, const Vec3 &dir, int pix, float w) {
+		originX[i] = origin.axis[AXIS_X];
+		originY[i] = origin.axis[AXIS_Y];
+		originZ[i] = origin.axis[AXIS_Z];
+		dirX[i] = dir.axis[AXIS_X];
+		dirY[i] = dir.axis[AXIS_Y];
+		dirZ[i] = dir.axis[AXIS_Z];
+		pixel[i] = pix;
+		weight[i] = w;
+	}
+	inline Ray ray(size_t i) const {
+		return Ray(Vec3(originX[i], originY[i], originZ[i]), Vec3(dirX[i], dirY[i], dirZ[i]));
+	}
+	// fill this queue with the given entries of source, in order
+	void gather(const RayQueue &source, const std::vector<int> &indices) {
+		gatherArray(originX, source.originX, indices);
+		gatherArray(originY, source.originY, indices);
+		gatherArray(originZ, source.originZ, indices);
+		gatherArray(dirX, source.dirX, indices);
+		gatherArray(dirY, source.dirY, indices);
+		gatherArray(dirZ, source.dirZ, indices);
+		gatherArray(pixel, source.pixel, indices);
+		gatherArray(weight, source.weight, indices);
+		gatherArray(depth, source.depth, indices);
+		gatherArray(instance, source.instance, indices);
+		gatherArray(normalX, source.normalX, indices);
+		gatherArray(normalY, source.normalY, indices);
+		gatherArray(normalZ, source.normalZ, indices);
+		gatherArray(diffuseR, source.diffuseR, indices);
+		gatherArray(diffuseG, source.diffuseG, indices);
+		gatherArray(diffuseB, source.diffuseB, indices);
+	}
+};
+
+// Structure of arrays queue of shadow rays waiting for an occlusion test
+class ShadowQueue {
+public:
+	// origin and direction as passed to the Ray constructor
+	std::vector<float> originX, originY, originZ, dirX, dirY, dirZ, length;
+	// index into the per hit, per light state
+	std::vector<int> slot;
+	std::vector<uint32_t> light, tile;
+
+	inline size_t size() const {
+		return slot.size();
+	}
+	void resize(size_t count) {
+		originX.resize(count);
+		originY.resize(count);
+		originZ.resize(count);
+		dirX.resize(count);
+		dirY.resize(count);
+		dirZ.resize(count);
+		length.resize(count);
+		slot.resize(count);
+		light.resize(count);
+		tile.resize(count);
+	}
+	inline void set(size_t i, const Vec3 &origin, const Vec3 &dir, float len, int s, uint32_t l, uint32_t t) {
+		originX[i] = origin.axis[AXIS_X];
+		originY[i] = origin.axis[AXIS_Y];
+		originZ[i] = origin.axis[AXIS_Z];
+		dirX[i] = dir.axis[AXIS_X];
+		dirY[i] = dir.axis[AXIS_Y];
+		dirZ[i] = dir.axis[AXIS_Z];
+		length[i] = len;
+		slot[i] = s;
+		light[i] = l;
+		tile[i] = t;
+	}
+	inline Ray ray(size_t i) const {
+		return Ray(Vec3(originX[i], originY[i], originZ[i]), Vec3(dirX[i], dirY[i], dirZ[i]));
+	}
+	void gather(const ShadowQueue &source, const std::vector<int> &indices) {
+		gatherArray(originX, source.originX, indices);
+		gatherArray(originY, source.originY, indices);
+		gatherArray(originZ, source.originZ, indices);
+		gatherArray(dirX, source.dirX, indices);
+		gatherArray(dirY, source.dirY, indices);
+		gatherArray(dirZ, source.dirZ, indices);
+		gatherArray(length, source.length, indices);
+		gatherArray(slot, source.slot, indices);
+		gatherArray(light, source.light, indices);
+		gatherArray(tile, source.tile, indices);
+	}
+};
+
+/* Renders in separate generate, extend, shade, occlusion and finish stages over queues of many rays
+instead of running Scene::shadeRay per pixel, and produces the same image
+each stage runs one kind of work over the whole queue, and queues can be sorted between stages so
+neighbouring rays traverse the same part of the scene */
+class Wavefront {
+private:
+	// rays being extended, and the next bounce
+	RayQueue queue, nextQueue, sorted;
+	// shade and finish write into these by hit index, they are compacted into the dense queues afterwards
+	RayQueue reflectSlots;
+	ShadowQueue shadowSlots, shadowQueue;
+	std::vector<uint8_t> reflects;
+	// per hit per light
+	std::vector<float> lightLum;
+	std::vector<uint8_t> lightState;
+	// per wavefront pixel
+	std::vector<float> colorR, colorG, colorB;
+	std::vector<Vec3> lightOffsets;
+	std::vector<int> indices, packetStarts;
+	std::vector<uint32_t> keys;
+	// first pixel and image width of the current wavefront
+	int first, width;
+	// whether the queued shadow rays were grouped into packets by the last shade
+	bool packeting;
+
+	// screen tile of a wavefront pixel
+	inline uint32_t pixelTile(int pixel) const {
+		int x = (first + pixel) % width;
+		int y = (first + pixel) / width;
+		return ((y / PACKET_TILE_SIZE) * ((width + PACKET_TILE_SIZE - 1) / PACKET_TILE_SIZE)) + (x / PACKET_TILE_SIZE);
+	}
+
+	// sorts indices by keys, keeping the current order for equal keys
+	void sortIndices() {
+		std::vector<int> order(indices.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [this](int a, int b) {return keys[a] < keys[b];});
+		std::vector<int> sortedIndices(indices.size());
+		for (size_t i = 0; i < order.size(); ++i) {
+			sortedIndices[i] = indices[order[i]];
+		}
+		indices.swap(sortedIndices);
+	}
+public:
+	int sortMode;
+	// trace primary hits' shadow rays as frustum packets, one per light per screen tile
+	// off by default, on the bench frame they only pay off slightly without reflections
+	bool shadowPackets;
+	// rays traced during the last render, by kind
+	size_t primaryRays, bounceRays, shadowRays, skippedShadowRays;
+	// shadow packets traced during the last render and the rays in them, the rest were traced one by one
+	size_t packets, packetRays;
+
+	Wavefront (int sortMode = WAVEFRONT_SORT_DIRECTION, bool shadowPackets = false) : first(0), width(1), packeting(false), sortMode(sortMode), shadowPackets(shadowPackets), primaryRays(0), bounceRays(0), shadowRays(0), skippedShadowRays(0), packets(0), packetRays(0) {}
+
+	// one primary ray per pixel, pixels [first, first + count) of a width wide image in scanline order
+	void generate(const Camera &camera, int width, int first, int count, unsigned int sample) {
+		PROFILE_ZONE("Wavefront generate");
+		this->first = first;
+		this->width = width;
+		queue.resize(count);
+		colorR.assign(count, 0);
+		colorG.assign(count, 0);
+		colorB.assign(count, 0);
+		lightOffsets.resize(count);
+
+		#pragma omp parallel for
+		for (int i = 0; i < count; ++i) {
+			int x = (first + i) % width;
+			int y = (first + i) / width;
+			float offsetX, offsetY;
+			Accumulator::jitter(x, y, sample, offsetX, offsetY, lightOffsets[i]);
+			queue.set(i, camera.primaryOrigin(x + offsetX, y + offsetY), CAMERA_ORTHO_DIR, i, 1);
+		}
+		primaryRays += count;
+	}
+
+	// closest hit of every queued ray, bins are only given for primary rays
+	void extend(const Scene &scene, const InstanceBins *bins = nullptr) {
+		PROFILE_ZONE("Wavefront extend");
+		int count = queue.size();
+
+		// each thread's zone ends as soon as it runs out of rays, so stragglers show up in captures
+		#pragma omp parallel
+		{
+			PROFILE_ZONE("Extend rays");
+			#pragma omp for schedule(dynamic, 64) nowait
+			for (int i = 0; i < count; ++i) {
+				Ray ray = queue.ray(i);
+				int instance = -1;
+				int pixel = first + queue.pixel[i];
+				BinRange bin;
+				if (bins && bins->bin(pixel % width, pixel / width, bin)) {
+					queue.depth[i] = scene.traceBinned(ray, bin, &instance);
+				} else {
+					queue.depth[i] = scene.trace<QUERY_CLOSEST>(ray, RAY_MISS, &instance);
+				}
+				queue.instance[i] = instance;
+				if (queue.depth[i] != RAY_MISS) {
+					queue.normalX[i] = ray.meshInfo.normal.axis[AXIS_X];
+					queue.normalY[i] = ray.meshInfo.normal.axis[AXIS_Y];
+					queue.normalZ[i] = ray.meshInfo.normal.axis[AXIS_Z];
+					queue.diffuseR[i] = ray.meshInfo.diffuse.axis[COLOR_R];
+					queue.diffuseG[i] = ray.meshInfo.diffuse.axis[COLOR_G];
+					queue.diffuseB[i] = ray.meshInfo.diffuse.axis[COLOR_B];
+				}
+			}
+		}
+
+		// group hits by the model they landed on, misses last
+		if (sortMode == WAVEFRONT_SORT_MODEL) {
+			indices.resize(count);
+			keys.resize(count);
+			for (int i = 0; i < count; ++i) {
+				indices[i] = i;
+				keys[i] = (uint32_t)queue.instance[i];
+			}
+			sortIndices();
+			sorted.gather(queue, indices);
+			std::swap(queue, sorted);
+		}
+	}
+
+	// light every hit, queueing a shadow ray for each shadow casting light that would add to it
+	void shade(const Scene &scene, int bounce) {
+		PROFILE_ZONE("Wavefront shade");
+		int count = queue.size();
+		int lightCount = scene.lights.size();
+		lightLum.resize(count * lightCount);
+		lightState.resize(count * lightCount);
+		shadowSlots.resize(count * lightCount);
+		size_t skipped = 0;
+
+		#pragma omp parallel for schedule(dynamic, 64) reduction(+:skipped)
+		for (int i = 0; i < count; ++i) {
+			if (queue.depth[i] == RAY_MISS) {
+				for (int l = 0; l < lightCount; ++l) {
+					lightState[(i * lightCount) + l] = LIGHT_UNLIT;
+				}
+				continue;
+			}
+			Ray ray = queue.ray(i);
+			Vec3 its = Vec3::add(ray.origin, Vec3::scale(ray.dir, queue.depth[i]));
+			Vec3 normal(queue.normalX[i], queue.normalY[i], queue.normalZ[i]);
+			const Vec3 &lightOffset = lightOffsets[queue.pixel[i]];
+
+			for (int l = 0; l < lightCount; ++l) {
+				const Light *light = scene.lights[l];
+				int slot = (i * lightCount) + l;
+				lightState[slot] = LIGHT_UNLIT;
+				if (light->shouldCastToPoint(its)) {
+					Vec3 lightPos = Vec3::add(light->pos, lightOffset);
+					Vec3 lightVec = Vec3::sub(its, lightPos);
+					Ray lightRay(lightPos, lightVec);
+					float lightRayLen = Vec3::lengthOf(lightVec);
+
+					float sDot = std::max(Vec3::dot(normal, lightRay.dir), 0.0f);
+					float sIntensity = light->intensity(lightRayLen);
+					lightLum[slot] = (sIntensity * sDot);
+					if (!light->shadowCast) {
+						lightState[slot] = LIGHT_LIT;
+					} else if (lightLum[slot] > 0) {
+						lightState[slot] = LIGHT_OCCLUSION_TEST;
+						shadowSlots.set(slot, lightPos, lightVec, lightRayLen, slot, l, pixelTile(queue.pixel[i]));
+					} else {
+						// the surface faces away, it would add nothing whether occluded or not
+						++skipped;
+					}
+				}
+			}
+		}
+		skippedShadowRays += skipped;
+
+		/* compact the shadow rays, in hit order unless sorting by light and direction
+		packets are only built from primary hits, reflected hits scatter too far for a tile's rays to share a frustum
+		they are then grouped by light and tile, keeping the direction order within each group for the rays that fall back */
+		indices.clear();
+		for (int slot = 0; slot < count * lightCount; ++slot) {
+			if (lightState[slot] == LIGHT_OCCLUSION_TEST) {
+				indices.push_back(slot);
+			}
+		}
+		packeting = shadowPackets && bounce == 0;
+		if (sortMode == WAVEFRONT_SORT_DIRECTION) {
+			keys.resize(indices.size());
+			for (size_t i = 0; i < indices.size(); ++i) {
+				int slot = indices[i];
+				keys[i] = (shadowSlots.light[slot] << 24) | directionKey(shadowSlots.dirX[slot], shadowSlots.dirY[slot], shadowSlots.dirZ[slot]);
+			}
+			sortIndices();
+		}
+		if (packeting) {
+			keys.resize(indices.size());
+			for (size_t i = 0; i < indices.size(); ++i) {
+				int slot = indices[i];
+				keys[i] = (shadowSlots.light[slot] << 24) | shadowSlots.tile[slot];
+			}
+			sortIndices();
+		}
+		shadowQueue.gather(shadowSlots, indices);
+		shadowRays += shadowQueue.size();
+	}
+
+	// any-hit test of every queued shadow ray
+	void occlude(const Scene &scene) {
+		PROFILE_ZONE("Wavefront occlude");
+		int count = shadowQueue.size();
+
+		if (!packeting) {
+			#pragma omp parallel
+			{
+				PROFILE_ZONE("Occlude rays");
+				#pragma omp for schedule(dynamic, 64) nowait
+				for (int i = 0; i < count; ++i) {
+					Ray lightRay = shadowQueue.ray(i);
+					float lightRayLen = shadowQueue.length[i];
+					lightState[shadowQueue.slot[i]] = eqMargin(scene.trace<QUERY_OCCLUSION>(lightRay, lightRayLen), lightRayLen) ? LIGHT_LIT : LIGHT_UNLIT;
+				}
+			}
+			return;
+		}
+
+		// each run of rays from one light into one tile is a packet
+		packetStarts.clear();
+		for (int i = 0; i < count; ++i) {
+			if (i == 0 || shadowQueue.light[i] != shadowQueue.light[i - 1] || shadowQueue.tile[i] != shadowQueue.tile[i - 1] || i - packetStarts.back() == PACKET_MAX_RAYS) {
+				packetStarts.push_back(i);
+			}
+		}
+		packetStarts.push_back(count);
+		int packetCount = packetStarts.size() - 1;
+		size_t tracedPackets = 0, tracedPacketRays = 0;
+
+		#pragma omp parallel reduction(+:tracedPackets, tracedPacketRays)
+		{
+			PROFILE_ZONE("Occlude packets");
+			ShadowPacket packet;
+			#pragma omp for schedule(dynamic) nowait
+			for (int p = 0; p < packetCount; ++p) {
+				packet.clear();
+				for (int i = packetStarts[p]; i < packetStarts[p + 1]; ++i) {
+					packet.add(shadowQueue.ray(i), shadowQueue.length[i]);
+				}
+				if (packet.build()) {
+					scene.occludePacket(packet);
+					for (int i = packetStarts[p]; i < packetStarts[p + 1]; ++i) {
+						lightState[shadowQueue.slot[i]] = packet.occluded[i - packetStarts[p]] ? LIGHT_UNLIT : LIGHT_LIT;
+					}
+					++tracedPackets;
+					tracedPacketRays += packet.size();
+				} else {
+					// origins differ, eg: jittered lights, or the rays spread too wide for a frustum
+					for (int i = packetStarts[p]; i < packetStarts[p + 1]; ++i) {
+						Ray lightRay = shadowQueue.ray(i);
+						float lightRayLen = shadowQueue.length[i];
+						lightState[shadowQueue.slot[i]] = eqMargin(scene.trace<QUERY_OCCLUSION>(lightRay, lightRayLen), lightRayLen) ? LIGHT_LIT : LIGHT_UNLIT;
+					}
+				}
+			}
+		}
+		packets += tracedPackets;
+		packetRays += tracedPacketRays;
+	}
+
+	// add each hit's color to its pixel and queue the reflected rays of the next bounce
+	void finish(const Scene &scene, int bounce) {
+		PROFILE_ZONE("Wavefront finish");
+		int count = queue.size();
+		int lightCount = scene.lights.size();
+		bool reflecting = scene.reflectivity > 0 && bounce < scene.maxBounces;
+		reflectSlots.resize(count);
+		reflects.assign(count, 0);
+
+		#pragma omp parallel for
+		for (int i = 0; i < count; ++i) {
+			int pixel = queue.pixel[i];
+			float weight = queue.weight[i];
+			Vec3 color = BACKGROUND_COLOR;
+
+			if (queue.depth[i] != RAY_MISS) {
+				float totalLum = AMBIENT_LIGHT;
+				Vec3 avgColor(queue.diffuseR[i], queue.diffuseG[i], queue.diffuseB[i]);
+				for (int l = 0; l < lightCount; ++l) {
+					int slot = (i * lightCount) + l;
+					if (lightState[slot] == LIGHT_LIT) {
+						Vec3::m_add(avgColor, Vec3::scale(scene.lights[l]->color, lightLum[slot]));
+						totalLum += lightLum[slot];
+					}
+				}
+				Vec3::m_normalize(avgColor);
+				Vec3::m_scale(avgColor, totalLum);
+				color = avgColor;
+
+				if (reflecting) {
+					Ray ray = queue.ray(i);
+					Vec3 its = Vec3::add(ray.origin, Vec3::scale(ray.dir, queue.depth[i]));
+					Vec3 reflectDir = Scene::reflect(ray.dir, Vec3(queue.normalX[i], queue.normalY[i], queue.normalZ[i]));
+					reflectSlots.set(i, Vec3::add(its, Vec3::scale(reflectDir, REFLECT_OFFSET)), reflectDir, pixel, weight * scene.reflectivity);
+					reflects[i] = 1;
+					weight *= 1 - scene.reflectivity;
+				}
+			}
+
+			// every pixel has one ray per bounce so there are no conflicting writes
+			colorR[pixel] += weight * color.axis[COLOR_R];
+			colorG[pixel] += weight * color.axis[COLOR_G];
+			colorB[pixel] += weight * color.axis[COLOR_B];
+		}
+
+		// compact the reflected rays, grouped by direction unless disabled
+		indices.clear();
+		for (int i = 0; i < count; ++i) {
+			if (reflects[i]) {
+				indices.push_back(i);
+			}
+		}
+		if (sortMode == WAVEFRONT_SORT_DIRECTION) {
+			keys.resize(indices.size());
+			for (size_t i = 0; i < indices.size(); ++i) {
+				int slot = indices[i];
+				keys[i] = directionKey(reflectSlots.dirX[slot], reflectSlots.dirY[slot], reflectSlots.dirZ[slot]);
+			}
+			sortIndices();
+		}
+		nextQueue.gather(reflectSlots, indices);
+		std::swap(queue, nextQueue);
+		bounceRays += queue.size();
+	}
+
+	// add one sample of every pixel of the accumulator
+	void render(const Camera &camera, Accumulator &accumulator, unsigned int sample) {
+		primaryRays = bounceRays = shadowRays = skippedShadowRays = packets = packetRays = 0;
+		int total = accumulator.width * accumulator.height;
+		for (int first = 0; first < total; first += WAVEFRONT_SIZE) {
+			int count = std::min(WAVEFRONT_SIZE, total - first);
+			generate(camera, accumulator.width, first, count, sample);
+			for (int bounce = 0; queue.size() > 0; ++bounce) {
+				extend(camera.scene, bounce == 0 ? &camera.bins : nullptr);
+				shade(camera.scene, bounce);
+				occlude(camera.scene);
+				finish(camera.scene, bounce);
+			}
+
+			#pragma omp parallel for
+			for (int i = 0; i < count; ++i) {
+				accumulator.add((first + i) % accumulator.width, (first + i) / accumulator.width, Vec3(colorR[i], colorG[i], colorB[i]));
+			}
+		}
+	}
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 
 #include <SDL2/SDL.h>
 #include <omp.h>
@@ -10,8 +12,27 @@
 #include "include/model.h"
 #include "include/light.h"
 #include "include/scene.h"
+#include "include/accumulator.h"
+#include "include/wavefront.h"
+#include "include/antialias.h"
+#include "include/demoscene.h"
+#include "include/profiler.h"
+#include "include/sharedframes.h"
 
 int main(int argc, char* argv[]) {
+	// ./main profile <first frame> <last frame> [trace.json], frame 0 includes loading
+	if (argc >= 4 && strcmp(argv[1], "profile") == 0) {
+		Profiler::capture(atoi(argv[2]), atoi(argv[3]), argc >= 5 ? argv[4] : "profile.json");
+	}
+	Profiler::nameThread("main");
+	// ./main shm [name] [slots], every new frame is also published to a shared memory ring for other processes
+	SharedFrameWriter sharedFrames;
+	if (argc >= 2 && strcmp(argv[1], "shm") == 0) {
+		if (!sharedFrames.open(argc >= 3 ? argv[2] : SHARED_FRAMES_NAME, SCREEN_WIDTH, SCREEN_HEIGHT, argc >= 4 ? atoi(argv[3]) : SHARED_FRAMES_SLOTS)) {
+			return 1;
+		}
+	}
+
 	SDL_Init(SDL_INIT_VIDEO);
 	SDL_Window *window = SDL_CreateWindow(WINDOW_NAME, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_FULLSCREEN | SDL_WINDOW_SHOWN);
 	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
@@ -22,27 +43,18 @@ int main(int argc, char* argv[]) {
 	std::chrono::high_resolution_clock::time_point startLoadTime = std::chrono::high_resolution_clock::now();
 
 	// Load scene
-	// TODO load the camera position/model list from file
-	Camera camera(Vec3(800, 800, 1500));
-
-	Model ball("models/ball.obj", true);
-	ModelInstance ball1(&ball, Vec3(600, 500, 0));
-	camera.scene.addModel(&ball1);
-	float ballVel = 10;
-
-	Model pillar("models/pillar.obj", true);
-	ModelInstance pillars[6];
-	for (int x = 0; x < 2; ++x) {
-		for (int y = 0; y < 3; ++y) {
-			pillars[(x * 3) + y] = ModelInstance(&pillar, Vec3(150 + x * 1600, 200 + y * 400, 0));
-			camera.scene.addModel(&pillars[(x * 3) + y]);
-		}
+	ProfileZone loadZone("Load");
+	DemoScene demo;
+	// ./main paged <pillar.clusters>, the pillars are traced out of core from a file written by ./render pack
+	if (argc >= 3 && strcmp(argv[1], "paged") == 0 && !demo.pagePillars(argv[2])) {
+		SDL_DestroyTexture(buffer);
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return 1;
 	}
-
-	Light camLight(Vec3(1, 0.5, 0), 150000, Vec3(500, 500, 500), true);
-	camera.scene.addLight(&camLight);
-	Light light2(Vec3(0.2, 0.5, 1), 150000, Vec3(1300, 100, 600), true);
-	camera.scene.addLight(&light2);
+	loadZone.end();
+	Camera &camera = demo.camera;
 	// Done loading scene
 
 	// time loading
@@ -50,12 +62,25 @@ int main(int argc, char* argv[]) {
 	double timePassed = duration.count();
 	printf("Loaded in %.2fs\n", timePassed);
 
+	// accumulates extra samples while the view is static
+	Accumulator accumulator(SCREEN_WIDTH, SCREEN_HEIGHT);
+	bool paused = false;
+	// staged renderer, toggled at runtime
+	Wavefront wavefront;
+	bool useWavefront = false;
+	// extra samples on edges only for the first sample after a change, toggled at runtime
+	EdgeAA edgeAA;
+	bool useEdgeAA = false;
+	// the ball's verts move every frame, toggled at runtime
+	bool deforming = false;
+
 	bool running = true;
 	int frames = 0;
 	std::chrono::high_resolution_clock::time_point prevTime = std::chrono::high_resolution_clock::now();
 	while (running) {
 		// handle user input
 		// polling must be done before key states are updated
+		ProfileZone inputZone("Input");
 		SDL_Event event;
 		while (SDL_PollEvent(&event) != 0) {
 			if (event.type == SDL_QUIT) {
@@ -63,6 +88,19 @@ int main(int argc, char* argv[]) {
 			} else if (event.type == SDL_KEYDOWN) {
 				if (event.key.keysym.sym == SDLK_ESCAPE) {
 					running = false;
+				} else if (event.key.keysym.sym == SDLK_SPACE) {
+					paused = !paused;
+				} else if (event.key.keysym.sym == SDLK_TAB) {
+					useWavefront = !useWavefront;
+					accumulator.reset();
+				} else if (event.key.keysym.sym == SDLK_F3) {
+					useEdgeAA = !useEdgeAA;
+					accumulator.reset();
+				} else if (event.key.keysym.sym == SDLK_F4) {
+					deforming = !deforming;
+				} else if (event.key.keysym.sym == SDLK_F2 && !Profiler::capturing()) {
+					// capture the next frames to a Chrome trace
+					Profiler::capture(Profiler::currentFrame() + 1, Profiler::currentFrame() + PROFILER_CAPTURE_FRAMES, "profile.json");
 				}
 			}
 		}
@@ -89,16 +127,23 @@ int main(int argc, char* argv[]) {
 		camera.pos.axis[AXIS_X] += xmov * movespeed;
 		camera.pos.axis[AXIS_Y] += ymov * movespeed;
 		camera.pos.axis[AXIS_Z] += zmov * movespeed;
+		inputZone.end();
+
+		ProfileZone updateZone("Scene update");
+		demo.followCamera();
+		if (!paused) {
+			demo.animate();
+			if (deforming) {
+				demo.deform();
+			}
+		}
+		camera.binInstances();
 
-		// light that follows camera
-		camLight.pos.axis[AXIS_X] = camera.pos.axis[AXIS_X];
-		camLight.pos.axis[AXIS_Y] = camera.pos.axis[AXIS_Y];
-
-		// animated model
-		if (ball1.pos.axis[AXIS_X] > 1200 || ball1.pos.axis[AXIS_X] < 600) {
-			ballVel *= -1;
+		// any change to the view throws away the accumulated samples
+		if (xmov != 0 || ymov != 0 || zmov != 0 || !paused) {
+			accumulator.reset();
 		}
-		ball1.pos.axis[AXIS_X] += ballVel;
+		updateZone.end();
 
 		// debug info
 		std::chrono::high_resolution_clock::time_point curTime = std::chrono::high_resolution_clock::now();
@@ -107,29 +152,82 @@ int main(int argc, char* argv[]) {
 		if (timePassed > PRINT_FPS_TIME) {
 			printf("FPS: %.1f - %.2fs per frame\n", frames/timePassed, timePassed/frames);
 			printf("\tx: %f y: %f z: %f\n", camera.pos.axis[AXIS_X], camera.pos.axis[AXIS_Y], camera.pos.axis[AXIS_Z]);
+			printf("\tsamples: %u/%u\n", accumulator.samples, accumulator.maxSamples);
+			printf("\tray cache: %.2f/%.2f MB, %ld tiles evicted\n", ModelRayCache::totalMemory() / (float)SIZE_MB, ModelRayCache::budget() / (float)SIZE_MB, ModelRayCache::evicted);
+			if (useEdgeAA) {
+				printf("\tedge AA: %.1f%% of pixels refined(%ld edges), %ld rays added to %ld\n", 100 * edgeAA.refinedFraction(), edgeAA.candidates, edgeAA.addedRays, edgeAA.baseRays);
+			}
+			if (demo.ball.dynamic) {
+				printf("\tball refit: %.3f ms, %ld tris moved, %ld cache entries invalidated, octree %.2fx its built cost, %ld rebuilds\n", demo.ball.refitMs,
+					demo.ball.refitMoved, demo.ball.refitInvalidated, demo.ball.refitCost, demo.ball.rebuilds);
+			}
+			if (PagedGeometry::active()) {
+				printf("\tpaged geometry: %ld clusters paged in(%.2f MB) last frame, %.2f/%.2f MB resident, %ld clusters evicted\n", PagedGeometry::lastFramePageIns,
+					PagedGeometry::lastFramePageInBytes / (float)SIZE_MB, PagedGeometry::memory() / (float)SIZE_MB, PagedGeometry::budget() / (float)SIZE_MB, PagedGeometry::evicted.load());
+			}
+			if (sharedFrames.opened()) {
+				printf("\tshared frames: %ld published, %ld dropped, %u consumers\n", (long)sharedFrames.frames, (long)sharedFrames.dropped(), sharedFrames.consumers());
+			}
+			if (useWavefront) {
+				printf("\twavefront: %ld primary, %ld bounce, %ld shadow rays, %ld shadow rays skipped\n", wavefront.primaryRays, wavefront.bounceRays, wavefront.shadowRays, wavefront.skippedShadowRays);
+				if (wavefront.shadowPackets) {
+					printf("\tshadow packets: %ld rays in %ld packets\n", wavefront.packetRays, wavefront.packets);
+				}
+			}
 
 			prevTime = curTime;
 			frames = 0;
 		}
 		++frames;
 
-		// lock buffer for editing
-		int pitch;
-		uint32_t *pixels;
-		SDL_LockTexture(buffer, NULL, (void **)&pixels, &pitch);
-
-		// dynamically assign rows to threads
-		#pragma omp parallel for schedule(dynamic)
-		for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-			for (int x = 0; x < SCREEN_WIDTH; ++x) {
-				pixels[ARRAY_INDEX(x,y,SCREEN_WIDTH)] = camera.renderPixel(x, y);
+		// once converged the last resolved frame is presented again without tracing
+		if (!accumulator.converged()) {
+			ProfileZone traceZone("Trace");
+			for (unsigned int i = accumulator.frameSamples(); i > 0; --i) {
+				unsigned int sample = accumulator.samples;
+				if (useEdgeAA && sample == 0) {
+					edgeAA.render(camera, accumulator);
+				} else if (useWavefront) {
+					wavefront.render(camera, accumulator, sample);
+				} else {
+					// dynamically assign rows to threads
+					#pragma omp parallel for schedule(dynamic)
+					for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+						PROFILE_ZONE_ARG("Trace row", y);
+						for (int x = 0; x < SCREEN_WIDTH; ++x) {
+							accumulator.add(x, y, camera.samplePixel(x, y, sample));
+						}
+					}
+				}
+				accumulator.endSample();
+			}
+			traceZone.end();
+			ModelRayCache::endFrame();
+			PagedGeometry::endFrame();
+
+			// lock buffer for editing
+			PROFILE_ZONE("Texture upload");
+			int pitch;
+			uint32_t *pixels;
+			SDL_LockTexture(buffer, NULL, (void **)&pixels, &pitch);
+			accumulator.resolve(pixels, pitch);
+			SDL_UnlockTexture(buffer);
+
+			// resolved straight into the ring, consumers map it without another copy
+			if (sharedFrames.opened()) {
+				PROFILE_ZONE("Shared frame");
+				accumulator.resolve(sharedFrames.beginFrame(), sharedFrames.pitch());
+				sharedFrames.publish();
 			}
 		}
 
 		// output buffer to screen
-		SDL_UnlockTexture(buffer);
-		SDL_RenderCopy(renderer, buffer, NULL, NULL);
-		SDL_RenderPresent(renderer);
+		{
+			PROFILE_ZONE("Present");
+			SDL_RenderCopy(renderer, buffer, NULL, NULL);
+			SDL_RenderPresent(renderer);
+		}
+		Profiler::endFrame();
 	}
 
 	SDL_DestroyTexture(buffer);
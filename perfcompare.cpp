@@ -0,0 +1,48 @@
+#include <cstdlib>
+#include <cstring>
+
+#include <stdio.h>
+
+#include "include/common.h"
+#include "include/perfrecord.h"
+
+/* Regression gate over two performance records written by ./render perf
+exits 1 if any metric got significantly worse, 2 if the records can't be read or weren't measured alike */
+
+static void usage() {
+	printf("Usage:\n");
+	printf("\tperfcompare <base.json> <test.json> [min change %%] [noise sigmas]\n");
+	printf("a change counts once it is past both min change(default %.0f%%) and that many sigmas(default %d) of the runs' noise\n", 100 * PERF_MIN_CHANGE, PERF_NOISE_SIGMAS);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 3 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+		usage();
+		return argc < 3 ? 2 : 0;
+	}
+	double minChange = argc >= 4 ? atof(argv[3]) / 100 : PERF_MIN_CHANGE;
+	double sigmas = argc >= 5 ? atof(argv[4]) : PERF_NOISE_SIGMAS;
+
+	PerfRecord base, test;
+	if (!base.read(argv[1]) || !test.read(argv[2])) {
+		return 2;
+	}
+	printf("base: %s %dx%d, %d threads, %d frames on %s, %s\n", base.scene.c_str(), base.width, base.height, base.threads, base.frames, base.host.c_str(), base.build.c_str());
+	printf("test: %s %dx%d, %d threads, %d frames on %s, %s\n", test.scene.c_str(), test.width, test.height, test.threads, test.frames, test.host.c_str(), test.build.c_str());
+	if (base.scene != test.scene || base.width != test.width || base.height != test.height || base.threads != test.threads) {
+		printf("Records are of different runs, compare the same scene, resolution and threads\n");
+		return 2;
+	}
+	// still compared, the numbers just say less
+	if (base.host != test.host) {
+		printf("Warning: records come from different hosts\n");
+	}
+
+	int regressions = PerfRecord::compare(base, test, minChange, sigmas);
+	if (regressions > 0) {
+		printf("%d significant regressions\n", regressions);
+		return 1;
+	}
+	printf("No significant regressions\n");
+	return 0;
+}
@@ -0,0 +1,491 @@
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <omp.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "include/common.h"
+#include "include/vec3.h"
+#include "include/scene.h"
+#include "include/demoscene.h"
+#include "include/antialias.h"
+#include "include/renderservice.h"
+#include "include/distributed.h"
+#include "include/profiler.h"
+#include "include/sharedframes.h"
+#include "include/perfrecord.h"
+
+/* Headless renderer for stills of the demo scene
+local renders in this process, coordinator splits the views into tiles for any number of worker processes
+stream renders the animation into shared memory for other processes, see framedump.cpp
+service renders many views of two scenes at once on one thread pool, with priorities and deadlines
+pack converts an OBJ into the cluster file PagedGeometry traces out of core
+perf times the animated demo scene by ray type and writes a record for perfcompare.cpp */
+
+static void usage() {
+	printf("Usage:\n");
+	printf("\trender local <width> <height> <out.ppm> [x y z] [aa] [paged <pillar.clusters>]\n");
+	printf("\trender coordinator <port> <width> <height> <out prefix> [x y z]... [spawn <workers>]\n");
+	printf("\trender worker <host> <port> [delay ms per tile] [die after tiles]\n");
+	printf("\trender stream <width> <height> <frames> [shm name] [slots]\n");
+	printf("\trender service <frames> [threads] [out prefix]\n");
+	printf("\trender pack <model.obj> <out.clusters> [tris per cluster]\n");
+	printf("\trender perf <width> <height> <frames> <out.json> [threads] [deform]\n");
+	printf("any mode may end with: profile <first frame> <last frame> <trace.json>, frames are tiles for workers, local renders frame 0\n");
+}
+
+// binary PPM, the X channel of RGBX8888 is dropped
+static bool writePPM(const char *filename, const uint32_t *pixels, int width, int height) {
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		printf("Could not open \"%s\"\n", filename);
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	std::vector<uint8_t> row(width * COLOR_NUM);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint32_t pixel = pixels[ARRAY_INDEX(x, y, width)];
+			row[(x * COLOR_NUM) + COLOR_R] = pixel >> 24;
+			row[(x * COLOR_NUM) + COLOR_G] = pixel >> 16;
+			row[(x * COLOR_NUM) + COLOR_B] = pixel >> 8;
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	fclose(file);
+	return true;
+}
+
+static Vec3 parseView(char **args) {
+	return Vec3(atof(args[0]), atof(args[1]), atof(args[2]));
+}
+
+static int renderLocal(int argc, char **argv) {
+	// the pillars traced out of core from a cluster file written by pack
+	const char *clusterFile = nullptr;
+	if (argc >= 7 && strcmp(argv[argc - 2], "paged") == 0) {
+		clusterFile = argv[argc - 1];
+		argc -= 2;
+	}
+	// adaptive edge anti-aliasing, refines at most AA_BUDGET of the pixels
+	bool edgeAA = argc >= 6 && strcmp(argv[argc - 1], "aa") == 0;
+	argc -= edgeAA;
+	if (argc < 5) {
+		usage();
+		return 1;
+	}
+	DemoScene demo;
+	if (clusterFile && !demo.pagePillars(clusterFile)) {
+		return 1;
+	}
+	Camera &camera = demo.camera;
+	camera.width = atoi(argv[2]);
+	camera.height = atoi(argv[3]);
+	if (argc >= 7) {
+		camera.pos = parseView(argv + 5);
+	}
+	demo.followCamera();
+	camera.binInstances();
+
+	std::vector<uint32_t> pixels(camera.width * camera.height);
+	EdgeAA antialias;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	ProfileZone traceZone("Trace");
+	if (edgeAA) {
+		Accumulator accumulator(camera.width, camera.height);
+		antialias.render(camera, accumulator);
+		accumulator.endSample();
+		accumulator.resolve(pixels.data(), camera.width * sizeof(uint32_t));
+	} else {
+		#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < camera.height; ++y) {
+			PROFILE_ZONE_ARG("Trace row", y);
+			for (int x = 0; x < camera.width; ++x) {
+				pixels[ARRAY_INDEX(x, y, camera.width)] = camera.renderPixel(x, y);
+			}
+		}
+	}
+	traceZone.end();
+	Profiler::endFrame();
+	PagedGeometry::endFrame();
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+	printf("Rendered %dx%d in %.3fs, %.2f Mpix/s, %d threads\n", camera.width, camera.height, duration.count(),
+		camera.width * camera.height / duration.count() / 1000000.0, omp_get_max_threads());
+	printf("Ray cache: %.2f MB\n", ModelRayCache::totalMemory() / (float)SIZE_MB);
+	if (PagedGeometry::active()) {
+		printf("Paged geometry: %ld clusters paged in(%.2f MB), %.2f/%.2f MB resident, %ld clusters evicted\n", PagedGeometry::lastFramePageIns,
+			PagedGeometry::lastFramePageInBytes / (float)SIZE_MB, PagedGeometry::memory() / (float)SIZE_MB, PagedGeometry::budget() / (float)SIZE_MB, PagedGeometry::evicted.load());
+	}
+	if (edgeAA) {
+		printf("Edge AA: %.1f%% of pixels refined(%ld edges), %ld rays added to %ld\n", 100 * antialias.refinedFraction(), antialias.candidates, antialias.addedRays, antialias.baseRays);
+	}
+	return writePPM(argv[4], pixels.data(), camera.width, camera.height) ? 0 : 1;
+}
+
+static int renderCoordinator(int argc, char **argv) {
+	if (argc < 6) {
+		usage();
+		return 1;
+	}
+	int port = atoi(argv[2]), width = atoi(argv[3]), height = atoi(argv[4]);
+	const char *prefix = argv[5];
+	int spawn = 0;
+	std::vector<Vec3> views;
+	for (int i = 6; i < argc;) {
+		if (strcmp(argv[i], "spawn") == 0 && i + 1 < argc) {
+			spawn = atoi(argv[i + 1]);
+			i += 2;
+		} else if (i + 2 < argc) {
+			views.push_back(parseView(argv + i));
+			i += 3;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	// the coordinator loads the scene too, only to know what workers must match
+	DemoScene demo;
+	if (views.empty()) {
+		views.push_back(demo.camera.pos);
+	}
+	TileCoordinator coordinator(width, height, views, demo.fingerprint());
+	if (!coordinator.listen(port)) {
+		printf("Could not listen on port %d\n", port);
+		return 1;
+	}
+	printf("Listening on port %d, scene %08x, %ld views of %dx%d\n", coordinator.port, coordinator.fingerprint, (long)views.size(), width, height);
+	fflush(stdout);
+
+	// local workers for testing on one host
+	std::vector<pid_t> children;
+	for (int i = 0; i < spawn; ++i) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			char portArg[16];
+			snprintf(portArg, sizeof(portArg), "%d", coordinator.port);
+			execl("/proc/self/exe", argv[0], "worker", "127.0.0.1", portArg, (char *)nullptr);
+			_exit(1);
+		} else if (pid > 0) {
+			children.push_back(pid);
+		}
+	}
+
+	bool rendered = coordinator.render();
+	coordinator.printStats();
+	for (pid_t child: children) {
+		waitpid(child, nullptr, 0);
+	}
+	if (!rendered) {
+		return 1;
+	}
+	for (size_t view = 0; view < views.size(); ++view) {
+		char filename[1024];
+		snprintf(filename, sizeof(filename), "%s%ld.ppm", prefix, (long)view);
+		if (!writePPM(filename, coordinator.images[view].data(), width, height)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int renderWorker(int argc, char **argv) {
+	if (argc < 4) {
+		usage();
+		return 1;
+	}
+	DemoScene demo;
+	TileWorker worker(demo, argc >= 5 ? atoi(argv[4]) : 0, argc >= 6 ? atoi(argv[5]) : -1);
+	bool done = worker.run(argv[2], atoi(argv[3]));
+	printf("Worker finished after %ld tiles, ray cache %.2f MB, %ld tiles evicted\n", worker.tiles, ModelRayCache::totalMemory() / (float)SIZE_MB, ModelRayCache::evicted);
+	return done ? 0 : 1;
+}
+
+// renders the animated demo scene straight into a shared memory ring, never waiting for whoever reads it
+static int renderStream(int argc, char **argv) {
+	if (argc < 5) {
+		usage();
+		return 1;
+	}
+	DemoScene demo;
+	Camera &camera = demo.camera;
+	camera.width = atoi(argv[2]);
+	camera.height = atoi(argv[3]);
+	int frames = atoi(argv[4]);
+	SharedFrameWriter sharedFrames;
+	if (!sharedFrames.open(argc >= 6 ? argv[5] : SHARED_FRAMES_NAME, camera.width, camera.height, argc >= 7 ? atoi(argv[6]) : SHARED_FRAMES_SLOTS)) {
+		return 1;
+	}
+	fflush(stdout);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frames; ++frame) {
+		demo.animate();
+		demo.followCamera();
+		camera.binInstances();
+		uint32_t *pixels = sharedFrames.beginFrame();
+		int rowPixels = sharedFrames.pitch() / sizeof(uint32_t);
+		ProfileZone traceZone("Trace");
+		#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < camera.height; ++y) {
+			PROFILE_ZONE_ARG("Trace row", y);
+			for (int x = 0; x < camera.width; ++x) {
+				pixels[ARRAY_INDEX(x, y, rowPixels)] = camera.renderPixel(x, y);
+			}
+		}
+		traceZone.end();
+		sharedFrames.publish();
+		ModelRayCache::endFrame();
+		PagedGeometry::endFrame();
+		Profiler::endFrame();
+	}
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+	printf("Streamed %d frames of %dx%d in %.3fs, %.1f fps, %ld dropped, %u consumers attached at the end\n", frames, camera.width, camera.height, duration.count(),
+		frames / duration.count(), (long)sharedFrames.dropped(), sharedFrames.consumers());
+	return 0;
+}
+
+/* a player view, a second player, a minimap of a second scene and thumbnails, all submitted every frame
+both scenes use the demo scene's models and instances, the minimap only sees the pillars under its own light */
+static int renderService(int argc, char **argv) {
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+	int frames = atoi(argv[2]);
+	int threads = argc >= 4 ? atoi(argv[3]) : (int)std::thread::hardware_concurrency();
+	const char *prefix = argc >= 5 ? argv[4] : nullptr;
+	DemoScene demo;
+	Scene minimapScene;
+	for (ModelInstance &pillar: demo.pillars) {
+		minimapScene.addModel(&pillar);
+	}
+	Light minimapLight(Vec3(1, 1, 1), 600000, Vec3(950, 600, 1500), false);
+	minimapScene.addLight(&minimapLight);
+
+	RenderService service(threads);
+	int demoScene = service.addScene(&demo.camera.scene);
+	int minimap = service.addScene(&minimapScene);
+	struct {
+		const char *name;
+		int scene, width, height, priority;
+		Vec3 pos;
+		double deadlineMs;
+	} views[] = {
+		{"player", demoScene, 1280, 720, 3, demo.camera.pos, 100},
+		{"player2", demoScene, 640, 360, 2, Vec3(1300, 600, 1500), 100},
+		{"minimap", minimap, 384, 384, 1, Vec3(300, 700, 1500), 200},
+		{"thumb0", demoScene, 128, 128, 0, Vec3(250, 300, 1500), 1000},
+		{"thumb1", demoScene, 128, 128, 0, Vec3(650, 550, 1500), 1000},
+		{"thumb2", demoScene, 128, 128, 0, Vec3(1850, 700, 1500), 1000},
+		{"thumb3", demoScene, 128, 128, 0, Vec3(250, 1100, 1500), 1000},
+	};
+	int viewCount = sizeof(views) / sizeof(views[0]);
+	std::vector<std::vector<uint32_t>> images(viewCount);
+	for (int i = 0; i < viewCount; ++i) {
+		service.addView(views[i].name, views[i].scene, views[i].pos, views[i].width, views[i].height);
+		images[i].resize(views[i].width * views[i].height);
+	}
+	std::vector<const Model *> models;
+	const Scene *scenes[] = {&demo.camera.scene, &minimapScene};
+	for (const Scene *scene: scenes) {
+		for (const ModelInstance *instance: scene->models) {
+			if (std::find(models.begin(), models.end(), instance->model) == models.end()) {
+				models.push_back(instance->model);
+			}
+		}
+	}
+	printf("%d views of 2 scenes sharing %ld models, %d threads\n", viewCount, (long)models.size(), service.threadCount());
+	fflush(stdout);
+
+	for (int frame = 0; frame < frames; ++frame) {
+		// the scene only changes while nothing is rendering it
+		demo.animate();
+		demo.followCamera();
+		// lowest priority first, the pool still takes the players' rows ahead of them
+		for (int i = viewCount - 1; i >= 0; --i) {
+			service.submit(i, images[i].data(), views[i].priority, views[i].deadlineMs);
+		}
+		service.waitIdle();
+	}
+	service.printStats();
+
+	if (prefix) {
+		for (int i = 0; i < viewCount; ++i) {
+			char filename[1024];
+			snprintf(filename, sizeof(filename), "%s%s.ppm", prefix, views[i].name);
+			if (!writePPM(filename, images[i].data(), views[i].width, views[i].height)) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+// the only step that holds the whole mesh in memory, tracing the written file pages clusters in as rays reach them
+static int renderPack(int argc, char **argv) {
+	if (argc < 4) {
+		usage();
+		return 1;
+	}
+	Model model(argv[2], false);
+	int clusterTris = argc >= 5 ? atoi(argv[4]) : PAGING_CLUSTER_TRIS;
+	if (model.tris.size() == 0 || clusterTris <= 0) {
+		return 1;
+	}
+	return PagedGeometry::write(argv[3], model.tris, model.triMaterials, model.materials, clusterTris) ? 0 : 1;
+}
+
+/* renders frames of the animation, then traces their primary and shadow rays again on their own so each ray type has its own rate
+the same frames and views every run, so records of one machine compare across commits */
+static int renderPerf(int argc, char **argv) {
+	// the ball's verts move and its octree is refit every frame
+	bool deform = argc >= 7 && strcmp(argv[argc - 1], "deform") == 0;
+	argc -= deform;
+	if (argc < 6) {
+		usage();
+		return 1;
+	}
+	if (argc >= 7) {
+		omp_set_num_threads(atoi(argv[6]));
+	}
+	DemoScene demo;
+	Camera &camera = demo.camera;
+	camera.width = atoi(argv[2]);
+	camera.height = atoi(argv[3]);
+	int frames = atoi(argv[4]);
+	const Scene &scene = camera.scene;
+	PerfRecord record(deform ? "demo deforming" : "demo", camera.width, camera.height, omp_get_max_threads());
+	record.frames = frames;
+	printf("Timing %d frames of %dx%d after %d warm up frames, %d threads\n", frames, camera.width, camera.height, PERF_WARMUP_FRAMES, record.threads);
+	fflush(stdout);
+
+	int pixels = camera.width * camera.height;
+	std::vector<uint32_t> image(pixels);
+	// primary hit points, the shadow pass casts from these
+	std::vector<Vec3> hits(pixels);
+	std::vector<uint8_t> hit(pixels);
+	std::vector<double> frameMs, pixelRates, primaryRates, shadowRates, refitMs;
+	typedef std::chrono::steady_clock Clock;
+	for (int frame = 0; frame < frames + PERF_WARMUP_FRAMES; ++frame) {
+		demo.animate();
+		if (deform) {
+			demo.deform();
+		}
+		demo.followCamera();
+		Clock::time_point start = Clock::now();
+		camera.binInstances();
+		ProfileZone traceZone("Trace");
+		#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < camera.height; ++y) {
+			PROFILE_ZONE_ARG("Trace row", y);
+			for (int x = 0; x < camera.width; ++x) {
+				image[ARRAY_INDEX(x, y, camera.width)] = camera.renderPixel(x, y);
+			}
+		}
+		traceZone.end();
+		Clock::time_point traced = Clock::now();
+
+		ProfileZone primaryZone("Primary rays");
+		#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < camera.height; ++y) {
+			for (int x = 0; x < camera.width; ++x) {
+				int i = ARRAY_INDEX(x, y, camera.width);
+				Ray ray = camera.primaryRay(x, y);
+				BinRange bin;
+				float depth = camera.bins.bin(x, y, bin) ? scene.traceBinned(ray, bin) : scene.trace<QUERY_CLOSEST>(ray);
+				hit[i] = depth != RAY_MISS;
+				hits[i] = Vec3::add(ray.origin, Vec3::scale(ray.dir, depth));
+			}
+		}
+		primaryZone.end();
+		Clock::time_point primaryEnd = Clock::now();
+
+		long shadowRays = 0;
+		ProfileZone shadowZone("Shadow rays");
+		#pragma omp parallel for schedule(dynamic) reduction(+:shadowRays)
+		for (int y = 0; y < camera.height; ++y) {
+			for (int x = 0; x < camera.width; ++x) {
+				int i = ARRAY_INDEX(x, y, camera.width);
+				if (!hit[i]) {
+					continue;
+				}
+				for (const Light *light: scene.lights) {
+					if (light->shadowCast && light->shouldCastToPoint(hits[i])) {
+						Vec3 lightVec = Vec3::sub(hits[i], light->pos);
+						Ray lightRay(light->pos, lightVec);
+						scene.trace<QUERY_OCCLUSION>(lightRay, Vec3::lengthOf(lightVec));
+						++shadowRays;
+					}
+				}
+			}
+		}
+		shadowZone.end();
+		Clock::time_point shadowEnd = Clock::now();
+		ModelRayCache::endFrame();
+		PagedGeometry::endFrame();
+		Profiler::endFrame();
+
+		if (frame < PERF_WARMUP_FRAMES) {
+			continue;
+		}
+		double traceSeconds = std::chrono::duration<double>(traced - start).count();
+		double primarySeconds = std::chrono::duration<double>(primaryEnd - traced).count();
+		double shadowSeconds = std::chrono::duration<double>(shadowEnd - primaryEnd).count();
+		frameMs.push_back(traceSeconds * 1000);
+		pixelRates.push_back(pixels / traceSeconds);
+		primaryRates.push_back(pixels / primarySeconds);
+		if (shadowRays > 0) {
+			shadowRates.push_back(shadowRays / shadowSeconds);
+		}
+		if (deform) {
+			refitMs.push_back(demo.ball.refitMs);
+		}
+	}
+
+	record.addMedian("pixels_per_s", "pixels/s", true, pixelRates);
+	record.addMedian("primary_rays_per_s", "rays/s", true, primaryRates);
+	record.addMedian("shadow_rays_per_s", "rays/s", true, shadowRates);
+	record.addPercentiles("frame_ms", "ms", frameMs);
+	record.addMedian("refit_ms", "ms", false, refitMs);
+	record.add("ray_cache_mb", "MB", false, ModelRayCache::totalMemory() / (double)SIZE_MB);
+	record.add("peak_memory_mb", "MB", false, PerfRecord::peakMemory());
+	for (const PerfMetric &metric: record.metrics) {
+		printf("%-24s %14.4g %-10s +-%.4g\n", metric.name.c_str(), metric.value, metric.unit.c_str(), metric.noise);
+	}
+	return record.write(argv[5]) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	// trailing capture request, stripped before the mode's own arguments are read
+	for (int i = 2; i + 3 < argc; ++i) {
+		if (strcmp(argv[i], "profile") == 0) {
+			Profiler::capture(atoi(argv[i + 1]), atoi(argv[i + 2]), argv[i + 3]);
+			argc = i;
+			break;
+		}
+	}
+	Profiler::nameThread("main");
+
+	if (argc >= 2 && strcmp(argv[1], "local") == 0) {
+		return renderLocal(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "coordinator") == 0) {
+		return renderCoordinator(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "worker") == 0) {
+		return renderWorker(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "stream") == 0) {
+		return renderStream(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "service") == 0) {
+		return renderService(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "pack") == 0) {
+		return renderPack(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "perf") == 0) {
+		return renderPerf(argc, argv);
+	}
+	usage();
+	return 1;
+}